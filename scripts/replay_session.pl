@@ -0,0 +1,223 @@
+#! /usr/bin/perl
+
+=head1 NAME
+
+replay_session.pl - play back a controller session recorded by --record-sessions
+
+=head1 SYNOPSIS
+
+  replay_session.pl [OPTIONS] RECORD_FILE [-- DAEMONPROXY_ARGS]
+
+=head1 DESCRIPTION
+
+Starts a daemonproxy in interactive mode and sends it the commands of one
+session from RECORD_FILE, at the same relative times they were recorded,
+while reading its output.  When the session is done, prints a report of
+throughput, overflows, errors, and command latency, such as:
+
+  session      1
+  commands     1200
+  elapsed      3.512
+  commands/s   341.7
+  lines_out    2409
+  overflows    0
+  errors       0
+  latency_ms   min 0.081 avg 0.240 p99 1.830 max 2.114
+
+Latency is measured by sending "echo" after every --probe-every commands and
+timing the reply, so it includes any time the command had to wait behind
+earlier output.
+
+=head1 OPTIONS
+
+=over
+
+=item --daemonproxy PATH
+
+The daemonproxy binary to test.  Defaults to build/daemonproxy.
+
+=item --session N
+
+Which session in the file to play.  Defaults to the first one which ran any
+commands.
+
+=item --fast
+
+Send commands as quickly as daemonproxy takes them, rather than at their
+recorded times.
+
+=item --paced-reads
+
+Read daemonproxy's output no faster than the recorded controller did, to
+reproduce overflows caused by a slow controller script.
+
+=item --simulate
+
+Run daemonproxy with --simulate, so that services are pretend processes.  The
+recorded gaps between commands become sim.advance commands instead of real
+waits, so the session plays as fast as possible.
+
+=item --probe-every N
+
+Send a latency probe after every N commands (default 20).
+
+=back
+
+=head1 COPYRIGHT
+
+Copyright (C) 2014 Michael Conrad <mike@nrdvana.net>
+
+Distributed under GPLv2, see LICENSE
+
+=cut
+
+use strict;
+use warnings;
+use Getopt::Long;
+use IO::Select;
+use IO::Handle;
+use Fcntl;
+use POSIX ();
+use Time::HiRes qw( time sleep );
+
+my $dp_path= 'build/daemonproxy';
+my ($session, $fast, $paced_reads, $simulate);
+my $probe_every= 20;
+GetOptions(
+	'daemonproxy=s' => \$dp_path,
+	'session=i'     => \$session,
+	'fast'          => \$fast,
+	'paced-reads'   => \$paced_reads,
+	'simulate'      => \$simulate,
+	'probe-every=i' => \$probe_every,
+) && @ARGV or die "Usage: $0 [OPTIONS] RECORD_FILE [-- DAEMONPROXY_ARGS]\n";
+my ($record_file, @dp_args)= @ARGV;
+$probe_every= 1 if $probe_every < 1;
+
+# Load the commands and reads of the chosen session, relative to its start
+my (@cmds, @reads, %start);
+open(my $rec, '<', $record_file) or die "open($record_file): $!\n";
+while (<$rec>) {
+	chomp;
+	next if /^#/;
+	my ($t, $sess, $type, $data)= split /\t/, $_, 4;
+	next if defined $session && $sess != $session;
+	$start{$sess}= $t if $type eq 'open';
+	if ($type eq 'cmd') {
+		$session= $sess;
+		push @cmds, [ $t - ($start{$sess} || 0), $data ];
+	}
+	elsif ($type eq 'read' && defined $session && $sess == $session) {
+		push @reads, [ $t - ($start{$sess} || 0), $data + (@reads? $reads[-1][1] : 0) ];
+	}
+}
+close $rec;
+@cmds or die "No commands recorded".(defined $session? " for session $session" : "")."\n";
+
+# Start daemonproxy on a pair of pipes
+pipe(my $child_in, my $to_dp) or die "pipe: $!";
+pipe(my $from_dp, my $child_out) or die "pipe: $!";
+defined(my $pid= fork()) or die "fork: $!";
+if (!$pid) {
+	close $to_dp; close $from_dp;
+	POSIX::dup2(fileno $child_in, 0) or die "dup2: $!";
+	POSIX::dup2(fileno $child_out, 1) or die "dup2: $!";
+	exec($dp_path, '-i', ($simulate? ('--simulate') : ()), @dp_args)
+		or die "exec($dp_path): $!";
+}
+close $child_in; close $child_out;
+for ($to_dp, $from_dp) {
+	my $flags= fcntl($_, F_GETFL, 0) or die "fcntl: $!";
+	fcntl($_, F_SETFL, $flags | O_NONBLOCK) or die "fcntl: $!";
+}
+
+my ($out_buf, $in_buf)= ('', '');
+my ($read_total, $lines_out, $overflows, $errors)= (0, 0, 0, 0);
+my (%probe_sent, @latency);
+my ($next_cmd, $next_probe, $sim_secs, $eof)= (0, 0, 0, 0);
+my $t0= time;
+
+sub allowed_read {
+	my $now= shift;
+	# once the recorded reads are used up, drain whatever is left
+	return undef unless $paced_reads && !$simulate && @reads && $now <= $reads[-1][0];
+	my $allowed= 0;
+	for (@reads) { last if $_->[0] > $now; $allowed= $_->[1]; }
+	return $allowed;
+}
+
+sub process_output {
+	while ($in_buf =~ s/^([^\n]*)\n//) {
+		my $line= $1;
+		$lines_out++;
+		if ($line eq 'overflow') { $overflows++ }
+		elsif ($line =~ /^error\t/) { $errors++ }
+		elsif ($line =~ /^replay-probe\t(\d+)$/ && $probe_sent{$1}) {
+			push @latency, time - delete $probe_sent{$1};
+		}
+	}
+}
+
+my $sel_r= IO::Select->new($from_dp);
+while (!$eof) {
+	my $now= time - $t0;
+	# queue every command which is due
+	while ($next_cmd < @cmds && ($fast || $simulate || $cmds[$next_cmd][0] <= $now)) {
+		my ($t, $text)= @{ $cmds[$next_cmd++] };
+		if ($simulate && int($t) > $sim_secs) {
+			$out_buf .= "sim.advance\t".(int($t) - $sim_secs)."\n";
+			$sim_secs= int($t);
+		}
+		$out_buf .= "$text\n";
+		if ($next_cmd % $probe_every == 0 || $next_cmd == @cmds) {
+			$out_buf .= "echo\treplay-probe\t".(++$next_probe)."\n";
+			$probe_sent{$next_probe}= undef;
+		}
+	}
+	if (length $out_buf) {
+		my $n= syswrite($to_dp, $out_buf);
+		if ($n) {
+			# probes are timed from when they were written
+			my $sent= substr($out_buf, 0, $n, '');
+			$probe_sent{$1}= time while $sent =~ /^echo\treplay-probe\t(\d+)$/mg;
+		}
+		elsif (!defined $n && !$!{EAGAIN}) {
+			last;
+		}
+	}
+	elsif ($next_cmd >= @cmds && !%probe_sent) {
+		# everything answered; let daemonproxy exit
+		close $to_dp if $to_dp->opened;
+	}
+	my $allowed= allowed_read($now);
+	my $want= !defined $allowed? 65536 : $allowed - $read_total;
+	my $wait= $next_cmd < @cmds && !$fast && !$simulate? $cmds[$next_cmd][0] - $now : 0.05;
+	$wait= 0 if length $out_buf && $wait > 0.001;
+	if ($want > 0 && $sel_r->can_read($wait < 0? 0 : $wait)) {
+		my $n= sysread($from_dp, $in_buf, $want > 65536? 65536 : $want, length $in_buf);
+		if (!$n) { $eof= 1 unless !defined $n && $!{EAGAIN}; }
+		else { $read_total += $n; process_output(); }
+	}
+	elsif ($want <= 0) {
+		sleep($wait > 0.01 || $wait <= 0? 0.01 : $wait);
+	}
+}
+my $elapsed= time - $t0;
+waitpid($pid, 0);
+
+my @sorted= sort { $a <=> $b } @latency;
+my $avg= 0; $avg += $_ for @sorted; $avg /= @sorted if @sorted;
+printf "session      %d\n", $session;
+printf "commands     %d\n", scalar @cmds;
+printf "elapsed      %.3f\n", $elapsed;
+printf "commands/s   %.1f\n", @cmds / ($elapsed || 1e-6);
+printf "lines_out    %d\n", $lines_out;
+printf "overflows    %d\n", $overflows;
+printf "errors       %d\n", $errors;
+if (@sorted) {
+	printf "latency_ms   min %.3f avg %.3f p99 %.3f max %.3f\n",
+		map { $_ * 1000 } $sorted[0], $avg, $sorted[int($#sorted * .99)], $sorted[-1];
+}
+else {
+	print "latency_ms   -\n";
+}
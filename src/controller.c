@@ -5,13 +5,35 @@
 
 #include "config.h"
 #include "daemonproxy.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 
 struct controller_s;
 typedef bool ctl_state_fn_t(struct controller_s *);
 
-// One for current (possibly partial) message, and one for a possible
-// following message while we look for the end of the first message.
-#define CONTROLLER_RECV_MAX_ANCILLARY_FD 2
+// Most descriptors the kernel will pass in one message (SCM_MAX_FD on Linux)
+#define CONTROLLER_RECV_MAX_MSG_FD 253
+
+// Room for a full batch with the current (possibly partial) message, and one
+// for a possible following message while we look for the end of the first.
+#define CONTROLLER_RECV_MAX_ANCILLARY_FD (CONTROLLER_RECV_MAX_MSG_FD * 2)
+
+// Output is queued in two lanes.  Broadcast events and signals go in the
+// event lane, which is always flushed first.  Replies to the controller's own
+// commands (including statedump) go in the bulk lane, so that a large reply
+// can't hold back events or cause them to overflow.
+#define CTL_LANE_BULK  0
+#define CTL_LANE_EVENT 1
+#define CTL_LANE_COUNT 2
+
+typedef struct ctl_lane_s {
+	char *buf;                 // from the buffer pool, or NULL until first use
+	int  size;
+	int  pos;
+	bool overflow;
+	bool partial;              // a line was partially written; finish it before switching lanes
+} ctl_lane_t;
 
 struct controller_s {
 	ctl_state_fn_t *state_fn;
@@ -20,20 +42,22 @@ struct controller_s {
 	int  recv_fd;
 	bool recv_is_socket;
 	bool append_final_newline;
-	char recv_buf[CONTROLLER_RECV_BUF_SIZE];
+	char *recv_buf;            // from the buffer pool, or NULL until first use
+	int  recv_buf_size;
 	int  recv_buf_pos;
 	bool recv_overflow;
 	int  recv_ancillary_fd[CONTROLLER_RECV_MAX_ANCILLARY_FD];
 	int  recv_ancillary_fd_count;
 	
 	int  send_fd;
-	char send_buf[CONTROLLER_SEND_BUF_SIZE];
-	int  send_buf_pos;
-	bool send_overflow;
+	ctl_lane_t send_lane[CTL_LANE_COUNT];
+	int  direct_lane;          // lane used by ctl_write to this controller alone
 	int64_t write_timeout_reset;
 	int64_t write_timeout_close;
 	int64_t send_blocked_ts;
 	int64_t last_signal_ts;
+	int64_t buf_active_ts;     // last time a buffer held data; idle buffers are released
+	service_t *service;        // service this controller was created for, if any
 	
 	int      line_len;         // length of current command in recv_buf
 	strseg_t command_name;     // str segment of command name (within recv_buf)
@@ -42,12 +66,28 @@ struct controller_s {
 	char     command_error_buf[64];// buffer in case we want to write a custom error msg
 	
 	int     command_substate;  // generic state machine variable for long-running commands
-	char    statedump_current[NAME_BUF_SIZE]; // state for the statedump command
-	int64_t statedump_ts;      // state for the statedump command
+	uint64_t statedump_epoch;  // objects created at or after this epoch are not dumped
+	fd_t   *statedump_fd;      // next fd object to be dumped
+	service_t *statedump_svc;  // next service to be dumped (or listed by service.history)
+	int64_t statedump_ts;      // last signal reported by the statedump command
+	char    send_fds_msg[64];  // reply which carries file descriptors (ctl_state_send_fds)
+	int     send_fds_msg_len;
+	int     send_fds[FD_SEND_MAX];
+	int     send_fds_count;
+	bool    send_fds_close;    // send_fds are our own duplicates, close after sending
+	strseg_t fs_name, fs_path;  // fd.open in progress in a fs worker
+	fd_flags_t fs_flags;
+	int     fs_open_flags;
+	int     fs_worker;
+	int64_t sim_target;        // sim.advance in progress
+	uint32_t flight_end;       // flight.dump stops at this entry
+	int     record_session;    // session number in the --record-sessions file, or 0
 };
 
 controller_t client[CONTROLLER_MAX_CLIENTS];
 
+uint64_t ctl_snapshot_epoch= 0;
+
 // Each of the following functions returns true/false of whether to continue
 //  processing (true), or yield until later (false).
 
@@ -60,6 +100,13 @@ STATE(ctl_state_free);
 STATE(ctl_state_dump_fds);
 STATE(ctl_state_dump_services);
 STATE(ctl_state_dump_signals);
+STATE(ctl_state_send_fds);
+STATE(ctl_state_fd_open_wait);
+STATE(ctl_state_svc_history);
+STATE(ctl_state_sim_advance);
+STATE(ctl_state_flight_dump);
+STATE(ctl_state_signal_routes);
+STATE(ctl_state_rule_list);
 
 // Each of the command functions returns true on success,
 // or sets ctl->command_error to an error message and returns false.
@@ -73,29 +120,63 @@ COMMAND(ctl_cmd_svc_tags,            "service.tags");
 COMMAND(ctl_cmd_svc_args,            "service.args");
 COMMAND(ctl_cmd_svc_fds,             "service.fds");
 COMMAND(ctl_cmd_svc_auto_up,         "service.auto_up");
+COMMAND(ctl_cmd_svc_probe,           "service.probe");
+COMMAND(ctl_cmd_svc_watchdog,        "service.watchdog");
+COMMAND(ctl_cmd_svc_max_runtime,     "service.max_runtime");
+COMMAND(ctl_cmd_svc_spare,           "service.spare");
+COMMAND(ctl_cmd_svc_history,         "service.history");
+COMMAND(ctl_cmd_svc_heartbeat,       "service.heartbeat");
+COMMAND(ctl_cmd_svc_ready,           "service.ready");
+COMMAND(ctl_cmd_svc_replace,         "service.replace");
 COMMAND(ctl_cmd_svc_start,           "service.start");
 COMMAND(ctl_cmd_svc_signal,          "service.signal");
 COMMAND(ctl_cmd_svc_delete,          "service.delete");
 COMMAND(ctl_cmd_socket_create,       "socket.create");
 COMMAND(ctl_cmd_socket_delete,       "socket.delete");
 COMMAND(ctl_cmd_fd_pipe,             "fd.pipe");
+COMMAND(ctl_cmd_fd_memfd,            "fd.memfd");
+COMMAND(ctl_cmd_fd_append,           "fd.append");
+COMMAND(ctl_cmd_fd_seal,             "fd.seal");
+COMMAND(ctl_cmd_fd_eventfd,          "fd.eventfd");
+COMMAND(ctl_cmd_fd_timerfd,          "fd.timerfd");
 COMMAND(ctl_cmd_fd_open,             "fd.open");
 COMMAND(ctl_cmd_fd_socket,           "fd.socket");
 COMMAND(ctl_cmd_fd_delete,           "fd.delete");
 COMMAND(ctl_cmd_fd_take,             "fd.take");
+COMMAND(ctl_cmd_fd_fetch,            "fd.fetch");
 COMMAND(ctl_cmd_chdir,               "chdir");
 COMMAND(ctl_cmd_exit,                "exit");
+COMMAND(ctl_cmd_flight_dump,         "flight.dump");
+COMMAND(ctl_cmd_flight_dest,         "flight.dest");
 COMMAND(ctl_cmd_log_filter,          "log.filter");
 COMMAND(ctl_cmd_log_dest,            "log.dest");
 COMMAND(ctl_cmd_event_pipe_timeout,  "conn.event_timeout");
+COMMAND(ctl_cmd_event_coalesce,      "event.coalesce");
+COMMAND(ctl_cmd_event_ring,          "event.ring");
+COMMAND(ctl_cmd_rule_set,            "rule.set");
+COMMAND(ctl_cmd_rule_delete,         "rule.delete");
+COMMAND(ctl_cmd_rule_list,           "rule.list");
 COMMAND(ctl_cmd_signal_clear,        "signal.clear");
+COMMAND(ctl_cmd_signal_route,        "signal.route");
+COMMAND(ctl_cmd_sim_advance,         "sim.advance");
+COMMAND(ctl_cmd_sim_exit,            "sim.exit");
 COMMAND(ctl_cmd_terminate_exec_args, "terminate.exec_args");
 COMMAND(ctl_cmd_terminate_guard,     "terminate.guard");
 COMMAND(ctl_cmd_terminate,           "terminate");
 
+static void ctl_report_command_error(controller_t *ctl);
+static void ctl_clear_send_fds(controller_t *ctl);
+static void ctl_close_ancillary_fds(controller_t *ctl);
+static bool ctl_fd_open_finish(controller_t *ctl, strseg_t fdname, fd_flags_t flags, strseg_t path, int f);
 static bool ctl_read_more(controller_t *ctl);
 static bool ctl_flush_outbuf(controller_t *ctl);
 static bool ctl_out_buf_ready(controller_t *ctl);
+static bool ctl_send_pending(controller_t *ctl);
+static bool ctl_recv_buf_room(controller_t *ctl);
+static bool ctl_lane_reserve(ctl_lane_t *lane, int need);
+static void ctl_release_idle_bufs(controller_t *ctl);
+static void ctl_drop_superseded(controller_t *ctl, const char *msg, int msg_len);
+static bool ctl_deliver_signals(controller_t *ctl, int64_t *last_signal_ts);
 static void ctl_read_ancillary_fds(controller_t *ctl, struct msghdr *msg);
 
 //
@@ -124,6 +205,7 @@ static bool ctl_get_arg_ts(controller_t *ctl, int64_t *ts);
 static bool ctl_get_arg_service(controller_t *ctl, bool existing, strseg_t *name_out, service_t **svc_out);
 static bool ctl_get_arg_fd(controller_t *ctl, bool existing, bool assignable, strseg_t *name_out, fd_t **fd_out);
 static bool ctl_get_arg_signal(controller_t *ctl, int *sig_out);
+static void ctl_format_svc_state_extra(char *buf, size_t bufsize, service_t *svc);
 
 //
 // Here we define a static hash table of commands, and methods to access them.
@@ -193,6 +275,64 @@ controller_t *ctl_alloc() {
 	return NULL;
 }
 
+/* Receive and send buffers are taken from a small pool when first needed,
+ * rather than being part of the controller object.  They come in power-of-two
+ * sizes starting at CONTROLLER_BUF_MIN and double (up to the receive or send
+ * cap) when a command or output doesn't fit.  Once a buffer has been empty for
+ * CONTROLLER_BUF_IDLE_TIMEOUT it goes back to the pool, which keeps one spare
+ * buffer of each size and frees the rest.
+ */
+#define CTL_BUF_CLASS_COUNT 8
+static char *ctl_buf_spare[CTL_BUF_CLASS_COUNT];
+
+static int ctl_buf_class(int size) {
+	int cls= 0;
+	while ((CONTROLLER_BUF_MIN << cls) < size)
+		cls++;
+	assert(cls < CTL_BUF_CLASS_COUNT);
+	return cls;
+}
+
+static void ctl_buf_put(char *buf, int size) {
+	int cls;
+	if (!buf)
+		return;
+	cls= ctl_buf_class(size);
+	if (ctl_buf_spare[cls])
+		free(buf);
+	else
+		ctl_buf_spare[cls]= buf;
+}
+
+/** Move a buffer's contents into a buffer of at least need bytes (but not
+ * more than limit), keeping the first used bytes.
+ *
+ * Returns false if the buffer can't be made that large.
+ */
+static bool ctl_buf_grow(char **buf, int *size, int used, int need, int limit) {
+	int new_size= *size? *size : CONTROLLER_BUF_MIN, cls;
+	char *new_buf;
+	while (new_size < need && new_size < limit)
+		new_size <<= 1;
+	if (new_size < need)
+		return false;
+	if (new_size == *size)
+		return true;
+	cls= ctl_buf_class(new_size);
+	if ((new_buf= ctl_buf_spare[cls]))
+		ctl_buf_spare[cls]= NULL;
+	else if (!(new_buf= malloc(new_size))) {
+		log_error("malloc(%d): %s", new_size, strerror(errno));
+		return false;
+	}
+	if (used)
+		memcpy(new_buf, *buf, used);
+	ctl_buf_put(*buf, *size);
+	*buf= new_buf;
+	*size= new_size;
+	return true;
+}
+
 /* Constructor (not including alloc)
  *
  * Initialize and bind a controller object to a pair of in/out handles.
@@ -224,25 +364,112 @@ bool ctl_ctor(controller_t *ctl, int recv_fd, int send_fd) {
 	ctl->send_fd= send_fd;
 	ctl->write_timeout_reset= CONTROLLER_WRITE_TIMEOUT>>1;
 	ctl->write_timeout_close= CONTROLLER_WRITE_TIMEOUT;
+	ctl->record_session= session_record_begin();
 	return true;
 }
 
+/* Associate a controller with the service whose control.* handles it serves.
+ */
+void ctl_set_service(controller_t *ctl, service_t *svc) {
+	ctl->service= svc;
+}
+
+/* Forget a service which is being deleted.
+ */
+void ctl_detach_service(service_t *svc) {
+	int i;
+	for (i= 0; i < CONTROLLER_MAX_CLIENTS; i++) {
+		if (client[i].service == svc)
+			client[i].service= NULL;
+		// If a statedump is paused on this service, resume at the start of the next one.
+		if (client[i].state_fn == ctl_state_dump_services && client[i].statedump_svc == svc) {
+			client[i].statedump_svc= svc_iter_next(svc, NULL);
+			client[i].command_substate= 1;
+		}
+		if (client[i].state_fn == ctl_state_svc_history && client[i].statedump_svc == svc)
+			client[i].statedump_svc= NULL;
+	}
+}
+
+/* Forget a FD object which is being deleted.
+ */
+void ctl_detach_fd(fd_t *fd) {
+	int i;
+	for (i= 0; i < CONTROLLER_MAX_CLIENTS; i++) {
+		if (client[i].state_fn == ctl_state_dump_fds && client[i].statedump_fd == fd) {
+			client[i].statedump_fd= fd_iter_next(fd, NULL);
+			client[i].command_substate= 1;
+		}
+	}
+}
+
 /* Destructor (not including free)
  *
  * Finalize the state of a controller object.
  */
 void ctl_dtor(controller_t *ctl) {
+	int i;
 	log_debug("destroying client %d", ctl->id);
 	if (ctl->recv_fd >= 0)
 		close(ctl->recv_fd);
 	if (ctl->send_fd >= 0 && ctl->send_fd != ctl->recv_fd)
 		close(ctl->send_fd);
+	ctl_close_ancillary_fds(ctl);
+	if (ctl->state_fn == ctl_state_fd_open_wait && ctl->fs_worker >= 0)
+		fs_worker_abandon(ctl->fs_worker);
+	if (ctl->state_fn == ctl_state_send_fds)
+		ctl_clear_send_fds(ctl);
+	session_record(ctl->record_session, "close", "", 0);
+	ctl_buf_put(ctl->recv_buf, ctl->recv_buf_size);
+	ctl->recv_buf= NULL;
+	ctl->recv_buf_size= ctl->recv_buf_pos= 0;
+	for (i= 0; i < CTL_LANE_COUNT; i++) {
+		ctl_buf_put(ctl->send_lane[i].buf, ctl->send_lane[i].size);
+		ctl->send_lane[i].buf= NULL;
+		ctl->send_lane[i].size= ctl->send_lane[i].pos= 0;
+	}
+	ctl->state_fn= ctl_state_free;
+}
+
+/** Return a controller's buffers to the pool once they have been empty for
+ * CONTROLLER_BUF_IDLE_TIMEOUT, and wake up at that time if they haven't yet.
+ */
+static void ctl_release_idle_bufs(controller_t *ctl) {
+	int i;
+	bool allocated= ctl->recv_buf != NULL;
+	if (ctl->recv_buf_pos)
+		ctl->buf_active_ts= wake->now;
+	for (i= 0; i < CTL_LANE_COUNT; i++) {
+		if (ctl->send_lane[i].pos || ctl->send_lane[i].overflow)
+			ctl->buf_active_ts= wake->now;
+		if (ctl->send_lane[i].buf)
+			allocated= true;
+	}
+	if (!allocated || ctl->buf_active_ts == wake->now)
+		return;
+	if (wake->now - ctl->buf_active_ts < CONTROLLER_BUF_IDLE_TIMEOUT) {
+		wake_at_time(ctl->buf_active_ts + CONTROLLER_BUF_IDLE_TIMEOUT);
+		return;
+	}
+	log_debug("controller[%d] idle, releasing buffers", ctl->id);
+	ctl_buf_put(ctl->recv_buf, ctl->recv_buf_size);
+	ctl->recv_buf= NULL;
+	ctl->recv_buf_size= 0;
+	for (i= 0; i < CTL_LANE_COUNT; i++) {
+		ctl_buf_put(ctl->send_lane[i].buf, ctl->send_lane[i].size);
+		ctl->send_lane[i].buf= NULL;
+		ctl->send_lane[i].size= 0;
+	}
+}
+
+// Close any received descriptors which no command has claimed
+void ctl_close_ancillary_fds(controller_t *ctl) {
 	int i;
 	for (i= 0; i < ctl->recv_ancillary_fd_count; i++) {
 		log_warn("closing leftover ancillary file descriptor %d", ctl->recv_ancillary_fd[i]);
 		close(ctl->recv_ancillary_fd[i]);
 	}
-	ctl->state_fn= ctl_state_free;
+	ctl->recv_ancillary_fd_count= 0;
 }
 
 /* Free a controller object, by returning it to the pool.
@@ -276,6 +503,11 @@ void ctl_run() {
 		if (ctl->send_fd >= 0 && woke_on_writeable(ctl->send_fd))
 			ctl_flush_outbuf(ctl);
 
+		// New signals go out on the event lane, even in the middle of a command
+		ctl->direct_lane= CTL_LANE_EVENT;
+		ctl_deliver_signals(ctl, &ctl->last_signal_ts);
+		ctl->direct_lane= CTL_LANE_BULK;
+
 		// Run (max 10) iterations of state machine while state returns true.
 		// The arbitrary limit of 10 helps keep our timestamps and signal
 		// delivery and reaped procs current.  (also mitigates infinite loops)
@@ -305,7 +537,7 @@ void ctl_run() {
 		
 		// If anything was left un-written, wake on writable pipe
 		// Also, set/check timeout for writes
-		if (ctl->send_fd >= 0 && ctl->send_buf_pos > 0) {
+		if (ctl->send_fd >= 0 && ctl_send_pending(ctl)) {
 			if (!ctl_flush_outbuf(ctl) && ctl->send_fd >= 0) {
 				lateness= wake->now - ctl->send_blocked_ts;
 				
@@ -320,13 +552,13 @@ void ctl_run() {
 				
 				// If the controller script doesn't read events before half its timeout,
 				// log a warning, and if the input buffer is full, set an overflow on the
-				// output stream so that we can resume processing the commands in the
+				// bulk output lane so that we can resume processing the commands in the
 				// input buffer.  The controller script will have to re-sync state if it
 				// finally wakes up.
 				if (lateness >= ctl->write_timeout_reset) {
 					log_warn("controller %d blocked pipe for %d seconds", i, (int)(lateness>>32));
-					if (ctl->recv_buf_pos >= CONTROLLER_RECV_BUF_SIZE) {
-						ctl->send_overflow= true;
+					if (!ctl_recv_buf_room(ctl)) {
+						ctl->send_lane[CTL_LANE_BULK].overflow= true;
 						wake->next= wake->now;
 					}
 					next_check_ts= ctl->send_blocked_ts + ctl->write_timeout_close;
@@ -349,10 +581,11 @@ void ctl_run() {
 		}
 		// If incoming fd, wake on data available, unless input buffer full
 		// (this could also be the config file, initially)
-		if (ctl->recv_fd >= 0 && ctl->recv_buf_pos < CONTROLLER_RECV_BUF_SIZE) {
+		if (ctl->recv_fd >= 0 && ctl_recv_buf_room(ctl)) {
 			log_trace("wake on controller[%d] recv_fd", i);
 			wake_on_readable(ctl->recv_fd);
 		}
+		ctl_release_idle_bufs(ctl);
 	}
 }
 
@@ -360,18 +593,19 @@ void ctl_run() {
  *
  * We store the last signal event which we notified each client about, and now
  * we look for anything newer than that event.  sig_get_new_events() should be
- * doing appropriate synchronization to prevent race conditions.
+ * doing appropriate synchronization to prevent race conditions.  Live events
+ * and statedump each keep their own last_signal_ts.
  */
-bool ctl_deliver_signals(controller_t *ctl) {
+static bool ctl_deliver_signals(controller_t *ctl, int64_t *last_signal_ts) {
 	int signum, sig_count;
 	int64_t sig_ts;
 	
-	while (sig_get_new_events(ctl->last_signal_ts, &signum, &sig_ts, &sig_count)) {
+	while (sig_get_new_events(*last_signal_ts, &signum, &sig_ts, &sig_count)) {
 		if (!ctl_out_buf_ready(ctl))
 			return false;
 		// deliver next signal that this controller hasn't seen
 		ctl_notify_signal(ctl, signum, sig_ts, sig_count);
-		ctl->last_signal_ts= sig_ts;
+		*last_signal_ts= sig_ts;
 	}
 	return true;
 }
@@ -383,10 +617,6 @@ bool ctl_deliver_signals(controller_t *ctl) {
 bool ctl_state_next_command(controller_t *ctl) {
 	char *eol;
 	
-	// Before checking commands, deliver any pending signal events
-	if (!ctl_deliver_signals(ctl))
-		return false; // false means the output buffer is blocked
-
 	// see if we have a full line in the input.  else read some more.
 	eol= (char*) memchr(ctl->recv_buf, '\n', ctl->recv_buf_pos);
 	if (!eol && ctl->recv_fd >= 0) {
@@ -430,6 +660,8 @@ bool ctl_state_next_command(controller_t *ctl) {
 	ctl->line_len= eol - ctl->recv_buf + 1;
 	*eol= '\0';
 	log_debug("controller[%d] command: \"%s\"", ctl->id, ctl->recv_buf);
+	session_record(ctl->record_session, "cmd", ctl->recv_buf, ctl->line_len - 1);
+	flight_record("cmd", ctl->id, 0, ctl->recv_buf, ctl->line_len - 1);
 	ctl->state_fn= ctl_state_run_command;
 	return true;
 }
@@ -473,6 +705,9 @@ bool ctl_state_run_command(controller_t *ctl) {
 			ctl_notify_error(ctl, "line too long");
 			log_error("controller[%d] command exceeds buffer size", ctl->id);
 		}
+		// Any descriptors received were most likely meant for the discarded
+		// line, and would be assigned to the wrong names by a later fd.take.
+		ctl_close_ancillary_fds(ctl);
 	}
 	else {
 		// ctl->command is the un-parsed portion of our command.
@@ -500,15 +735,22 @@ bool ctl_state_run_command(controller_t *ctl) {
 			}
 		}
 		// dispatch it (returns false if it encounters an error, and sets ctl->command_error)
-		else if (!cmd->fn(ctl)) {
-			ctl_notify_error(ctl, "%s, for command \"%.*s%s\"", ctl->command_error, ctl->line_len > 30? 30 : ctl->line_len, ctl->recv_buf, ctl->line_len > 30? "...":"");
-			log_error("controller[%d] command failed: '%.*s'%s", ctl->id, ctl->line_len > 90? 90 : ctl->line_len, ctl->recv_buf, ctl->line_len > 90? "...":"");
-			log_error("  with error: '%s'", ctl->command_error);
-		}
+		else if (!cmd->fn(ctl))
+			ctl_report_command_error(ctl);
 	}
 	return true;
 }
 
+/** Report ctl->command_error for the current command.
+ *
+ * Used when a command fails, including commands that complete asynchronously.
+ */
+void ctl_report_command_error(controller_t *ctl) {
+	ctl_notify_error(ctl, "%s, for command \"%.*s%s\"", ctl->command_error, ctl->line_len > 30? 30 : ctl->line_len, ctl->recv_buf, ctl->line_len > 30? "...":"");
+	log_error("controller[%d] command failed: '%.*s'%s", ctl->id, ctl->line_len > 90? 90 : ctl->line_len, ctl->recv_buf, ctl->line_len > 90? "...":"");
+	log_error("  with error: '%s'", ctl->command_error);
+}
+
 /** Reset command-related variables, and advance read buffer.
  *
  * The command remains in the read buffer while it is being processed.
@@ -525,6 +767,48 @@ bool ctl_state_end_command(controller_t *ctl) {
 	return true;
 }
 
+/** Send a reply with file descriptors attached.
+ *
+ * The descriptors must arrive with the reply line, so wait for everything
+ * queued ahead of it to be written first.
+ */
+// Forget the descriptors of an unsent or sent reply
+static void ctl_clear_send_fds(controller_t *ctl) {
+	int i;
+	if (ctl->send_fds_close)
+		for (i= 0; i < ctl->send_fds_count; i++)
+			close(ctl->send_fds[i]);
+	ctl->send_fds_count= 0;
+	ctl->send_fds_close= false;
+}
+
+bool ctl_state_send_fds(controller_t *ctl) {
+	ssize_t n;
+	if (ctl->send_fd < 0) {
+		ctl_clear_send_fds(ctl);
+		ctl->state_fn= ctl_state_end_command;
+		return true;
+	}
+	if (ctl_send_pending(ctl) && (!ctl_flush_outbuf(ctl) || ctl_send_pending(ctl)))
+		return false;
+	n= fd_send_with_fds(ctl->send_fd, ctl->send_fds_msg, ctl->send_fds_msg_len,
+		ctl->send_fds, ctl->send_fds_count);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			wake_on_writeable(ctl->send_fd);
+			return false;
+		}
+		log_error("controller[%d] can't send file descriptors: %s", ctl->id, strerror(errno));
+		ctl_notify_error(ctl, "can't send file descriptors");
+	}
+	// The descriptors went with the first byte; queue whatever didn't fit
+	else if (n < ctl->send_fds_msg_len)
+		ctl_write(ctl, "%.*s", (int)(ctl->send_fds_msg_len - n), ctl->send_fds_msg + n);
+	ctl_clear_send_fds(ctl);
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
 bool ctl_state_close(controller_t *ctl) {
 	if (ctl->send_fd >= 0)
 		if (!ctl_flush_outbuf(ctl))
@@ -609,6 +893,84 @@ bool ctl_cmd_event_pipe_timeout(controller_t *ctl) {
 	return true;
 }
 
+/*
+=item event.coalesce BOOL
+
+Enable (1) or disable (0) coalescing of service.state events, the same as the
+--coalesce-events option.  This affects all controllers.
+
+=cut
+*/
+bool ctl_cmd_event_coalesce(controller_t *ctl) {
+	int64_t enable;
+
+	if (!ctl_get_arg_int(ctl, &enable))
+		return false;
+	if (enable != 0 && enable != 1) {
+		ctl->command_error= "expected 0 or 1";
+		return false;
+	}
+	// don't lose events which were already queued
+	if (!enable)
+		svc_flush_state_events();
+	opt_coalesce_events= enable;
+	return true;
+}
+
+/*
+=item event.ring [SIZE]
+
+Request the shared memory event ring, which lets local monitoring processes
+read every event without any socket I/O.  The ring is created with a data area
+of at least SIZE bytes (default 1MiB) the first time it is requested; later
+requests return the same ring, and ignore SIZE.  Must be sent over the control
+socket (see --socket).  The reply is
+
+  event.ring	SIZE
+
+with two file descriptors attached: a memfd holding the ring, and an eventfd.
+Once the ring exists, every event broadcast to controllers is also appended to
+it, regardless of whether any controller is connected.
+
+The memfd begins with a 64-byte header: the magic "dpring", then native-endian
+uint32 version, header_size, data_size, and waiters, and uint64 head.  The
+data area of data_size bytes follows, and is used as a circular buffer of
+records, each a uint32 length followed by that many bytes of event text
+(including the newline) and padded to a multiple of 4.  Records may wrap around
+the end of the data area.  head is the total number of bytes ever written, and
+is advanced only after a record is complete.
+
+A consumer keeps its own position (start at the current head), copies records
+while its position is behind head, and then checks that head minus the
+position at which it began copying is still less than data_size; if not, the
+records were overwritten while being copied and the consumer must re-sync with
+statedump.  To sleep, atomically increment waiters, re-check head, read the
+eventfd, and decrement waiters.  daemonproxy only writes the eventfd while
+waiters is nonzero.
+
+=cut
+*/
+bool ctl_cmd_event_ring(controller_t *ctl) {
+	int64_t size= 1 << 20;
+	
+	if (ctl_peek_arg(ctl, NULL) && !ctl_get_arg_int(ctl, &size))
+		return false;
+	if (!ctl->recv_is_socket || ctl->send_fd != ctl->recv_fd) {
+		ctl->command_error= "file descriptors can only be sent over the control socket";
+		return false;
+	}
+	if (!event_ring_open(size)) {
+		ctl->command_error= (errno == EINVAL)? "invalid size" : "can't create event ring";
+		return false;
+	}
+	ctl->send_fds_msg_len= snprintf(ctl->send_fds_msg, sizeof(ctl->send_fds_msg),
+		"event.ring	%d\n", event_ring_get_size());
+	event_ring_get_fds(ctl->send_fds);
+	ctl->send_fds_count= 2;
+	ctl->state_fn= ctl_state_send_fds;
+	return true;
+}
+
 /*
 =item chdir PATH
 
@@ -659,59 +1021,73 @@ bool ctl_cmd_exit(controller_t *ctl) {
 Re-emit all events for daemonproxy's current state, to get the controller back
 into sync.  Useful after event overflow, or controller restart.
 
+The dump covers the fd objects and services which existed when the command
+began.  Anything created or changed while the dump is in progress is reported
+by the normal events, which are delivered ahead of the dump output, so the
+controller never sees a dumped value that is older than an event it has
+already received.
+
 =cut
 */
 bool ctl_cmd_statedump(controller_t *ctl) {
 	ctl->state_fn= ctl_state_dump_fds;
-	ctl->statedump_current[0]= '\0';
+	ctl->statedump_epoch= ++ctl_snapshot_epoch;
+	ctl->statedump_fd= NULL;
+	ctl->statedump_svc= NULL;
 	ctl->command_substate= 0;
 	return true;
 }
 
 bool ctl_state_dump_fds(controller_t *ctl) {
-	fd_t *fd= fd_by_name(STRSEG(ctl->statedump_current));
-	if (!fd) ctl->command_substate= 0;
+	fd_t *fd= ctl->statedump_fd;
 	/* Statedump command, part 1: iterate fd objects and dump each one.
-	 * Uses an iterator of fd_t's name so that if fds are creeated or destroyed during our
-	 * iteration, we can safely resume.  (and this iteration could be idle for a while if
-	 * the controller script doesn't read its pipe)
+	 * The cursor points directly at the next object to dump.  If that object is
+	 * deleted while we wait for the controller to read its pipe, ctl_detach_fd
+	 * moves the cursor to the following one (or NULL, at the end).
 	 */
+	if (!fd && ctl->command_substate)
+		goto done;
  switch (ctl->command_substate) {
  case 0:
 	
-	while ((fd= fd_iter_next(fd, ctl->statedump_current))) {
-		log_trace("fd iter = %s", fd_get_name(fd));
+	for (fd= fd_iter_next(NULL, ""); fd; fd= fd_iter_next(fd, NULL)) {
  case 1:
+		if (fd_get_epoch(fd) >= ctl->statedump_epoch)
+			continue; // created after the dump began, and already announced
+		log_trace("fd iter = %s", fd_get_name(fd));
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 1; break; }
 		ctl_notify_fd_state(ctl, fd);
 	}
  } //switch
-	if (fd) { // If we broke the loop early, record name of where to resume
-		strcpy(ctl->statedump_current, fd_get_name(fd)); // length of name has already been checked
+	if (fd) { // If we broke the loop early, record where to resume
+		ctl->statedump_fd= fd;
 		return false;
 	}
-	ctl->statedump_current[0]= '\0';
+done:
+	ctl->statedump_fd= NULL;
 	ctl->state_fn= ctl_state_dump_services;
 	ctl->command_substate= 0;
 	return true;
 }
 
 bool ctl_state_dump_services(controller_t *ctl) {
-	service_t *svc= svc_by_name(STRSEG(ctl->statedump_current), false);
-	if (!svc) ctl->command_substate= 0;
+	service_t *svc= ctl->statedump_svc;
 	/* Statedump command, part 2: iterate services and dump each one.
-	 * Like part 1 above, except a service has 4 lines of output.
+	 * Like part 1 above, except a service has several lines of output.
 	 */
+	if (!svc && ctl->command_substate)
+		goto done;
  switch (ctl->command_substate) {
  case 0:
 
-	while ((svc= svc_iter_next(svc, ctl->statedump_current))) {
-		log_trace("service iter = %s", svc_get_name(svc));
+	for (svc= svc_iter_next(NULL, ""); svc; svc= svc_iter_next(svc, NULL)) {
  case 1:
+		if (svc_get_epoch(svc) >= ctl->statedump_epoch)
+			continue; // created after the dump began, and already announced
+		log_trace("service iter = %s", svc_get_name(svc));
 		svc_check(svc);
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 1; break; }
-		ctl_notify_svc_state(ctl, svc_get_name(svc), svc_get_up_ts(svc),
-			svc_get_reap_ts(svc), svc_get_wstat(svc), svc_get_pid(svc));
+		ctl_notify_svc_state(ctl, svc);
  case 2:
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 2; break; }
 		ctl_notify_svc_tags(ctl, svc_get_name(svc), svc_get_tags(svc));
@@ -724,21 +1100,43 @@ bool ctl_state_dump_services(controller_t *ctl) {
  case 5:
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 5; break; }
 		ctl_notify_svc_auto_up(ctl, svc_get_name(svc), svc_get_restart_interval(svc), svc_get_triggers(svc));
+ case 6:
+		if (svc_get_probe(svc)[0]) {
+			if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 6; break; }
+			ctl_notify_svc_probe(ctl, svc_get_name(svc), svc_get_probe(svc));
+		}
+ case 7:
+		if (svc_get_watchdog(svc)[0]) {
+			if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 7; break; }
+			ctl_notify_svc_watchdog(ctl, svc_get_name(svc), svc_get_watchdog(svc));
+		}
+ case 8:
+		if (svc_get_max_runtime(svc)[0]) {
+			if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 8; break; }
+			ctl_notify_svc_max_runtime(ctl, svc_get_name(svc), svc_get_max_runtime(svc));
+		}
+ case 9:
+		if (svc_get_spare(svc)) {
+			if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 9; break; }
+			ctl_notify_svc_spare(ctl, svc_get_name(svc), true);
+		}
 	}
  }//switch
-	if (svc) { // If we broke the loop early, record name of where to resume
-		strcpy(ctl->statedump_current, svc_get_name(svc)); // length of name has already been checked
+	if (svc) { // If we broke the loop early, record where to resume
+		ctl->statedump_svc= svc;
 		return false;
 	}
-	ctl->last_signal_ts= 0;
+done:
+	ctl->statedump_svc= NULL;
+	ctl->statedump_ts= 0;
 	ctl->state_fn= ctl_state_dump_signals;
 	ctl->command_substate= 0;
 	return true;
 }
 
 bool ctl_state_dump_signals(controller_t *ctl) {
-	// Just use the deliver_signals, after having reset the last_signal_ts
-	if (!ctl_deliver_signals(ctl))
+	// Just use the deliver_signals, starting from the beginning
+	if (!ctl_deliver_signals(ctl, &ctl->statedump_ts))
 		return false;
 	// But, need to override the state transition that it performs when complete
 	ctl->state_fn= ctl_state_end_command;
@@ -859,6 +1257,307 @@ bool ctl_cmd_fd_pipe(controller_t *ctl) {
 	return true;
 }
 
+// Parse the value of a "name=value" flag, if opt has that name
+static bool ctl_parse_flag_value(controller_t *ctl, strseg_t opt, const char *name, int64_t *val) {
+	int n= strlen(name);
+	if (opt.len <= n || memcmp(opt.data, name, n) != 0 || opt.data[n] != '=')
+		return false;
+	opt.data += n+1;
+	opt.len -= n+1;
+	if (!strseg_parse_size(&opt, val) || opt.len > 0 || *val < 0) {
+		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+			"invalid value for %s", name);
+		ctl->command_error= ctl->command_error_buf;
+		*val= -1;
+	}
+	return true;
+}
+
+// Report an unknown flag in a FLAGS argument
+static bool ctl_unknown_flag(controller_t *ctl, strseg_t opt) {
+	snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+		"unknown flag \"%.*s\"", opt.len, opt.data);
+	ctl->command_error= ctl->command_error_buf;
+	return false;
+}
+
+// Report a failed syscall
+static bool ctl_syscall_failed(controller_t *ctl, const char *fn) {
+	snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+		"%s failed: %s", fn, strerror(errno));
+	ctl->command_error= ctl->command_error_buf;
+	return false;
+}
+
+// Register a newly created descriptor under a name and announce it
+static bool ctl_fd_add(controller_t *ctl, strseg_t name, int f, fd_flags_t flags, strseg_t descrip) {
+	fd_t *fd= fd_new_file(name, f, flags, descrip);
+	if (!fd) {
+		close(f);
+		ctl->command_error= "Unable to allocate new file descriptor object";
+		return false;
+	}
+	ctl_notify_fd_state(NULL, fd);
+	return true;
+}
+
+// Append bytes to the end of a memfd, without moving its file offset
+static bool ctl_memfd_append(controller_t *ctl, int f, strseg_t text) {
+	struct stat st;
+	struct iovec iov[2]= { { (void*) text.data, text.len }, { "\n", 1 } };
+	if (fstat(f, &st) < 0)
+		return ctl_syscall_failed(ctl, "fstat");
+	if (pwritev(f, iov, 2, st.st_size) != text.len + 1)
+		return ctl_syscall_failed(ctl, "write");
+	return true;
+}
+
+/*
+=item fd.memfd NAME FLAGS [TEXT]
+
+Create an anonymous in-memory file (memfd), readable and writable.  If TEXT
+is given, the rest of the line (including any tabs) is written to it, followed
+by a newline.  Use fd.append to add more lines.  FLAGS is '-' or a comma-separated
+list of:
+
+=over
+
+=item size=BYTES
+
+Make the file BYTES long, padding TEXT with zeros or cutting it off.  BYTES can
+have a suffix like 'K' or 'M'.
+
+=item seal
+
+Once TEXT is written, seal the file so that nobody (including services) can
+modify it again.
+
+=back
+
+The file offset is shared by every process that has the handle, so services
+reading it should use pread(), mmap(), or open /proc/self/fd/N for a private
+offset.  This is a convenient way to give a service its configuration without
+a temp file on disk.
+
+=cut
+*/
+bool ctl_cmd_fd_memfd(controller_t *ctl) {
+	strseg_t fdname, opts, opt;
+	int64_t size= -1, val;
+	bool seal= false;
+	fd_flags_t flags;
+	char memfd_name[NAME_LEN_MAX+1];
+	int f;
+	
+	if (!ctl_get_arg_fd(ctl, false, true, &fdname, NULL))
+		return false;
+	if (!ctl_get_arg(ctl, &opts)) {
+		ctl->command_error= "missing flags argument";
+		return false;
+	}
+	while (opts.len > 0) {
+		opt= opts;
+		strseg_split_1(&opt, ',', &opts);
+		if (opt.len <= 0 || (opt.len == 1 && opt.data[0] == '-'))
+			continue;
+		if (ctl_parse_flag_value(ctl, opt, "size", &val)) {
+			if (val < 0) return false;
+			size= val;
+		}
+		else if (opt.len == 4 && memcmp(opt.data, "seal", 4) == 0)
+			seal= true;
+		else
+			return ctl_unknown_flag(ctl, opt);
+	}
+	
+	snprintf(memfd_name, sizeof(memfd_name), "%.*s", fdname.len, fdname.data);
+	if ((f= memfd_create(memfd_name, MFD_ALLOW_SEALING)) < 0)
+		return ctl_syscall_failed(ctl, "memfd_create");
+	if ((ctl->command.len > 0 && !ctl_memfd_append(ctl, f, ctl->command))
+		|| (size >= 0 && ftruncate(f, size) < 0 && !ctl_syscall_failed(ctl, "ftruncate"))
+		|| (seal && fcntl(f, F_ADD_SEALS, F_SEAL_SEAL|F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE) < 0
+			&& !ctl_syscall_failed(ctl, "fcntl(F_ADD_SEALS)"))
+	) {
+		close(f);
+		return false;
+	}
+	memset(&flags, 0, sizeof(flags));
+	flags.read= flags.write= flags.memfd= true;
+	return ctl_fd_add(ctl, fdname, f, flags, STRSEG("memfd"));
+}
+
+/*
+=item fd.append NAME TEXT
+
+Append the rest of the line (including any tabs) and a newline to the memfd
+NAME.  Fails if the memfd has been sealed.
+
+=cut
+*/
+bool ctl_cmd_fd_append(controller_t *ctl) {
+	fd_t *fd;
+	
+	if (!ctl_get_arg_fd(ctl, true, true, NULL, &fd))
+		return false;
+	if (!fd_get_flags(fd).memfd) {
+		ctl->command_error= "not a memfd";
+		return false;
+	}
+	if (!ctl_memfd_append(ctl, fd_get_fdnum(fd), ctl->command.len > 0? ctl->command : STRSEG("")))
+		return false;
+	ctl_notify_fd_state(NULL, fd);
+	return true;
+}
+
+/*
+=item fd.seal NAME
+
+Seal the memfd NAME, so that its content and size can never change again.
+
+=cut
+*/
+bool ctl_cmd_fd_seal(controller_t *ctl) {
+	fd_t *fd;
+	
+	if (!ctl_get_arg_fd(ctl, true, true, NULL, &fd))
+		return false;
+	if (!fd_get_flags(fd).memfd) {
+		ctl->command_error= "not a memfd";
+		return false;
+	}
+	if (fcntl(fd_get_fdnum(fd), F_ADD_SEALS, F_SEAL_SEAL|F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE) < 0)
+		return ctl_syscall_failed(ctl, "fcntl(F_ADD_SEALS)");
+	ctl_notify_fd_state(NULL, fd);
+	return true;
+}
+
+/*
+=item fd.eventfd NAME [FLAGS]
+
+Create an eventfd, a counter which services can use as a lightweight wakeup
+channel: writing 8 bytes adds to the counter, and reading returns and clears it
+(or decrements it, with 'semaphore').  FLAGS is a comma-separated list of
+nonblock, semaphore, and initval=N.
+
+=cut
+*/
+bool ctl_cmd_fd_eventfd(controller_t *ctl) {
+	strseg_t fdname, opts, opt;
+	int64_t initval= 0;
+	int ev_flags= 0, f;
+	fd_flags_t flags;
+	
+	memset(&flags, 0, sizeof(flags));
+	if (!ctl_get_arg_fd(ctl, false, true, &fdname, NULL))
+		return false;
+	if (ctl_get_arg(ctl, &opts)) {
+		while (opts.len > 0) {
+			opt= opts;
+			strseg_split_1(&opt, ',', &opts);
+			if (opt.len <= 0 || (opt.len == 1 && opt.data[0] == '-'))
+				continue;
+			if (ctl_parse_flag_value(ctl, opt, "initval", &initval)) {
+				if (initval < 0) return false;
+				if (initval > 0xFFFFFFFFLL) {
+					ctl->command_error= "initval must fit in 32 bits";
+					return false;
+				}
+			}
+			else if (opt.len == 8 && memcmp(opt.data, "nonblock", 8) == 0)
+				flags.nonblock= true;
+			else if (opt.len == 9 && memcmp(opt.data, "semaphore", 9) == 0)
+				ev_flags |= EFD_SEMAPHORE;
+			else
+				return ctl_unknown_flag(ctl, opt);
+		}
+	}
+	if ((f= eventfd((unsigned) initval, ev_flags | (flags.nonblock? EFD_NONBLOCK : 0))) < 0)
+		return ctl_syscall_failed(ctl, "eventfd");
+	flags.read= flags.write= flags.eventfd= true;
+	return ctl_fd_add(ctl, fdname, f, flags, (ev_flags & EFD_SEMAPHORE)? STRSEG("semaphore") : STRSEG("counter"));
+}
+
+/*
+=item fd.timerfd NAME [FLAGS]
+
+Create a timerfd, which becomes readable when the timer expires, and returns
+the number of expirations when read.  FLAGS is a comma-separated list of:
+
+=over
+
+=item interval=SECONDS
+
+Expire every SECONDS seconds.
+
+=item value=SECONDS
+
+Expire first after SECONDS seconds (default is the interval).
+
+=item realtime
+
+Use the wall clock instead of the monotonic clock.
+
+=item nonblock
+
+Reads return EAGAIN instead of blocking.
+
+=back
+
+Without interval or value, the timer is created unarmed, and a service can arm
+it with timerfd_settime().
+
+=cut
+*/
+bool ctl_cmd_fd_timerfd(controller_t *ctl) {
+	strseg_t fdname, opts, opt;
+	int64_t interval= 0, value= -1;
+	bool realtime= false;
+	struct itimerspec its;
+	char descrip[64];
+	fd_flags_t flags;
+	int f;
+	
+	memset(&flags, 0, sizeof(flags));
+	if (!ctl_get_arg_fd(ctl, false, true, &fdname, NULL))
+		return false;
+	if (ctl_get_arg(ctl, &opts)) {
+		while (opts.len > 0) {
+			opt= opts;
+			strseg_split_1(&opt, ',', &opts);
+			if (opt.len <= 0 || (opt.len == 1 && opt.data[0] == '-'))
+				continue;
+			if (ctl_parse_flag_value(ctl, opt, "interval", &interval)) {
+				if (interval < 0) return false;
+			}
+			else if (ctl_parse_flag_value(ctl, opt, "value", &value)) {
+				if (value < 0) return false;
+			}
+			else if (opt.len == 8 && memcmp(opt.data, "realtime", 8) == 0)
+				realtime= true;
+			else if (opt.len == 8 && memcmp(opt.data, "nonblock", 8) == 0)
+				flags.nonblock= true;
+			else
+				return ctl_unknown_flag(ctl, opt);
+		}
+	}
+	if (value < 0)
+		value= interval;
+	
+	if ((f= timerfd_create(realtime? CLOCK_REALTIME : CLOCK_MONOTONIC, flags.nonblock? TFD_NONBLOCK : 0)) < 0)
+		return ctl_syscall_failed(ctl, "timerfd_create");
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec= interval;
+	its.it_value.tv_sec= value;
+	if (timerfd_settime(f, 0, &its, NULL) < 0) {
+		close(f);
+		return ctl_syscall_failed(ctl, "timerfd_settime");
+	}
+	flags.read= flags.timerfd= true;
+	snprintf(descrip, sizeof(descrip), "%s,interval=%lld,value=%lld",
+		realtime? "realtime" : "monotonic", (long long) interval, (long long) value);
+	return ctl_fd_add(ctl, fdname, f, flags, (strseg_t){ descrip, strlen(descrip) });
+}
+
 /*
 =item fd.open NAME FLAG1,FLAG2,.. PATH
 
@@ -866,12 +1565,14 @@ Opens a file at PATH.  FLAGS is a comma-sparated list of flags of the
 set read, write, create, truncate, nonblock, mkdir.  Re-using an
 existing name will close the old handle.
 
+With --fs-workers, the mkdir and open() calls happen in a helper process,
+and this controller waits for the result without stalling the others.
+
 =cut
 */
 bool ctl_cmd_fd_open(controller_t *ctl) {
 	int f, open_flags;
 	fd_flags_t flags;
-	fd_t *fd;
 	strseg_t fdname, opts, opt, path;
 
 	if (!ctl_get_arg_fd(ctl, false, true, &fdname, NULL))
@@ -928,28 +1629,63 @@ bool ctl_cmd_fd_open(controller_t *ctl) {
 	}
 	#undef STRMATCH
 	
-	if (flags.mkdir)
-		// we don't check success on this.  we just let open() fail and check that.
-		create_missing_dirs((char*)path.data);
-
 	open_flags= (flags.write? (flags.read? O_RDWR : O_WRONLY) : O_RDONLY)
 		| (flags.append? O_APPEND : 0) | (flags.create? O_CREAT : 0)
 		| (flags.trunc?  O_TRUNC  : 0) | (flags.nonblock? O_NONBLOCK : 0)
 		| O_NOCTTY;
 
-	f= open(path.data, open_flags, 0600);
-	if (f < 0) {
-		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
-			"open failed: %s", strerror(errno));
-		ctl->command_error= ctl->command_error_buf;
-		return false;
-	}
-
-	fd= fd_new_file(fdname, f, flags, path);
-	if (!fd) {
-		close(f);
-		ctl->command_error= "Unable to allocate new file descriptor object";
-		return false;
+	// Let a worker process do the filesystem calls, if enabled.  The command
+	// line stays in recv_buf until the command ends, so the strsegs stay valid.
+	if (fs_worker_enabled()) {
+		ctl->fs_name= fdname;
+		ctl->fs_path= path;
+		ctl->fs_flags= flags;
+		ctl->fs_open_flags= open_flags;
+		ctl->fs_worker= -1;
+		ctl->state_fn= ctl_state_fd_open_wait;
+		return true;
+	}
+
+	if (flags.mkdir)
+		// we don't check success on this.  we just let open() fail and check that.
+		create_missing_dirs((char*)path.data);
+
+	f= open(path.data, open_flags, 0600);
+	return ctl_fd_open_finish(ctl, fdname, flags, path, f);
+}
+
+bool ctl_state_fd_open_wait(controller_t *ctl) {
+	int f;
+	if (ctl->fs_worker < 0) {
+		ctl->fs_worker= fs_worker_open_begin(ctl->fs_path.data, ctl->fs_open_flags, ctl->fs_flags.mkdir);
+		if (ctl->fs_worker < 0 && errno == EAGAIN)
+			return false; // all workers busy
+	}
+	if (ctl->fs_worker < 0)
+		f= -1;
+	else if (!fs_worker_open_end(ctl->fs_worker, &f))
+		return false;
+	ctl->state_fn= ctl_state_end_command;
+	if (!ctl_fd_open_finish(ctl, ctl->fs_name, ctl->fs_flags, ctl->fs_path, f))
+		ctl_report_command_error(ctl);
+	return true;
+}
+
+// Second half of fd.open, once we have the result of open()
+bool ctl_fd_open_finish(controller_t *ctl, strseg_t fdname, fd_flags_t flags, strseg_t path, int f) {
+	fd_t *fd;
+	if (f < 0) {
+		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+			"open failed: %s", strerror(errno));
+		ctl->command_error= ctl->command_error_buf;
+		return false;
+	}
+
+	fd= fd_new_file(fdname, f, flags, path);
+	if (!fd) {
+		close(f);
+		ctl->command_error= "Unable to allocate new file descriptor object";
+		return false;
 	}
 
 	ctl_notify_fd_state(NULL, fd);
@@ -1113,47 +1849,120 @@ bool ctl_cmd_fd_socket(controller_t *ctl) {
 }
 
 /*
-=item fd.take NAME  <plus one file descriptor in ancillary data>
+=item fd.take NAME [NAME2 ...]  <plus one file descriptor per NAME in ancillary data>
 
 This is a special message in which the controller uses sendmsg() to deliver
-a file descriptor to daemonproxy.  NAME is the symbolic name to assign to the
-file descriptor once it is received.  If the name already exists it will be
-closed and then reassigned.  Only one file descriptor may be transferred
-per message.
+file descriptors to daemonproxy.  Each NAME is the symbolic name to assign to
+the corresponding file descriptor of the SCM_RIGHTS array once it is received.
+If a name already exists it will be closed and then reassigned.  Up to 253
+file descriptors (the Linux limit for one message) may be transferred at once.
 
 =cut
 */
 bool ctl_cmd_fd_take(controller_t *ctl) {
 	fd_t *fd;
-	int new_fd, i, fl;
-	strseg_t fdname;
+	int new_fd[CONTROLLER_RECV_MAX_MSG_FD], n_names= 0, count, i;
+	strseg_t fdname[CONTROLLER_RECV_MAX_MSG_FD];
+	bool names_ok= true;
 
 	if (ctl->recv_ancillary_fd_count <= 0) {
 		ctl->command_error= "No ancillary file descriptor received";
 		return false;
 	}
 
+	// Collect the names.  On error, the descriptors for the names seen so
+	// far are still consumed, so that later messages get the right ones.
+	// (No message carries more than CONTROLLER_RECV_MAX_MSG_FD descriptors,
+	// so that is all that extra names can account for.)
+	do {
+		if (n_names >= CONTROLLER_RECV_MAX_MSG_FD) {
+			ctl->command_error= "Too many names";
+			names_ok= false;
+		}
+		else {
+			if (!ctl_get_arg_fd(ctl, false, true, &fdname[n_names], NULL))
+				names_ok= false;
+			n_names++;
+		}
+	} while (names_ok && ctl_peek_arg(ctl, NULL));
+	count= n_names < ctl->recv_ancillary_fd_count? n_names : ctl->recv_ancillary_fd_count;
+
 	// TODO: should redesign controller ancillary mechanism to auto-discard
 	//  leftover FDs after the message they came with is gone, but this is
 	//  very hard to determine in a cross-platform manner.
-	new_fd= ctl->recv_ancillary_fd[0];
-	--ctl->recv_ancillary_fd_count;
-	for (i= 0; i < ctl->recv_ancillary_fd_count; i++)
-		ctl->recv_ancillary_fd[i]= ctl->recv_ancillary_fd[i+1];
+	memcpy(new_fd, ctl->recv_ancillary_fd, count * sizeof(int));
+	ctl->recv_ancillary_fd_count -= count;
+	memmove(ctl->recv_ancillary_fd, ctl->recv_ancillary_fd + count,
+		ctl->recv_ancillary_fd_count * sizeof(int));
 
-	if (!ctl_get_arg_fd(ctl, false, true, &fdname, NULL)) {
-		close(new_fd);
+	if (names_ok && count < n_names) {
+		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+			"Received %d file descriptors for %d names", count, n_names);
+		ctl->command_error= ctl->command_error_buf;
+		names_ok= false;
+	}
+	if (!names_ok) {
+		for (i= 0; i < count; i++)
+			close(new_fd[i]);
 		return false;
 	}
 
-	fd= fd_new_unknown(fdname, new_fd);
-	if (!fd) {
-		close(new_fd);
-		ctl->command_error= "Unable to allocate new file descriptor object";
-		return false;
+	for (i= 0; i < count; i++) {
+		fd= fd_new_unknown(fdname[i], new_fd[i]);
+		if (!fd) {
+			while (i < count)
+				close(new_fd[i++]);
+			ctl->command_error= "Unable to allocate new file descriptor object";
+			return false;
+		}
+		ctl_notify_fd_state(NULL, fd);
 	}
+	return true;
+}
 
-	ctl_notify_fd_state(NULL, fd);
+/*
+=item fd.fetch NAME
+
+The reverse of fd.take: daemonproxy replies with
+
+  fd.fetch	NAME
+
+and attaches a duplicate of the named file descriptor with sendmsg().  The
+handle remains stored in daemonproxy.  Must be sent over a socket that is used
+in both directions, which is either the control socket (see --socket) or the
+control.socket handle of a service.  Together with fd.take, this lets a service
+park its listening sockets or memfd caches in daemonproxy across restarts, and
+get them back whenever it wants instead of only through service.fds.
+
+=cut
+*/
+bool ctl_cmd_fd_fetch(controller_t *ctl) {
+	fd_t *fd;
+	int fdnum;
+
+	if (!ctl_get_arg_fd(ctl, true, true, NULL, &fd))
+		return false;
+	if (!ctl->recv_is_socket || ctl->send_fd != ctl->recv_fd) {
+		ctl->command_error= "file descriptors can only be sent over a control socket";
+		return false;
+	}
+	if ((fdnum= fd_get_fdnum(fd)) < 0) {
+		ctl->command_error= "file descriptor is not open";
+		return false;
+	}
+	// Send a duplicate, in case the handle is deleted before our turn to send
+	if ((fdnum= fcntl(fdnum, F_DUPFD_CLOEXEC, 3)) < 0) {
+		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+			"dup failed: %s", strerror(errno));
+		ctl->command_error= ctl->command_error_buf;
+		return false;
+	}
+	ctl->send_fds_msg_len= snprintf(ctl->send_fds_msg, sizeof(ctl->send_fds_msg),
+		"fd.fetch	%s\n", fd_get_name(fd));
+	ctl->send_fds[0]= fdnum;
+	ctl->send_fds_count= 1;
+	ctl->send_fds_close= true;
+	ctl->state_fn= ctl_state_send_fds;
 	return true;
 }
 
@@ -1210,6 +2019,13 @@ Assign new exec() arguments to the service.  NAME will be created if
 it didn't exist.  ARG_1 is both the file to execute and argv[0] to
 pass to the service.  To falsify argv[0], use an external program.
 
+ARG_1 is looked up right away, using daemonproxy's PATH and working
+directory at that moment, and a warning is logged if it can't be found.
+It is looked up again at each start (a bare name starting with the PATH
+entry where it was found before), and the service is exec'd through a
+handle opened just for that start, so a file renamed into place is picked
+up by the next start.
+
 =cut
 */
 bool ctl_cmd_svc_args(controller_t *ctl) {
@@ -1274,13 +2090,21 @@ service has been running longer than MIN_INTERVAL and it exits while a trigger
 is true, it will be restarted immediately.  MIN_INTERVAL cannot be less than 1
 second.  A MIN_INTERVAL of '-' disables auto-up.
 
-Currently, triggers are 'always', SIGINT, SIGHUP, SIGTERM, SIGUSR1, SIGUSR2,
-SIGQUIT.
+Currently, triggers are 'always', 'cron:SCHEDULE', SIGINT, SIGHUP, SIGTERM,
+SIGUSR1, SIGUSR2, SIGQUIT.
 
 'always' means the service will always start if it is not already running.
 Using 'always' with a large MIN_INTERVAL can give you a cron-like effect, if
 you want a periodicaly-run service and don't care what specific time it runs.
 
+'cron:SCHEDULE' starts the service at the wall-clock times (local time) given
+by a crontab(5) style SCHEDULE of "MINUTE HOUR DAY_OF_MONTH MONTH DAY_OF_WEEK"
+separated by spaces, e.g. 'cron:0 3 * * *' for every day at 03:00.  Fields
+accept '*', numbers, ranges 'N-M', lists 'A,B', and steps '/N', but not names.
+The shortcuts '@hourly', '@daily', '@weekly', '@monthly', and '@yearly' are
+also accepted.  If the service is still running when the time comes, that run
+is skipped.  Only one cron trigger is allowed per service.
+
 Signal triggers cause the service to start if the pending count of that signal
 is nonzero.  (and the service is expected to issue the command "signal.clear"
 to reset the count to zero, to prevent being started again)
@@ -1320,6 +2144,293 @@ bool ctl_cmd_svc_auto_up(controller_t *ctl) {
 	return true;
 }
 
+/*
+=item service.probe NAME INTERVAL TIMEOUT THRESHOLD FLAGS TYPE [ARGS]...
+
+Run a health-check probe against the service every INTERVAL seconds while it
+is up.  A probe which has not finished after TIMEOUT seconds has failed.  When
+THRESHOLD consecutive probes fail, the service is declared unhealthy.  Results
+are reported with the service.health event.
+
+TYPE is one of:
+
+  exec ARG_1 .. ARG_N   run a command; success is an exit code of 0
+  connect FD_NAME       connect to the address the named socket is bound to
+  file PATH MAX_AGE     check that PATH was modified within MAX_AGE seconds
+
+FLAGS is '-' or a comma-separated list of: 'restart', to send SIGTERM to an
+unhealthy service (and SIGKILL if it is still up 5 seconds later) and start it
+again once it exits; 'group', to send those signals to the process group.  At most PROBE_MAX_CONCURRENT (default 4) exec or
+connect probes run at once; others wait for a free slot.  A spec of '-'
+removes the probe.
+
+=cut
+*/
+bool ctl_cmd_svc_probe(controller_t *ctl) {
+	service_t *svc;
+
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+
+	if (!svc_set_probe(svc, ctl->command.len > 0? ctl->command : STRSEG(""))) {
+		ctl->command_error= "invalid probe specification";
+		return false;
+	}
+
+	ctl_notify_svc_probe(NULL, svc_get_name(svc), svc_get_probe(svc));
+	return true;
+}
+
+/*
+=item service.watchdog NAME TIMEOUT [SIGNAL [FLAGS]]
+
+Require the service to send service.heartbeat at least every TIMEOUT seconds
+while it is up.  If a heartbeat is missed, the service is sent SIGNAL (default
+SIGTERM) and started again once it exits, and its service.state event reports
+'watchdog' as the exit reason.  The only flag is 'group', to signal the
+process group.  The first heartbeat is due TIMEOUT seconds after the service
+starts.  If the service is still up 5 seconds after SIGNAL (for instance
+because it handles it, like SIGHUP), it is sent SIGKILL.  A TIMEOUT of '-'
+removes the watchdog.
+
+=cut
+*/
+bool ctl_cmd_svc_watchdog(controller_t *ctl) {
+	service_t *svc;
+
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+
+	if (!svc_set_watchdog(svc, ctl->command.len > 0? ctl->command : STRSEG(""))) {
+		ctl->command_error= "invalid watchdog specification";
+		return false;
+	}
+
+	ctl_notify_svc_watchdog(NULL, svc_get_name(svc), svc_get_watchdog(svc));
+	return true;
+}
+
+/*
+=item service.max_runtime NAME SECONDS [SIGNAL [FLAGS]]
+
+Limit how long the service may run.  If it is still up SECONDS after it
+started, it is sent SIGNAL (default SIGTERM) and its service.state event
+reports 'timeout' as the exit reason.  This is useful for periodic jobs, so
+that a hung run can't block the next one.  The service is not restarted
+unless its auto_up triggers say so.  The only flag is 'group', to signal the
+process group.  If the service is still up 5 seconds after SIGNAL, it is sent
+SIGKILL.  Changing the limit applies to the current run as well.  A SECONDS of
+'-' removes the limit.
+
+=cut
+*/
+bool ctl_cmd_svc_max_runtime(controller_t *ctl) {
+	service_t *svc;
+
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+
+	if (!svc_set_max_runtime(svc, ctl->command.len > 0? ctl->command : STRSEG(""))) {
+		ctl->command_error= "invalid max_runtime specification";
+		return false;
+	}
+
+	ctl_notify_svc_max_runtime(NULL, svc_get_name(svc), svc_get_max_runtime(svc));
+	return true;
+}
+
+/*
+=item service.spare NAME BOOL
+
+Keep (1) or stop keeping (0) a standby process for the service.  The standby
+is forked in advance and waits just before exec, so when the service is
+restarted (by its auto_up triggers, a watchdog or a probe) daemonproxy only
+has to wake it, and then forks the next standby.  The standby is discarded
+when the service goes down and stays down, so a service.start after that
+forks as usual.  This takes the fork out of the restart time of a service
+whose crashes need to be recovered quickly, though the service still has to
+exec and initialize.  The standby is replaced whenever the service's
+arguments or executable change, or a handle it names is closed or reassigned.
+Services which use control.cmd, control.event or control.socket are always
+forked when they start.  With --spawner, no standby is kept (the helper does
+the forking instead) unless the helper has died.
+
+=cut
+*/
+bool ctl_cmd_svc_spare(controller_t *ctl) {
+	service_t *svc;
+	int64_t enable;
+
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+	if (!ctl_get_arg_int(ctl, &enable))
+		return false;
+	if (enable != 0 && enable != 1) {
+		ctl->command_error= "expected 0 or 1";
+		return false;
+	}
+	svc_set_spare(svc, enable);
+	ctl_notify_svc_spare(NULL, svc_get_name(svc), enable);
+	return true;
+}
+
+/*
+=item service.history NAME
+
+List the most recent runs of the service (up to 8), oldest first, one line
+each:
+
+  service.history NAME START_TS REAP_TS PID EXITREASON EXITVALUE CPU_MS MAXRSS_KB
+
+The timestamps, EXITREASON and EXITVALUE are the same as in service.state.
+CPU_MS is the user plus system time of the process in milliseconds, and
+MAXRSS_KB is its peak resident set size.  A previous instance retired by
+service.replace is listed with an EXITREASON of 'replace'.  Nothing is
+listed if the service has never exited.
+
+=cut
+*/
+bool ctl_cmd_svc_history(controller_t *ctl) {
+	service_t *svc;
+
+	if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+		return false;
+
+	ctl->statedump_svc= svc;
+	ctl->command_substate= 0;
+	ctl->state_fn= ctl_state_svc_history;
+	return true;
+}
+
+// Write one line per past run, as buffer space allows
+bool ctl_state_svc_history(controller_t *ctl) {
+	service_t *svc= ctl->statedump_svc;
+	const svc_run_t *run;
+	const char *signame;
+
+	// (the service is cleared by ctl_detach_service if it gets deleted)
+	while (svc && (run= svc_get_history(svc, ctl->command_substate))) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		if (WIFEXITED(run->wait_status))
+			ctl_write(ctl, "service.history	%s	%d	%d	%d	%s	%d	%u	%u\n",
+				svc_get_name(svc), (int)(run->start_time>>32), (int)(run->reap_time>>32), (int) run->pid,
+				run->kill_reason? run->kill_reason : "exit", WEXITSTATUS(run->wait_status),
+				run->cpu_ms, run->maxrss_kb);
+		else {
+			signame= sig_name_by_num(WTERMSIG(run->wait_status));
+			ctl_write(ctl, "service.history	%s	%d	%d	%d	%s	SIG%s	%u	%u\n",
+				svc_get_name(svc), (int)(run->start_time>>32), (int)(run->reap_time>>32), (int) run->pid,
+				run->kill_reason? run->kill_reason : "signal", signame? signame : "-?",
+				run->cpu_ms, run->maxrss_kb);
+		}
+		ctl->command_substate++;
+	}
+	ctl->statedump_svc= NULL;
+	ctl->command_substate= 0;
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
+/*
+=item service.heartbeat [NAME]
+
+Tell daemonproxy that the service is alive, postponing its watchdog.  A
+service sending this over its own control.cmd or control.socket handle can
+omit NAME.
+
+=cut
+*/
+bool ctl_cmd_svc_heartbeat(controller_t *ctl) {
+	service_t *svc;
+
+	if (ctl_peek_arg(ctl, NULL)) {
+		if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+			return false;
+	}
+	else if (!(svc= ctl->service)) {
+		ctl->command_error= "Expected service name";
+		return false;
+	}
+
+	if (!svc_handle_heartbeat(svc)) {
+		ctl->command_error= "service is not running";
+		return false;
+	}
+	return true;
+}
+
+/*
+=item service.replace NAME [GRACE [SIGNAL]]
+
+Replace the running instance of a service without a gap.  A second instance
+is started with the same arguments and file descriptors (so it can share
+listening sockets), and the current instance keeps running until the new one
+sends service.ready, or until GRACE seconds (default 10) have passed.  Then
+the old instance is sent SIGNAL (default SIGTERM) and the new one becomes the
+service's process, reported with a service.state 'up' event.  If the old
+instance exits first, the new one takes over immediately.  If the new one
+exits first, the old one is left alone.  Progress is reported with
+service.replace events.  GRACE is at most 7FFFFFFF.  Another replace is
+refused until the old instance has exited.
+
+If the service uses control.cmd, control.event or control.socket, the new
+instance needs a free controller of its own while both are running.
+
+=cut
+*/
+bool ctl_cmd_svc_replace(controller_t *ctl) {
+	service_t *svc;
+	int64_t grace= 10;
+	int sig= SIGTERM;
+	
+	if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+		return false;
+	if (ctl_peek_arg(ctl, NULL) && !ctl_get_arg_int(ctl, &grace))
+		return false;
+	if (grace < 0 || grace > 0x7FFFFFFF) {
+		ctl->command_error= "invalid grace period (must be 0..7FFFFFFF)";
+		return false;
+	}
+	if (ctl_peek_arg(ctl, NULL) && !ctl_get_arg_signal(ctl, &sig))
+		return false;
+	if (svc_get_pid(svc) <= 0 || svc_get_wstat(svc) >= 0) {
+		ctl->command_error= "service is not running";
+		return false;
+	}
+	if (!svc_replace(svc, grace << 32, sig)) {
+		ctl->command_error= (errno == EBUSY)? "replacement already in progress, or old instance still running"
+			: "can't start replacement";
+		return false;
+	}
+	return true;
+}
+
+/*
+=item service.ready [NAME]
+
+Tell daemonproxy that the replacement instance started by service.replace is
+ready to take over.  The new instance can send this over its own control.cmd
+or control.socket handle, and omit NAME.  It does nothing if no replacement is
+in progress, so a service can send it every time it starts.
+
+=cut
+*/
+bool ctl_cmd_svc_ready(controller_t *ctl) {
+	service_t *svc;
+
+	if (ctl_peek_arg(ctl, NULL)) {
+		if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+			return false;
+	}
+	else if (!(svc= ctl->service)) {
+		ctl->command_error= "Expected service name";
+		return false;
+	}
+	svc_handle_ready(svc);
+	return true;
+}
+
 /*
 =item service.start NAME [FUTURE_TIMESTAMP]
 
@@ -1444,11 +2555,93 @@ bool ctl_cmd_svc_delete(controller_t *ctl) {
 		return false;
 	}
 
-	ctl_write(NULL, "service.state	%s	deleted	-	-	-	-	-	-\n", svc_get_name(svc));
+	ctl_write(NULL, "service.state	%s	deleted	-	-	-	-	-	-%s\n", svc_get_name(svc),
+		opt_coalesce_events? "\t-\t-\t-" : "");
 	svc_delete(svc);
 	return true;
 }
 
+/*
+=item flight.dump
+
+List the entries in the flight recorder, oldest first, one line each:
+
+  flight TIME EVENT A B TEXT
+
+The flight recorder is a fixed-size ring which always holds the most recent
+internal events: 'loop' for each main loop iteration (A is the result of
+select and B the highest descriptor), 'fork' and 'reap' of a pid (B of reap is
+the wait status), 'state.*' for each service state change (A is the pid),
+'cmd' for each controller command (A is the controller id), and 'fatal'.
+TEXT is the service name, command text or message, truncated to 39 bytes.
+The same entries are written out when daemonproxy hits a fatal error; see
+flight.dest.
+
+=cut
+*/
+bool ctl_cmd_flight_dump(controller_t *ctl) {
+	ctl->command_substate= (int) flight_first();
+	ctl->flight_end= flight_end();
+	ctl->state_fn= ctl_state_flight_dump;
+	return true;
+}
+
+bool ctl_state_flight_dump(controller_t *ctl) {
+	char buf[128];
+	uint32_t seq;
+	int n;
+
+	while ((seq= (uint32_t) ctl->command_substate) != ctl->flight_end) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		// entries overwritten while we were blocked are skipped
+		if ((n= flight_format(seq, buf, sizeof(buf))) >= 0)
+			ctl_write(ctl, "flight\t%.*s\n", n, buf);
+		ctl->command_substate++;
+	}
+	ctl->command_substate= 0;
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
+/*
+=item flight.dest fd FD_NAME
+
+=item flight.dest log
+
+Choose where the flight recorder is written when daemonproxy hits a fatal
+error: the named file descriptor, or (the default) the same place as the
+log.  If FD_NAME doesn't exist at that time, the log is used.
+
+=cut
+*/
+bool ctl_cmd_flight_dest(controller_t *ctl) {
+	strseg_t arg, fd_name;
+	fd_t *fd;
+
+	if (!ctl_get_arg(ctl, &arg))
+		return false;
+
+	if (strseg_cmp(arg, STRSEG("fd")) == 0) {
+		if (!ctl_get_arg_fd(ctl, false, false, &fd_name, &fd))
+			return false;
+
+		if (!fd)
+			ctl_write(ctl, "warning	fd \"%.*s\" does not exist\n", fd_name.len, fd_name.data);
+
+		flight_set_dest(fd_name);
+		return true;
+	}
+	else if (strseg_cmp(arg, STRSEG("log")) == 0) {
+		flight_set_dest(STRSEG(""));
+		return true;
+	}
+	else {
+		ctl->command_error= "Unknown flight recorder destination";
+		return false;
+	}
+}
+
 /*
 =item log.filter [+|-|none|LEVELNAME]
 
@@ -1522,6 +2715,115 @@ bool ctl_cmd_log_dest(controller_t *ctl) {
 	}
 }
 
+/*
+=item rule.set NAME EVENT SELECTOR CONDITIONS ACTION [ARGS...]
+
+Define a rule, which makes daemonproxy react to an event on its own, within
+microseconds, rather than waiting for a controller to read the event and send
+back a command.  A rule by the same NAME is replaced.  EVENT is one of:
+
+=over
+
+=item service.state SERVICE_SELECTOR CONDITIONS
+
+A service matched by SERVICE_SELECTOR (a service name, "*", or "tag:TAG")
+changed state.  CONDITIONS is "-" for any change, or a comma-separated list
+of "state=down", "state=start", or "state=up", "exit=CODE", "signal=SIGNAL",
+and "reason=EXITREASON", which compare with the fields of the service.state
+event.  Any of the last three implies state=down.
+
+=item signal SIGNAL -
+
+Daemonproxy received SIGNAL.  (The signal is still reported to controllers.)
+
+=back
+
+ACTION is one of:
+
+=over
+
+=item service.start SERVICE_SELECTOR
+
+Start each matching service which is down and has args.
+
+=item service.signal SERVICE_SELECTOR SIGNAL [group]
+
+Send SIGNAL to each matching service which is running.
+
+=back
+
+For example, to start "cleanup" whenever "db" exits with code 3, and to send
+SIGHUP to every service tagged "reload" when daemonproxy gets SIGUSR1:
+
+  rule.set  db-crash  service.state  db      exit=3  service.start   cleanup
+  rule.set  reload    signal         SIGUSR1 -       service.signal  tag:reload  SIGHUP
+
+An action can trigger more rules, up to 4 deep.  A service can't restart
+itself from its own state=down rule (use service.auto_up for that).
+
+=cut
+*/
+bool ctl_cmd_rule_set(controller_t *ctl) {
+	strseg_t name;
+	const char *error;
+
+	if (!ctl_get_arg(ctl, &name))
+		return false;
+	if (!rule_set(name, ctl->command, &error)) {
+		ctl->command_error= error;
+		return false;
+	}
+	return true;
+}
+
+/*
+=item rule.delete NAME
+
+Remove a rule.
+
+=cut
+*/
+bool ctl_cmd_rule_delete(controller_t *ctl) {
+	strseg_t name;
+
+	if (!ctl_get_arg(ctl, &name))
+		return false;
+	if (!rule_delete(name)) {
+		ctl->command_error= "No such rule";
+		return false;
+	}
+	return true;
+}
+
+/*
+=item rule.list
+
+List the rules, one line each:
+
+  rule NAME EVENT SELECTOR CONDITIONS ACTION [ARGS...]
+
+=cut
+*/
+bool ctl_cmd_rule_list(controller_t *ctl) {
+	ctl->command_substate= 0;
+	ctl->state_fn= ctl_state_rule_list;
+	return true;
+}
+
+bool ctl_state_rule_list(controller_t *ctl) {
+	const char *name, *spec;
+
+	while (rule_get(ctl->command_substate, &name, &spec)) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		ctl_write(ctl, "rule\t%s\t%s\n", name, spec);
+		ctl->command_substate++;
+	}
+	ctl->command_substate= 0;
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
 /*
 =item signal.clear SIGNAL COUNT
 
@@ -1546,6 +2848,202 @@ bool ctl_cmd_signal_clear(controller_t *ctl) {
 	return true;
 }
 
+/*
+=item signal.route SIGNAL SELECTOR TARGET_SIGNAL [FLAGS]
+
+=item signal.route SIGNAL SELECTOR -
+
+=item signal.route
+
+Forward SIGNAL, each time daemonproxy receives it, as TARGET_SIGNAL to every
+running service matched by SELECTOR.  SELECTOR is a service name, "*" for all
+services, or "tag:TAG" for the services which have TAG among their tags.  The
+flag "group" sends the signal to the process group of each service.  The
+signals are sent by the main loop as soon as the signal arrives, without
+waiting for a controller, so a SIGTERM to daemonproxy can reach every service
+in the same instant.  Only signals received after the route is added are
+forwarded.  The signal is still reported to controllers, and still counts
+for auto_up triggers.
+
+Setting a route for the same SIGNAL and SELECTOR replaces it, and a
+TARGET_SIGNAL of "-" removes it.  Up to 16 routes can exist.  With no
+arguments, lists the routes, one line each:
+
+  signal.route SIGNAL SELECTOR TARGET_SIGNAL FLAGS
+
+=cut
+*/
+bool ctl_cmd_signal_route(controller_t *ctl) {
+	strseg_t selector, arg, flag;
+	int sig, target= 0;
+	bool group= false;
+
+	if (ctl->command.len <= 0) {
+		ctl->command_substate= 0;
+		ctl->state_fn= ctl_state_signal_routes;
+		return true;
+	}
+	if (!ctl_get_arg_signal(ctl, &sig))
+		return false;
+	if (!ctl_get_arg(ctl, &selector))
+		return false;
+	if (!svc_check_selector(selector)) {
+		ctl->command_error= "Invalid service selector";
+		return false;
+	}
+	if (!ctl_peek_arg(ctl, &arg)) {
+		ctl->command_error= "Expected target signal, or '-'";
+		return false;
+	}
+	if (!(arg.len == 1 && arg.data[0] == '-')) {
+		if (!ctl_get_arg_signal(ctl, &target))
+			return false;
+		if (ctl_peek_arg(ctl, &arg)) {
+			while (strseg_tok_next(&arg, ',', &flag)) {
+				if (strseg_cmp(flag, STRSEG("group")) == 0)
+					group= true;
+				else {
+					snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+						"unknown option \"%.*s\"", flag.len, flag.data);
+					ctl->command_error= ctl->command_error_buf;
+					return false;
+				}
+			}
+		}
+	}
+	if (!svc_sig_route_set(sig, selector, target, group)) {
+		ctl->command_error= "Signal routing table is full";
+		return false;
+	}
+	return true;
+}
+
+bool ctl_state_signal_routes(controller_t *ctl) {
+	const svc_sig_route_t *route;
+	const char *signame, *targetname;
+
+	while ((route= svc_sig_route_get(ctl->command_substate))) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		signame= sig_name_by_num(route->signum);
+		targetname= sig_name_by_num(route->target);
+		ctl_write(ctl, "signal.route	SIG%s	%s	SIG%s	%s\n", signame? signame : "-?",
+			route->selector, targetname? targetname : "-?", route->group? "group" : "-");
+		ctl->command_substate++;
+	}
+	ctl->command_substate= 0;
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
+/*
+=item sim.advance SECONDS
+
+Only valid with --simulate.  Let the virtual clock run forward by SECONDS,
+processing every timer and scripted exit that falls within that time in
+order.  When the clock gets there, daemonproxy replies with
+
+  sim.time	SECONDS
+
+(the new time on the virtual clock), and this controller carries on with its
+next command.
+
+=cut
+*/
+bool ctl_cmd_sim_advance(controller_t *ctl) {
+	int64_t secs;
+	if (!sim_enabled()) {
+		ctl->command_error= "not running with --simulate";
+		return false;
+	}
+	if (!ctl_get_arg_ts(ctl, &secs))
+		return false;
+	if (secs < 0) {
+		ctl->command_error= "invalid time";
+		return false;
+	}
+	ctl->sim_target= wake->now + secs;
+	sim_advance(ctl->sim_target);
+	ctl->state_fn= ctl_state_sim_advance;
+	return true;
+}
+
+bool ctl_state_sim_advance(controller_t *ctl) {
+	if (ctl->sim_target - wake->now > 0) {
+		wake_at_time(ctl->sim_target);
+		return false;
+	}
+	if (!ctl_out_buf_ready(ctl))
+		return false;
+	ctl_write(ctl, "sim.time\t%lld\n", (long long)(wake->now >> 32));
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
+/*
+=item sim.exit NAME SECONDS exit CODE
+
+=item sim.exit NAME SECONDS signal SIGNAL
+
+=item sim.exit NAME
+
+Only valid with --simulate.  Each later run of service NAME ends SECONDS after
+it starts, with the given exit code or signal, as if the process had exited
+on its own.  Without the other arguments, runs of NAME last until they are
+signaled (the default).  NAME does not need to be an existing service.
+
+=cut
+*/
+bool ctl_cmd_sim_exit(controller_t *ctl) {
+	strseg_t name, reason;
+	int64_t delay, code;
+	int wstat, sig;
+
+	if (!sim_enabled()) {
+		ctl->command_error= "not running with --simulate";
+		return false;
+	}
+	if (!ctl_get_arg(ctl, &name))
+		return false;
+	if (ctl->command.len <= 0) {
+		delay= -1;
+		wstat= 0;
+	}
+	else {
+		if (!ctl_get_arg_ts(ctl, &delay))
+			return false;
+		if (delay < 0) {
+			ctl->command_error= "invalid time";
+			return false;
+		}
+		if (!ctl_get_arg(ctl, &reason))
+			return false;
+		if (0 == strseg_cmp(reason, STRSEG("exit"))) {
+			if (!ctl_get_arg_int(ctl, &code))
+				return false;
+			if (code < 0 || code > 255) {
+				ctl->command_error= "invalid exit code";
+				return false;
+			}
+			wstat= (int) code << 8;
+		}
+		else if (0 == strseg_cmp(reason, STRSEG("signal"))) {
+			if (!ctl_get_arg_signal(ctl, &sig))
+				return false;
+			wstat= sig;
+		}
+		else {
+			ctl->command_error= "expected \"exit\" or \"signal\"";
+			return false;
+		}
+	}
+	if (!sim_set_exit(name, delay, wstat)) {
+		ctl->command_error= "unable to store script";
+		return false;
+	}
+	return true;
+}
+
 /*
 =item socket.create OPTIONS PATH
 
@@ -1738,33 +3236,67 @@ bool ctl_notify_signal(controller_t *ctl, int sig_num, int64_t sig_ts, int count
 
 The state of service has changed.  STATE is 'start', 'up', 'down', or 'deleted'.
 TS is a timestamp from CLOCK_MONOTONIC.  PID is the process ID if relevant,
-and '-' otherwise.  EXITREASON is '-', 'exit', or 'signal'.  EXITVALUE is an
-integer or signal name.  UPTIME and DOWNTIME are in seconds, and '-' if not
-relevant.
+and '-' otherwise.  EXITREASON is '-', 'exit', or 'signal', or the name of the
+monitor which killed the service, such as 'probe'.  EXITVALUE is an integer or
+signal name.  UPTIME and DOWNTIME are in seconds, and '-' if not relevant.
+
+With --coalesce-events (or event.coalesce) only the final state of a service
+is reported for each iteration of the main loop, and three fields are
+appended: RESTARTS LAST_EXITREASON LAST_EXITVALUE.  RESTARTS counts the
+automatic restarts of the service, and the others describe how the run before
+the current one ended (or '-' if there was none), so a restart which was
+reported only as 'up' can still be seen.
 
 =cut
 */
 
-bool ctl_notify_svc_state(controller_t *ctl, const char *name, int64_t up_ts, int64_t reap_ts, int wstat, pid_t pid) {
-	const char *signame;
+bool ctl_notify_svc_state(controller_t *ctl, service_t *svc) {
+	const char *name= svc_get_name(svc), *signame, *reason;
+	int64_t up_ts= svc_get_up_ts(svc), reap_ts= svc_get_reap_ts(svc);
+	int wstat= svc_get_wstat(svc);
+	pid_t pid= svc_get_pid(svc);
+	char extra[64];
 	log_trace("ctl_notify_svc_state(%s, %lld, %lld, %d, %d)", name, up_ts, reap_ts, pid, wstat);
+	ctl_format_svc_state_extra(extra, sizeof(extra), svc);
 	if (!up_ts)
-		return ctl_write(ctl, "service.state	%s	down	-	-	-	-	-	-\n", name);
+		return ctl_write(ctl, "service.state	%s	down	-	-	-	-	-	-%s\n", name, extra);
 	else if ((up_ts - wake->now) >= 0 && !pid)
-		return ctl_write(ctl, "service.state	%s	start	%d	-	-	-	-	-\n",
-			name, (int)(up_ts>>32));
+		return ctl_write(ctl, "service.state	%s	start	%d	-	-	-	-	-%s\n",
+			name, (int)(up_ts>>32), extra);
 	else if (!reap_ts)
-		return ctl_write(ctl, "service.state	%s	up	%d	%d	-	-	%d	-\n",
-			name, (int)(up_ts>>32), (int) pid, (int)((wake->now - up_ts)>>32));
+		return ctl_write(ctl, "service.state	%s	up	%d	%d	-	-	%d	-%s\n",
+			name, (int)(up_ts>>32), (int) pid, (int)((wake->now - up_ts)>>32), extra);
+	reason= svc_get_kill_reason(svc);
+	if (WIFEXITED(wstat))
+		return ctl_write(ctl, "service.state	%s	down	%d	%d	%s	%d	%d	%d%s\n",
+			name, (int)(reap_ts>>32), (int) pid, reason? reason : "exit", WEXITSTATUS(wstat),
+			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32), extra);
+	else {
+		signame= sig_name_by_num(WTERMSIG(wstat));
+		return ctl_write(ctl, "service.state	%s	down	%d	%d	%s	SIG%s	%d	%d%s\n",
+			name, (int)(reap_ts>>32), (int) pid, reason? reason : "signal", signame? signame : "-?",
+			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32), extra);
+	}
+}
+
+/* Format the fields which --coalesce-events appends to service.state:
+ * RESTARTS LAST_EXITREASON LAST_EXITVALUE, or an empty string otherwise.
+ */
+static void ctl_format_svc_state_extra(char *buf, size_t bufsize, service_t *svc) {
+	const char *reason= svc_get_last_kill_reason(svc), *signame;
+	int wstat= svc_get_last_wstat(svc);
+
+	if (!opt_coalesce_events)
+		buf[0]= '\0';
+	else if (wstat == -1)
+		snprintf(buf, bufsize, "\t%d\t-\t-", svc_get_restart_count(svc));
 	else if (WIFEXITED(wstat))
-		return ctl_write(ctl, "service.state	%s	down	%d	%d	exit	%d	%d	%d\n",
-			name, (int)(reap_ts>>32), (int) pid, WEXITSTATUS(wstat),
-			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32));
+		snprintf(buf, bufsize, "\t%d\t%s\t%d", svc_get_restart_count(svc),
+			reason? reason : "exit", WEXITSTATUS(wstat));
 	else {
 		signame= sig_name_by_num(WTERMSIG(wstat));
-		return ctl_write(ctl, "service.state	%s	down	%d	%d	signal	SIG%s	%d	%d\n",
-			name, (int)(reap_ts>>32), (int) pid, signame? signame : "-?",
-			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32));
+		snprintf(buf, bufsize, "\t%d\t%s\tSIG%s", svc_get_restart_count(svc),
+			reason? reason : "signal", signame? signame : "-?");
 	}
 }
 
@@ -1816,16 +3348,93 @@ bool ctl_notify_svc_auto_up(controller_t *ctl, const char *name, int64_t interva
 	return true;
 }
 
+/*
+=item service.probe NAME INTERVAL TIMEOUT THRESHOLD FLAGS TYPE [ARGS]...
+
+The health-check probe for the service has changed.  A spec of '-' means the
+service has no probe.
+
+=cut
+*/
+bool ctl_notify_svc_probe(controller_t *ctl, const char *name, const char *tsv_spec) {
+	return ctl_write(ctl, "service.probe	%s	%s\n", name, tsv_spec[0]? tsv_spec : "-");
+}
+
+/*
+=item service.health NAME STATUS FAILURES DETAIL
+
+Result of a health-check probe.  STATUS is 'ok', 'fail', or 'unhealthy' once
+FAILURES (the count of consecutive failed probes) reaches the threshold.
+DETAIL is free-form text such as 'exit 1' or 'timeout'.  Every failure is
+reported, but success is only reported when the status changes.
+
+=cut
+*/
+bool ctl_notify_svc_health(controller_t *ctl, const char *name, const char *status, int failures, const char *detail) {
+	return ctl_write(ctl, "service.health	%s	%s	%d	%s\n", name, status, failures, detail);
+}
+
+/*
+=item service.replace NAME STATUS PID DETAIL
+
+Progress of service.replace.  STATUS is 'started' when the replacement
+instance PID is running, 'promoted' when PID has taken over as the service's
+process, or 'failed' if PID ended before taking over (DETAIL is like 'exit 1'
+or 'signal SIGKILL', and '-' otherwise).
+
+=cut
+*/
+bool ctl_notify_svc_replace(controller_t *ctl, const char *name, const char *status, pid_t pid, const char *detail) {
+	return ctl_write(ctl, "service.replace	%s	%s	%d	%s\n", name, status, (int) pid, detail);
+}
+
+/*
+=item service.watchdog NAME TIMEOUT [SIGNAL [FLAGS]]
+
+The watchdog for the service has changed.  A TIMEOUT of '-' means the service
+has no watchdog.
+
+=cut
+*/
+bool ctl_notify_svc_watchdog(controller_t *ctl, const char *name, const char *tsv_spec) {
+	return ctl_write(ctl, "service.watchdog	%s	%s\n", name, tsv_spec[0]? tsv_spec : "-");
+}
+
+/*
+=item service.max_runtime NAME SECONDS [SIGNAL [FLAGS]]
+
+The maximum runtime of the service has changed.  A SECONDS of '-' means the
+service has no limit.
+
+=cut
+*/
+bool ctl_notify_svc_max_runtime(controller_t *ctl, const char *name, const char *tsv_spec) {
+	return ctl_write(ctl, "service.max_runtime	%s	%s\n", name, tsv_spec[0]? tsv_spec : "-");
+}
+
+/*
+=item service.spare NAME BOOL
+
+The service does (1) or doesn't (0) keep a standby process.  Only services
+which keep one are listed by statedump.
+
+=cut
+*/
+bool ctl_notify_svc_spare(controller_t *ctl, const char *name, bool enabled) {
+	return ctl_write(ctl, "service.spare	%s	%d\n", name, enabled? 1 : 0);
+}
+
 /*
 =item fd.state NAME TYPE FLAGS DESCRIPTION
 
-TYPE is 'file', 'pipe', 'socket', 'special', or 'deleted'.  Deleted means the file
-handle has just been removed and no longer exists.  Type 'file' has FLAGS
+TYPE is 'file', 'pipe', 'socket', 'special', 'memfd', 'eventfd', 'timerfd', or
+'deleted'.  Deleted means the file handle has just been removed and no longer exists.  Type 'file' has FLAGS
 that match the flags used to open it (though possibly in a different order).
 Type 'pipe' refers to both pipes and socketpairs.  Flags for a pipe are 'to' or 'from',
 but if it is a socketpair it also has flags for the domain and type.
 DESCRIPTION is the filename (possibly truncated), the pipe-peer handle name,
-the bound socket address, or a free-form string describing the handle.
+the bound socket address, or a free-form string describing the handle.  For a
+memfd it is the current size, and its FLAGS include 'sealed' once sealed.
 
 =cut
 */
@@ -1862,6 +3471,21 @@ bool ctl_notify_fd_state(controller_t *ctl, fd_t *fd) {
 		);
 		return true;
 	}
+	else if (flags.memfd) {
+		struct stat st;
+		int seals= fcntl(fd_get_fdnum(fd), F_GET_SEALS);
+		if (fstat(fd_get_fdnum(fd), &st) < 0)
+			st.st_size= 0;
+		return ctl_write(ctl, "fd.state" "\t" "%s" "\t" "memfd" "\t" "%s" "\t" "size=%lld\n",
+			name, (seals > 0 && (seals & F_SEAL_WRITE))? "read,sealed" : "read,write",
+			(long long) st.st_size);
+	}
+	else if (flags.eventfd || flags.timerfd) {
+		return ctl_write(ctl, "fd.state" "\t" "%s" "\t" "%s" "\t" "%s%s" "\t" "%s\n",
+			name, flags.eventfd? "eventfd" : "timerfd",
+			flags.write? "read,write" : "read", flags.nonblock? ",nonblock" : "",
+			fd_get_file_path(fd));
+	}
 	else {
 		return ctl_write(ctl, "fd.state" "\t" "%s" "\t" "%s" "\t" "%s%s%s%s%s%s" "\t" "%s\n",
 			name, flags.special? "special" : "file",
@@ -1888,26 +3512,33 @@ token, but MESSAGE being arbitrary ascii text.
 // Read more controller input from recv_fd
 bool ctl_read_more(controller_t *ctl) {
 	int n, e;
-	if (ctl->recv_fd < 0 || ctl->recv_buf_pos >= CONTROLLER_RECV_BUF_SIZE)
+	if (ctl->recv_fd < 0 || !ctl_recv_buf_room(ctl))
+		return false;
+	// Grow the buffer when it is full with only part of a command
+	if (ctl->recv_buf_pos >= ctl->recv_buf_size
+		&& !ctl_buf_grow(&ctl->recv_buf, &ctl->recv_buf_size, ctl->recv_buf_pos,
+			ctl->recv_buf_pos + 1, CONTROLLER_RECV_BUF_SIZE))
 		return false;
 	if (ctl->recv_is_socket) {
-		char control_buf[64];
+		char control_buf[CMSG_SPACE(sizeof(int) * CONTROLLER_RECV_MAX_MSG_FD)];
 		struct msghdr msg;
 		struct iovec  iov;
 		memset(&msg, 0, sizeof(msg));
 		memset(&iov, 0, sizeof(iov));
 		iov.iov_base= ctl->recv_buf + ctl->recv_buf_pos;
-		iov.iov_len=  CONTROLLER_RECV_BUF_SIZE - ctl->recv_buf_pos;
+		iov.iov_len=  ctl->recv_buf_size - ctl->recv_buf_pos;
 		msg.msg_iov= &iov;
 		msg.msg_iovlen= 1;
 		msg.msg_control= control_buf;
 		msg.msg_controllen= sizeof(control_buf);
 		n= recvmsg(ctl->recv_fd, &msg, 0);
+		if (n > 0 && (msg.msg_flags & MSG_CTRUNC))
+			log_error("controller[%d] sent too many file descriptors; some were discarded", ctl->id);
 		if (msg.msg_controllen > 0)
 			ctl_read_ancillary_fds(ctl, &msg);
 	}
 	else {
-		n= read(ctl->recv_fd, ctl->recv_buf + ctl->recv_buf_pos, CONTROLLER_RECV_BUF_SIZE - ctl->recv_buf_pos);
+		n= read(ctl->recv_fd, ctl->recv_buf + ctl->recv_buf_pos, ctl->recv_buf_size - ctl->recv_buf_pos);
 	}
 	if (n <= 0) {
 		e= errno;
@@ -1923,15 +3554,25 @@ bool ctl_read_more(controller_t *ctl) {
 		return false;
 	}
 	ctl->recv_buf_pos += n;
+	ctl->buf_active_ts= wake->now;
 	log_trace("controller[%d] read %d bytes (%d in recv buf)", ctl->id, n, ctl->recv_buf_pos);
 	return true;
 }
 
+// Check whether ctl_read_more has room to read into.  A full buffer can grow
+// up to CONTROLLER_RECV_BUF_SIZE, but not while it holds a command in progress
+// (whose strsegs point into it).
+static bool ctl_recv_buf_room(controller_t *ctl) {
+	return ctl->recv_buf_pos < ctl->recv_buf_size
+		|| (ctl->recv_buf_pos < CONTROLLER_RECV_BUF_SIZE
+			&& (!ctl->recv_buf_pos || !memchr(ctl->recv_buf, '\n', ctl->recv_buf_pos)));
+}
+
 void ctl_read_ancillary_fds(controller_t *ctl, struct msghdr *msg) {
 	// Find any new FD which has been delivered to us
-	// We store at most 2 of them (one for the current message which might not be
-	// complete, and one for the next message which might deliver ancillary data
-	// as we get the remainder of the first message)
+	// We store at most two messages worth of them (one for the current message
+	// which might not be complete, and one for the next message which might
+	// deliver ancillary data as we get the remainder of the first message)
 	struct cmsghdr *cmsg;
 	for (cmsg= CMSG_FIRSTHDR(msg); cmsg; cmsg= CMSG_NXTHDR(msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
@@ -1953,23 +3594,43 @@ void ctl_read_ancillary_fds(controller_t *ctl, struct msghdr *msg) {
 
 // Try to write data to a controller, nonblocking.
 // Return true if the message was queued, or false if it can't be written.
-// If ctl is NULL, then all controllers with send_fd will be notified, assuming
-//  they aren't in an overflow condition.  Return value is always true when broadcasting.
+// If ctl is NULL, then all controllers with send_fd will be notified on their
+//  event lane, assuming that lane isn't in an overflow condition.  Otherwise
+//  the message goes in the controller's direct_lane (normally the bulk lane).
+//  Return value is always true when broadcasting.
 bool ctl_write(controller_t *single_dest, const char *fmt, ... ) {
 	controller_t * dest[CONTROLLER_MAX_CLIENTS];
-	int dest_n, i;
+	ctl_lane_t *lane;
+	int dest_n, i, lane_idx;
+	char ring_msg[CONTROLLER_SEND_BUF_SIZE];
+	const char *msg_data= NULL;
+	int msg_len= -1;
 	
 	// Either send one message, or iterate all clients
 	if (single_dest) {
-		if (!single_dest->state_fn || single_dest->send_fd < 0 || single_dest->send_overflow)
+		lane_idx= single_dest->direct_lane;
+		if (!single_dest->state_fn || single_dest->send_fd < 0 || single_dest->send_lane[lane_idx].overflow)
 			return true;
 		dest[0]= single_dest;
 		dest_n= 1;
 	}
 	else {
+		lane_idx= CTL_LANE_EVENT;
+		// The event ring gets every broadcast, so format the message up front
+		if (event_ring_enabled()) {
+			va_list val;
+			va_start(val, fmt);
+			msg_len= vsnprintf(ring_msg, sizeof(ring_msg), fmt, val);
+			va_end(val);
+			if (msg_len < sizeof(ring_msg)) {
+				event_ring_append(ring_msg, msg_len);
+				msg_data= ring_msg;
+			}
+			else msg_len= -1;
+		}
 		dest_n= 0;
 		for (i= 0; i < CONTROLLER_MAX_CLIENTS; i++) {
-			if (!client[i].state_fn || client[i].send_fd < 0 || client[i].send_overflow)
+			if (!client[i].state_fn || client[i].send_fd < 0 || client[i].send_lane[lane_idx].overflow)
 				continue;
 			dest[dest_n++]= &client[i];
 		}
@@ -1978,36 +3639,41 @@ bool ctl_write(controller_t *single_dest, const char *fmt, ... ) {
 	}
 	log_trace("write msg to %d controllers", dest_n);
 	
-	const char *msg_data= NULL;
-	int msg_len= -1;
 	int p, buf_free;
 	for (i= 0; i < dest_n; i++) {
+		lane= &dest[i]->send_lane[lane_idx];
+		if (!lane->buf && !ctl_lane_reserve(lane, msg_len < 0? 1 : msg_len + 1)) {
+			lane->overflow= true;
+			continue;
+		}
 		check_space:
-		buf_free= CONTROLLER_SEND_BUF_SIZE - dest[i]->send_buf_pos;
+		buf_free= lane->size - lane->pos;
 		// see if message fits in buffer
 		if (msg_len >= buf_free) {
+			// try a larger buffer
+			if (ctl_lane_reserve(lane, lane->pos + msg_len + 1))
+				goto check_space;
 			// try flushing
-			p= dest[i]->send_buf_pos;
+			p= lane->pos;
 			ctl_flush_outbuf(dest[i]);
 			// check if flushing made any progress
-			if (p != dest[i]->send_buf_pos)
+			if (p != lane->pos)
 				goto check_space;
 			
 			log_debug("client[%d]: can't write msg, %d > buffer free %d", dest[i]->id, msg_len, buf_free);
-			// if it is a broadcast, we mark the client outbuf as having overflowed
-			//if (!single_dest)
-				dest[i]->send_overflow= true;
+			// mark this lane of the client outbuf as having overflowed
+			lane->overflow= true;
 		}
 		else {
 			// If this is the second+ time printing, we can memcpy from the first
 			if (msg_data)
-				memcpy(dest[i]->send_buf + dest[i]->send_buf_pos, msg_data, msg_len);
+				memcpy(lane->buf + lane->pos, msg_data, msg_len);
 			// else printf
 			else {
 				va_list val;
 				va_start(val, fmt);
 				msg_len= vsnprintf(
-					dest[i]->send_buf + dest[i]->send_buf_pos,
+					lane->buf + lane->pos,
 					buf_free,
 					fmt, val);
 				va_end(val);
@@ -2017,10 +3683,15 @@ bool ctl_write(controller_t *single_dest, const char *fmt, ... ) {
 					log_trace("first write attempt didn't fit");
 					goto check_space;
 				}
-				msg_data= dest[i]->send_buf + dest[i]->send_buf_pos; // save for next iter
+				msg_data= lane->buf + lane->pos; // save for next iter
 			}
-			dest[i]->send_buf_pos += msg_len;
+			lane->pos += msg_len;
+			dest[i]->buf_active_ts= wake->now;
 			log_debug("client[%d] event: \"%.*s\"", dest[i]->id, msg_len, msg_data);
+			// An event jumps ahead of the bulk lane, so older bulk lines about
+			// the same object would arrive after it with stale information.
+			if (lane_idx == CTL_LANE_EVENT)
+				ctl_drop_superseded(dest[i], msg_data, msg_len);
 		}
 	}
 	
@@ -2037,37 +3708,55 @@ void create_missing_dirs(char *path) {
 	}
 }
 
+// Select the lane to flush next: one with a partially written line must be
+// finished first, otherwise the event lane takes priority over bulk.
+static ctl_lane_t * ctl_next_lane(controller_t *ctl) {
+	int i;
+	for (i= 0; i < CTL_LANE_COUNT; i++)
+		if (ctl->send_lane[i].partial)
+			return &ctl->send_lane[i];
+	return ctl->send_lane[CTL_LANE_EVENT].pos? &ctl->send_lane[CTL_LANE_EVENT]
+		: ctl->send_lane[CTL_LANE_BULK].pos? &ctl->send_lane[CTL_LANE_BULK]
+		: NULL;
+}
+
 // Try to flush the output buffer (nonblocking)
 // Return true if flushed completely.  false otherwise.
 static bool ctl_flush_outbuf(controller_t *ctl) {
-	int n, eol;
-	while (ctl->send_buf_pos) {
+	int n, eol, i;
+	ctl_lane_t *lane;
+	while ((lane= ctl_next_lane(ctl))) {
 		// find end of last line in buffer
-		for (eol= ctl->send_buf_pos-1; eol >= 0; eol--)
-			if (ctl->send_buf[eol] == '\n')
+		for (eol= lane->pos-1; eol >= 0; eol--)
+			if (lane->buf[eol] == '\n')
 				break;
 		log_trace("controller[%d] write buffer %d bytes pending, final eol at %d, %s",
-			ctl->id, ctl->send_buf_pos, eol, ctl->send_overflow? "(overflow flag set)" : "");
+			ctl->id, lane->pos, eol, lane->overflow? "(overflow flag set)" : "");
 		// if no send_fd, discard buffer
 		if (ctl->send_fd == -1)
-			ctl->send_buf_pos= 0;
+			lane->pos= 0;
 		// if no eol, can't continue
 		// This prevents partial lines from being written, which could get
 		// interrupted by an overflow condition and result in the controller
 		// script seeing a half-event.
 		else if (eol < 0) {
 			// if overflow is set, discard partial line.
-			if (ctl->send_overflow) ctl->send_buf_pos= 0;
+			if (lane->overflow) lane->pos= 0;
 			else return false;
 		}
 		// else write as much as we can (on nonblocking fd)
 		else {
-			n= write(ctl->send_fd, ctl->send_buf, eol+1);
+			n= write(ctl->send_fd, lane->buf, eol+1);
 			if (n > 0) {
 				log_trace("controller[%d] flushed %d bytes", ctl->id, n);
-				ctl->send_buf_pos -= n;
+				if (ctl->record_session) {
+					char nbuf[16];
+					session_record(ctl->record_session, "read", nbuf, snprintf(nbuf, sizeof(nbuf), "%d", n));
+				}
+				lane->partial= (lane->buf[n-1] != '\n');
+				lane->pos -= n;
 				ctl->send_blocked_ts= 0;
-				memmove(ctl->send_buf, ctl->send_buf + n, ctl->send_buf_pos);
+				memmove(lane->buf, lane->buf + n, lane->pos);
 			}
 			else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
 				// mark the time when this happened.  We clear this next time a write succeeds
@@ -2084,23 +3773,77 @@ static bool ctl_flush_outbuf(controller_t *ctl) {
 			}
 		}
 	}
-	// If we just finished emptying the buffer, and the overflow flag is set,
+	// If we just finished emptying the buffers, and an overflow flag is set,
 	// then send the overflow message.
-	if (ctl->send_overflow) {
-		memcpy(ctl->send_buf, "overflow\n", 9);
-		ctl->send_buf_pos= 9;
-		ctl->send_overflow= false;
-		return ctl_flush_outbuf(ctl);
+	for (i= 0; i < CTL_LANE_COUNT; i++) {
+		lane= &ctl->send_lane[i];
+		if (lane->overflow && ctl_lane_reserve(lane, 9)) {
+			session_record(ctl->record_session, "overflow", "", 0);
+			memcpy(lane->buf, "overflow\n", 9);
+			lane->pos= 9;
+			lane->overflow= false;
+			return ctl_flush_outbuf(ctl);
+		}
 	}
 	return true;
 }
 
+// Check whether there is room for the largest write in the lane that
+// ctl_write would use for this controller.
 static bool ctl_out_buf_ready(controller_t *ctl) {
-	return ctl->send_buf_pos <= (CONTROLLER_SEND_BUF_SIZE-CONTROLLER_LARGEST_WRITE)
-		|| ctl->send_overflow // if overflow, just allow writes to be discarded
+	ctl_lane_t *lane= &ctl->send_lane[ctl->direct_lane];
+	return lane->pos <= (CONTROLLER_SEND_BUF_SIZE-CONTROLLER_LARGEST_WRITE)
+		|| lane->overflow // if overflow, just allow writes to be discarded
 		|| ctl_flush_outbuf(ctl);
 }
 
+// Make room in a send lane for need bytes in total, up to CONTROLLER_SEND_BUF_SIZE
+static bool ctl_lane_reserve(ctl_lane_t *lane, int need) {
+	return need <= lane->size
+		|| ctl_buf_grow(&lane->buf, &lane->size, lane->pos, need, CONTROLLER_SEND_BUF_SIZE);
+}
+
+// An overflow flag counts as pending output, since the "overflow" line still
+// has to be sent even if the message that didn't fit left the lane empty.
+static bool ctl_send_pending(controller_t *ctl) {
+	return ctl->send_lane[CTL_LANE_EVENT].pos > 0 || ctl->send_lane[CTL_LANE_BULK].pos > 0
+		|| ctl->send_lane[CTL_LANE_EVENT].overflow || ctl->send_lane[CTL_LANE_BULK].overflow;
+}
+
+/** Remove lines from the bulk lane which are superseded by an event.
+ *
+ * Lines match if they begin with the same "TYPE\tNAME\t" as the event.
+ * A line which has been partially written is left alone.
+ */
+static void ctl_drop_superseded(controller_t *ctl, const char *msg, int msg_len) {
+	ctl_lane_t *lane= &ctl->send_lane[CTL_LANE_BULK];
+	const char *p, *end;
+	int prefix_len, start, eol;
+
+	// prefix is up to and including the second tab
+	if (!(p= memchr(msg, '\t', msg_len))
+		|| !(p= memchr(p+1, '\t', msg + msg_len - (p+1))))
+		return;
+	prefix_len= p + 1 - msg;
+
+	for (start= 0; start < lane->pos; ) {
+		end= memchr(lane->buf + start, '\n', lane->pos - start);
+		if (!end)
+			break;
+		eol= end - lane->buf + 1;
+		if (!(start == 0 && lane->partial)
+			&& eol - start >= prefix_len
+			&& 0 == memcmp(lane->buf + start, msg, prefix_len))
+		{
+			log_debug("client[%d] dropping superseded \"%.*s\"", ctl->id, eol - start - 1, lane->buf + start);
+			memmove(lane->buf + start, lane->buf + eol, lane->pos - eol);
+			lane->pos -= eol - start;
+		}
+		else
+			start= eol;
+	}
+}
+
 /** Extract the next argument as an integer
  */
 bool ctl_get_arg_int(controller_t *ctl, int64_t *val) {
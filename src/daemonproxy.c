@@ -33,6 +33,7 @@ int main(int argc, char** argv) {
 	int wstat, ret;
 	pid_t pid;
 	struct timeval tv;
+	struct rusage ru;
 	service_t *svc;
 	
 	// initialize wake structure, which is owned by main
@@ -62,11 +63,19 @@ int main(int argc, char** argv) {
 
 	// parse arguments, overriding default values
 	parse_opts(argv+1);
+	if (opt_simulate)
+		wake->now= gettime_mon_frac();
 	
 	// Check for required options
 	if (!opt_interactive && !opt_config_file && !opt_socket_path)
 		fatal(EXIT_BAD_OPTIONS, "require -i or -c or -S");
 	
+	// Names of pooled objects come from an arena allocated along with the pools
+	if ((opt_fd_pool_count > 0 && opt_fd_pool_size_each > 0) || (opt_svc_pool_count > 0 && opt_svc_pool_size_each > 0))
+		if (!name_preallocate(opt_fd_pool_count + opt_svc_pool_count,
+			(opt_fd_pool_count + opt_svc_pool_count) * NAME_POOL_BYTES_EACH))
+			fatal(EXIT_INVALID_ENVIRONMENT, "Unable to preallocate object names");
+
 	// Initialize file descriptor object pool
 	if (opt_fd_pool_count > 0 && opt_fd_pool_size_each > 0)
 		if (!fd_preallocate(opt_fd_pool_count, opt_fd_pool_size_each))
@@ -77,6 +86,13 @@ int main(int argc, char** argv) {
 	if (!register_open_fds())
 		fatal(EXIT_BAD_OPTIONS, "Not enough FD objects to register all open FDs");
 
+	// Helper processes should have default signal handling, and their sockets
+	// should not be registered as named FDs, so start them right here.
+	if (opt_spawner && !spawner_start())
+		fatal(EXIT_INVALID_ENVIRONMENT, "Can't start spawner helper");
+	if (opt_fs_workers > 0 && !fs_worker_init(opt_fs_workers))
+		fatal(EXIT_INVALID_ENVIRONMENT, "Can't start fs workers");
+
 	// Set up signal handlers and signal mask and signal self-pipe
 	// Do this AFTER registering all open FDs, because it creates a pipe
 	sig_init();
@@ -86,6 +102,12 @@ int main(int argc, char** argv) {
 		if (!svc_preallocate(opt_svc_pool_count, opt_svc_pool_size_each))
 			fatal(EXIT_INVALID_ENVIRONMENT, "Unable to preallocate service objects");
 
+	if (opt_state_table_path && !state_table_open(opt_state_table_path))
+		fatal(EXIT_INVALID_ENVIRONMENT, "Can't create state table");
+
+	if (opt_record_sessions_path && !session_record_open(opt_record_sessions_path))
+		fatal(EXIT_INVALID_ENVIRONMENT, "Can't create session record");
+
 	// Initialize controller object pool
 	control_socket_init();
 
@@ -128,11 +150,14 @@ int main(int argc, char** argv) {
 		sig_run();
 		
 		// reap all zombies, possibly waking services
-		while ((pid= waitpid(-1, &wstat, WNOHANG)) > 0) {
+		while ((pid= sim_wait4(&wstat, &ru)) > 0) {
 			log_trace("waitpid found pid = %d", (int)pid);
+			flight_record("reap", pid, wstat, NULL, 0);
 			if ((svc= svc_by_pid(pid)))
-				svc_handle_reaped(svc, wstat);
-			else
+				svc_handle_reaped(svc, wstat, &ru);
+			else if (!svc_handle_probe_reaped(pid, wstat) && !svc_handle_replace_reaped(pid, wstat, &ru)
+				&& !svc_handle_spare_reaped(pid, wstat)
+				&& !spawner_handle_reaped(pid, wstat))
 				log_trace("pid does not belong to any service");
 		}
 		if (pid < 0)
@@ -141,6 +166,9 @@ int main(int argc, char** argv) {
 		// run state machine of each service that is active.
 		svc_run_active();
 		
+		// announce final state of services, if events are being coalesced
+		svc_flush_state_events();
+		
 		// possibly accept new controller connections
 		control_socket_run();
 		
@@ -160,7 +188,8 @@ int main(int argc, char** argv) {
 		else
 			tv.tv_sec= tv.tv_usec= 0;
 		
-		ret= select(wake->max_fd+1, &wake->fd_read, &wake->fd_write, &wake->fd_err, &tv);
+		ret= sim_select(wake->max_fd+1, &wake->fd_read, &wake->fd_write, &wake->fd_err, &tv);
+		flight_record("loop", ret, wake->max_fd, NULL, 0);
 		if (ret < 0) {
 			// shouldn't ever fail, but if not EINTR, at least log it and prevent
 			// looping too fast
@@ -352,6 +381,8 @@ static bool setup_config_file(const char *path) {
 // returns monotonic time as a 32.32 fixed-point number 
 int64_t gettime_mon_frac() {
 	struct timespec t;
+	if (opt_simulate)
+		return sim_time();
 	if (clock_gettime(CLOCK_MONOTONIC, &t) != 0) {
 		t.tv_sec= time(NULL);
 		t.tv_nsec= 0;
@@ -388,6 +419,12 @@ void fatal(int exitcode, const char *msg, ...) {
 	}
 	else msgbuf[0]= '\0';
 
+	// Write out what led up to this, unless it is a normal exit
+	if (exitcode) {
+		flight_record("fatal", exitcode, 0, msgbuf, -1);
+		flight_dump();
+	}
+
 	if (opt_exec_on_exit) {
 		// Pass params to child as environment vars
 		snprintf(numbuf, sizeof(numbuf), "%d", exitcode);
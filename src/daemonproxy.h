@@ -45,6 +45,17 @@ bool strseg_parse_size(strseg_t *string, int64_t *val);
 bool strseg_parse_sockaddr(strseg_t *string, int addr_family, struct sockaddr_storage *a_out, int *len_out);
 
 
+//----------------------------------------------------------------------------
+// intern.c interface
+
+// Shared, reference-counted copies of service and fd names
+const char * name_intern(strseg_t name, bool pooled);
+void name_release(const char *name);
+int name_len(const char *name);
+
+// Reserve memory for the names of pooled objects
+bool name_preallocate(int count, int arena_size);
+
 //----------------------------------------------------------------------------
 // daemonproxy.c interface
 
@@ -166,6 +177,12 @@ extern bool     opt_interactive;
 extern bool     opt_exec_on_exit;
 extern strseg_t opt_exec_on_exit_args;
 extern bool     opt_mlockall;
+extern bool     opt_coalesce_events;
+extern const char * opt_state_table_path;
+extern bool     opt_spawner;
+extern int      opt_fs_workers;
+extern bool     opt_simulate;
+extern const char * opt_record_sessions_path;
 extern int64_t  opt_terminate_guard;
 
 // Parse main's argv[] to find option settings
@@ -242,6 +259,100 @@ bool control_socket_start(strseg_t path);
 // Remove a previously created controller socket
 void control_socket_stop();
 
+//----------------------------------------------------------------------------
+// state-table.c interface
+
+// Create the shared state table file
+bool state_table_open(const char *path);
+
+// Claim, update, or free the record of a service (no-ops if no table)
+int  state_table_alloc(service_t *svc);
+void state_table_publish(int slot, service_t *svc);
+void state_table_release(int slot);
+
+//----------------------------------------------------------------------------
+// event-ring.c interface
+
+// Create the shared memory event ring (no-op if it already exists)
+bool event_ring_open(int64_t size);
+bool event_ring_enabled();
+int  event_ring_get_size();
+void event_ring_get_fds(int fds[2]);
+
+// Append an event line to the ring, if enabled
+void event_ring_append(const char *msg, int len);
+
+//----------------------------------------------------------------------------
+// spawner.c interface
+
+// Fork the helper process which will fork services
+bool spawner_start();
+bool spawner_enabled();
+
+// Start a process with the given descriptors as 0..fd_count-1
+pid_t spawner_spawn(const int *fd_list, int fd_count, int exec_fd, const char *argv);
+
+// Returns true if pid was the helper process
+bool spawner_handle_reaped(pid_t pid, int wstat);
+
+//----------------------------------------------------------------------------
+// flight-recorder.c interface
+
+// Ring of recent internal events, written out by fatal()
+void     flight_record(const char *event, int32_t a, int32_t b, const char *text, int len);
+uint32_t flight_first();
+uint32_t flight_end();
+int      flight_format(uint32_t seq, char *buf, int bufsize);
+void     flight_set_dest(strseg_t name);
+void     flight_dump();
+
+//----------------------------------------------------------------------------
+// rules.c interface
+
+// Built-in reactions to events (rule.set)
+bool rule_set(strseg_t name, strseg_t spec, const char **error);
+bool rule_delete(strseg_t name);
+bool rule_get(int i, const char **name_out, const char **spec_out);
+void rule_notify_svc_state(service_t *svc);
+void rule_notify_signal(int signum);
+
+//----------------------------------------------------------------------------
+// session-record.c interface
+
+// Record controller traffic to a file (--record-sessions)
+bool session_record_open(const char *path);
+int  session_record_begin();
+void session_record(int session, const char *type, const char *data, int len);
+
+//----------------------------------------------------------------------------
+// simulate.c interface
+
+// Virtual clock and pretend child processes (--simulate)
+void sim_enable();
+bool sim_enabled();
+int64_t sim_time();
+void sim_advance(int64_t target);
+bool sim_set_exit(strseg_t name, int64_t delay, int wstat);
+pid_t sim_spawn(const char *name);
+
+// Process and wait calls, which pass through unless simulating
+int   sim_kill(pid_t pid, int signum, bool group);
+pid_t sim_wait4(int *wstat, struct rusage *ru);
+int   sim_select(int nfds, fd_set *rd, fd_set *wr, fd_set *er, struct timeval *tv);
+
+//----------------------------------------------------------------------------
+// fs-worker.c interface
+
+// Start helper processes for filesystem calls
+bool fs_worker_init(int count);
+bool fs_worker_enabled();
+
+// Open a file in a worker: begin returns a worker index (or -1 with errno),
+// and end returns false until the result is ready.
+int  fs_worker_open_begin(const char *path, int open_flags, bool mkdir);
+bool fs_worker_open_end(int idx, int *fd_out);
+void fs_worker_abandon(int idx);
+
 //----------------------------------------------------------------------------
 // controller.c interface
 
@@ -263,6 +374,19 @@ bool ctl_ctor(controller_t *ctl, int recv_fd, int send_fd);
 // Destroy a controller
 void ctl_dtor(controller_t *ctl);
 
+// Associate a controller with the service it was created for
+void ctl_set_service(controller_t *ctl, service_t *svc);
+
+// Remove any association of controllers with a service that is being deleted
+void ctl_detach_service(service_t *svc);
+
+// Move any statedump cursor off of a FD object that is being deleted
+void ctl_detach_fd(fd_t *fd);
+
+// Incremented each time a statedump begins.  Objects record the value when
+// created, so a statedump can skip objects that appeared after it started.
+extern uint64_t ctl_snapshot_epoch;
+
 // Toggle flag of whether partial line should be treated as complete command
 void ctl_set_auto_final_newline(controller_t *ctl, bool enable);
 
@@ -272,11 +396,17 @@ bool ctl_write(controller_t *ctl, const char *msg, ... );
 
 // Notify functions are simply a way to keep all the event "printf" statements in one place.
 bool ctl_notify_signal(controller_t *ctl, int sig_num, int64_t sig_ts, int count);
-bool ctl_notify_svc_state(controller_t *ctl, const char *name, int64_t up_ts, int64_t reap_ts, pid_t pid, int wstat);
+bool ctl_notify_svc_state(controller_t *ctl, service_t *svc);
 bool ctl_notify_svc_tags(controller_t *ctl, const char *name, const char *tsv_fields);
 bool ctl_notify_svc_argv(controller_t *ctl, const char *name, const char *tsv_fields);
 bool ctl_notify_svc_fds(controller_t *ctl, const char *name, const char *tsv_fields);
 bool ctl_notify_svc_auto_up(controller_t *ctl, const char *name, int64_t interval, const char *tsv_triggers);
+bool ctl_notify_svc_probe(controller_t *ctl, const char *name, const char *tsv_spec);
+bool ctl_notify_svc_health(controller_t *ctl, const char *name, const char *status, int failures, const char *detail);
+bool ctl_notify_svc_replace(controller_t *ctl, const char *name, const char *status, pid_t pid, const char *detail);
+bool ctl_notify_svc_watchdog(controller_t *ctl, const char *name, const char *tsv_spec);
+bool ctl_notify_svc_max_runtime(controller_t *ctl, const char *name, const char *tsv_spec);
+bool ctl_notify_svc_spare(controller_t *ctl, const char *name, bool enabled);
 bool ctl_notify_fd_state(controller_t *ctl, fd_t *fd);
 #define ctl_notify_error(ctl, msg, ...) (ctl_write(ctl, "error\t" msg "\n", ##__VA_ARGS__))
 
@@ -286,6 +416,25 @@ void ctl_run();
 //----------------------------------------------------------------------------
 // service.c interface
 
+// One past run of a service, as remembered for service.history
+typedef struct svc_run_s {
+	int64_t  start_time;
+	int64_t  reap_time;
+	pid_t    pid;
+	int      wait_status;
+	const char *kill_reason;
+	uint32_t cpu_ms;       // user plus system time
+	uint32_t maxrss_kb;    // peak resident set size
+} svc_run_t;
+
+// Forward a signal received by daemonproxy to the matching services
+typedef struct svc_sig_route_s {
+	int      signum;       // signal received
+	const char *selector;  // interned service name, "*", or "tag:TAG"
+	int      target;       // signal to send
+	bool     group;        // send to the process group
+} svc_sig_route_t;
+
 void svc_init();
 
 // Initialize the service pool
@@ -303,6 +452,15 @@ int     svc_get_wstat(service_t *svc);
 int64_t svc_get_up_ts(service_t *svc);
 int64_t svc_get_reap_ts(service_t *svc);
 int64_t svc_get_restart_interval(service_t *svc);
+uint64_t svc_get_epoch(service_t *svc);
+// name of the monitor that killed the service (or NULL) reported as exit reason
+const char * svc_get_kill_reason(service_t *svc);
+// count of automatic restarts, and how the run before the current one ended
+int     svc_get_restart_count(service_t *svc);
+int     svc_get_last_wstat(service_t *svc);
+// past runs, oldest first; returns NULL when i is past the end
+const svc_run_t * svc_get_history(service_t *svc, int i);
+const char * svc_get_last_kill_reason(service_t *svc);
 
 // Set tags for a service. Fails if unable to allocate the needed space
 bool svc_set_tags(service_t *svc, strseg_t tsv_fields);
@@ -322,6 +480,13 @@ bool svc_set_fds(service_t *svc, strseg_t tsv_fields);
 // Return TSV string of fds
 const char * svc_get_fds(service_t *svc);
 
+// Resolve the fd names of a service to descriptor numbers (NULL to count them)
+int svc_get_fd_list(service_t *svc, int *fd_list);
+
+// Put fd_list at descriptors 0..fd_count-1, close the rest, and exec argv
+// (through exec_fd, if not -1)
+void svc_exec_fds_argv(int *fd_list, int fd_count, int exec_fd, char *arg_spec);
+
 // Set restart interval (used if service has an auto_up trigger)
 bool svc_set_restart_interval(service_t *svc, int64_t interval);
 
@@ -331,6 +496,27 @@ const char * svc_get_triggers(service_t *svc);
 // Set TSV string of triggers for the auto_up feature
 bool svc_set_triggers(service_t *svc, strseg_t triggers_tsv);
 
+// Return TSV string of the health-check probe spec
+const char * svc_get_probe(service_t *svc);
+
+// Set TSV spec for the health-check probe, or remove it if empty or '-'
+bool svc_set_probe(service_t *svc, strseg_t probe_tsv);
+
+// Return TSV string of the watchdog spec
+const char * svc_get_watchdog(service_t *svc);
+
+// Set TSV spec for the watchdog, or remove it if empty or '-'
+bool svc_set_watchdog(service_t *svc, strseg_t watchdog_tsv);
+
+// Return TSV string of the maximum runtime spec
+const char * svc_get_max_runtime(service_t *svc);
+
+// Set TSV spec for the maximum runtime, or remove it if empty or '-'
+bool svc_set_max_runtime(service_t *svc, strseg_t max_runtime_tsv);
+
+// Record a heartbeat from a running service
+bool svc_handle_heartbeat(service_t *svc);
+
 // Tell service state machine to start at specified time
 bool svc_handle_start(service_t *svc, int64_t when);
 
@@ -338,7 +524,29 @@ bool svc_handle_start(service_t *svc, int64_t when);
 bool svc_cancel_start(service_t *svc);
 
 // Tell service state machine it has been reaped
-void svc_handle_reaped(service_t *svc, int wstat);
+void svc_handle_reaped(service_t *svc, int wstat, const struct rusage *ru);
+
+// Check whether a reaped pid belongs to a health-check probe, and handle it
+bool svc_handle_probe_reaped(pid_t pid, int wstat);
+
+// Start a replacement instance which takes over from the running one
+bool svc_replace(service_t *svc, int64_t grace, int signum);
+
+// Record that the replacement instance is ready
+bool svc_handle_ready(service_t *svc);
+
+// Check whether a reaped pid belongs to a replaced or replacement instance
+bool svc_handle_replace_reaped(pid_t pid, int wstat, const struct rusage *ru);
+
+// Keep a pre-forked standby process to use for the next start
+void svc_set_spare(service_t *svc, bool enable);
+bool svc_get_spare(service_t *svc);
+
+// Replace standby processes after a named handle was closed
+void svc_reset_spares(strseg_t fd_name);
+
+// Check whether a reaped pid belongs to a standby process
+bool svc_handle_spare_reaped(pid_t pid, int wstat);
 
 // Run an iteration of the state machine for the service
 void svc_run(service_t *svc);
@@ -346,6 +554,9 @@ void svc_run(service_t *svc);
 // Run all services which need running
 void svc_run_active();
 
+// Emit the state events queued while coalescing events
+void svc_flush_state_events();
+
 // Lookup services by attributes
 service_t * svc_by_name(strseg_t name, bool create);
 
@@ -355,9 +566,19 @@ service_t * svc_by_pid(pid_t pid);
 // Iterate list of services, either from a previous obj, or from a previous name
 service_t * svc_iter_next(service_t *current, const char *from_name);
 
+// Services chosen by a selector: a name, "*", or "tag:TAG"
+bool svc_check_selector(strseg_t selector);
+bool svc_selector_match(const char *selector, service_t *svc);
+service_t * svc_select_next(const char *selector, service_t *prev);
+
 // Send signal to service IFF running.  If group is true, send to process group.
 bool svc_send_signal(service_t *svc, int sig, bool group);
 
+// Add, replace, or (with target 0) remove a signal route
+bool svc_sig_route_set(int signum, strseg_t selector, int target, bool group);
+// Routes in the order they were added; returns NULL when i is past the end
+const svc_sig_route_t * svc_sig_route_get(int i);
+
 // Deallocate service struct
 void svc_delete(service_t *svc);
 
@@ -387,7 +608,10 @@ typedef struct fd_flags_s {
 		sock_seq: 1,
 		bind: 1,
 		special: 1,
-		is_const: 1;
+		is_const: 1,
+		memfd: 1,
+		eventfd: 1,
+		timerfd: 1;
 	uint16_t listen;
 } fd_flags_t;
 
@@ -396,6 +620,10 @@ void fd_load_flags(fd_flags_t *flags, int fh);
 
 bool fd_set_nonblock(int fdnum);
 
+// Send bytes with file descriptors attached, on a unix socket
+ssize_t fd_send_with_fds(int sock, const char *buf, int len, const int *fds, int fd_count);
+ssize_t fd_recv_with_fds(int sock, char *buf, int len, int *fds, int *fd_count);
+
 void fd_init();
 
 // Initialize the fd pool from a static chunk of memory
@@ -408,6 +636,7 @@ bool fd_init_special_handles();
 extern int fd_dev_null;
 
 const char* fd_get_name(fd_t *fd);
+uint64_t    fd_get_epoch(fd_t *fd);
 int         fd_get_fdnum(fd_t *fd);
 void        fd_set_fdnum(fd_t *fd, int fdnum);
 fd_flags_t  fd_get_flags(fd_t *fd);
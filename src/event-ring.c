@@ -0,0 +1,136 @@
+/* event-ring.c - shared memory ring of broadcast events
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+#include <sys/eventfd.h>
+
+/* The ring is a memfd which local consumers map shared.  Daemonproxy is the
+ * only writer of events, but consumers need write access to the header to
+ * count themselves in 'waiters', so daemonproxy never trusts anything else
+ * it finds there: data_size and head are kept in private variables, and
+ * only copied into the header for consumers to read.  After the header comes a data area of data_size
+ * bytes, used as a circular buffer of records.  Each record is a uint32
+ * length followed by that many bytes of event text (one line, including
+ * the newline), padded to a multiple of 4 bytes.  Records wrap around the
+ * end of the data area.
+ *
+ * 'head' is the total number of bytes ever written, and is only updated
+ * after a record is complete.  A consumer keeps its own position; any
+ * time head - position exceeds data_size, the consumer has been lapped and
+ * must re-sync with statedump.  'waiters' is incremented by consumers
+ * which are about to block on the eventfd, and daemonproxy only writes the
+ * eventfd while it is nonzero, so a busy consumer costs no syscalls.
+ */
+
+#define EVENT_RING_MAGIC   "dpring"
+#define EVENT_RING_VERSION 1
+
+typedef struct event_ring_header_s {
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t data_size;
+	uint32_t waiters;
+	uint64_t head;
+	uint32_t reserved[8];
+} event_ring_header_t;
+
+static int event_ring_memfd= -1;
+static int event_ring_eventfd= -1;
+static event_ring_header_t *event_ring= NULL;
+static char *event_ring_data= NULL;
+static uint32_t event_ring_data_size= 0;  // authoritative copies of the
+static uint64_t event_ring_head= 0;       // header fields of the same name
+
+/** Create the ring, if it doesn't exist yet.
+ * The size is rounded up to a multiple of the page size.
+ */
+bool event_ring_open(int64_t size) {
+	long page= sysconf(_SC_PAGESIZE);
+	size_t total;
+	void *mem;
+	if (event_ring)
+		return true;
+	if (size < EVENT_RING_MIN_SIZE || size > EVENT_RING_MAX_SIZE) {
+		errno= EINVAL;
+		return false;
+	}
+	total= (sizeof(event_ring_header_t) + size + page - 1) / page * page;
+	if ((event_ring_memfd= memfd_create("daemonproxy-events", MFD_CLOEXEC)) < 0)
+		goto fail;
+	if (ftruncate(event_ring_memfd, total) < 0)
+		goto fail;
+	if ((event_ring_eventfd= eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) < 0)
+		goto fail;
+	mem= mmap(NULL, total, PROT_READ|PROT_WRITE, MAP_SHARED, event_ring_memfd, 0);
+	if (mem == MAP_FAILED)
+		goto fail;
+	event_ring= (event_ring_header_t*) mem;
+	event_ring_data= (char*) (event_ring + 1);
+	memcpy(event_ring->magic, EVENT_RING_MAGIC, sizeof(EVENT_RING_MAGIC));
+	event_ring->version= EVENT_RING_VERSION;
+	event_ring->header_size= sizeof(event_ring_header_t);
+	event_ring_data_size= total - sizeof(event_ring_header_t);
+	event_ring->data_size= event_ring_data_size;
+	log_info("created event ring of %d bytes", (int) event_ring_data_size);
+	return true;
+	fail:
+	log_error("event ring: %s", strerror(errno));
+	if (event_ring_memfd >= 0) close(event_ring_memfd);
+	if (event_ring_eventfd >= 0) close(event_ring_eventfd);
+	event_ring_memfd= event_ring_eventfd= -1;
+	return false;
+}
+
+bool event_ring_enabled() {
+	return event_ring != NULL;
+}
+
+int event_ring_get_size() {
+	return event_ring? event_ring_data_size : 0;
+}
+
+// memfd of the ring, and the eventfd consumers can block on
+void event_ring_get_fds(int fds[2]) {
+	fds[0]= event_ring_memfd;
+	fds[1]= event_ring_eventfd;
+}
+
+// Copy bytes into the data area at an absolute position, wrapping as needed
+static void event_ring_copy(uint64_t pos, const void *src, int len) {
+	uint32_t ofs= pos % event_ring_data_size;
+	uint32_t n= event_ring_data_size - ofs;
+	if (n > len) n= len;
+	memcpy(event_ring_data + ofs, src, n);
+	if (n < len)
+		memcpy(event_ring_data, ((const char*) src) + n, len - n);
+}
+
+/** Append one event line to the ring.
+ */
+void event_ring_append(const char *msg, int len) {
+	uint32_t hdr= len;
+	uint64_t head;
+	int rec_len= (sizeof(hdr) + len + 3) & ~3;
+	const uint64_t one= 1;
+	if (!event_ring)
+		return;
+	if (rec_len > event_ring_data_size) {
+		log_warn("event of %d bytes is too large for the event ring", len);
+		return;
+	}
+	head= event_ring_head;
+	event_ring_copy(head, &hdr, sizeof(hdr));
+	event_ring_copy(head + sizeof(hdr), msg, len);
+	// publish the record only after its bytes are in place
+	__sync_synchronize();
+	event_ring_head= head + rec_len;
+	event_ring->head= event_ring_head;
+	__sync_synchronize();
+	if (event_ring->waiters)
+		if (write(event_ring_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			log_debug("write(eventfd): %s", strerror(errno));
+}
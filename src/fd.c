@@ -22,6 +22,7 @@ struct fd_s {
 	fd_flags_t flags;
 	int fd;
 	RBTreeNode name_index_node;
+	uint64_t epoch;        // ctl_snapshot_epoch when created
 	union attr_union_u {
 		struct file_attr_s {
 			const char *path;
@@ -30,7 +31,7 @@ struct fd_s {
 			struct fd_s *peer;
 		} pipe;
 	} attr;
-	int name_len;
+	strseg_t name;         // interned, see name_intern
 	char buffer[];
 };
 
@@ -49,7 +50,7 @@ static const char * append_elipses(char *buffer, int bufsize, strseg_t source);
 int fd_by_name_compare(void *data, RBTreeNode *node) {
 	strseg_t *name= (strseg_t*) data;
 	fd_t *obj= (fd_t*) node->Object;
-	return strseg_cmp(*name, (strseg_t){ obj->buffer, obj->name_len });
+	return strseg_cmp(*name, obj->name);
 }
 
 void fd_init() {
@@ -93,8 +94,8 @@ bool fd_preallocate(int count, int data_size_each) {
 	if (!fd_list_resize(count))
 		return false;
 
-	// Caller asks for buffer space, but we need to include struct and name
-	size_each= sizeof(fd_t) + NAME_BUF_SIZE + data_size_each;
+	// Caller asks for buffer space, but we need to include the struct
+	size_each= sizeof(fd_t) + data_size_each;
 	size_each= ((size_each - 1) | 0xF) + 1; // round up to 16
 
 	if (!(fd_obj_pool= malloc(count * size_each)))
@@ -118,34 +119,35 @@ bool fd_list_resize(int new_limit) {
 
 fd_t * fd_new(int size, strseg_t name) {
 	fd_t *obj;
-	assert(size >= sizeof(fd_t) + name.len + 1);
-	assert(name.len < NAME_BUF_SIZE);
+	const char *iname;
+	assert(size >= sizeof(fd_t));
 	// enlarge the container if needed (and not using a pool)
 	if (fd_list_count >= fd_list_limit)
 		if (fd_obj_pool || !fd_list_resize(fd_list_limit + 32))
 			return NULL;
+	if (!(iname= name_intern(name, fd_obj_pool != NULL)))
+		return NULL;
 	// allocate space (unless using a pool)
 	if (fd_obj_pool) {
 		size= fd_obj_pool_size_each;
-		if (size < sizeof(fd_t) + name.len + 1)
-			return NULL;
 		obj= fd_list[fd_list_count++];
 	}
 	else {
-		if (!(obj= (fd_t*) malloc(size)))
+		if (!(obj= (fd_t*) malloc(size))) {
+			name_release(iname);
 			return NULL;
+		}
 		fd_list[fd_list_count++]= obj;
 	}
 	memset(obj, 0, size);
 	obj->size= size;
 	obj->fd= -1;
+	obj->epoch= ctl_snapshot_epoch;
 	RBTreeNode_Init( &obj->name_index_node );
 	obj->name_index_node.Object= obj;
-	memcpy(obj->buffer, name.data, name.len);
-	obj->buffer[name.len]= '\0';
-	obj->name_len= name.len;
+	obj->name= (strseg_t){ iname, name.len };
 
-	RBTree_Add( &fd_by_name_index, &obj->name_index_node, &name );
+	RBTree_Add( &fd_by_name_index, &obj->name_index_node, &obj->name );
 
 	return obj;
 }
@@ -168,8 +170,12 @@ void fd_delete(fd_t *fd) {
 		int result= close(fd->fd);
 		log_trace("close(%d) => %d", fd->fd, result);
 	}
-	// Remove name from index
+	// Standby processes might hold a copy of the descriptor
+	svc_reset_spares(fd->name);
+	// Move any statedump cursor off of this object, then remove name from index
+	ctl_detach_fd(fd);
 	RBTreeNode_Prune( &fd->name_index_node );
+	name_release(fd->name.data);
 	// remove the pointer from fd_list and free the mem (or swap within list, for obj pool)
 	for (i= 0; i < fd_list_count; i++) {
 		if (fd_list[i] == fd) {
@@ -187,7 +193,11 @@ void fd_delete(fd_t *fd) {
 }
 
 const char* fd_get_name(fd_t *fd) {
-	return fd->buffer;
+	return fd->name.data;
+}
+
+uint64_t fd_get_epoch(fd_t *fd) {
+	return fd->epoch;
 }
 
 int fd_get_fdnum(fd_t *fd) {
@@ -216,6 +226,69 @@ bool fd_set_nonblock(int fdnum) {
 		&& fcntl(fdnum, F_SETFL, i|O_NONBLOCK) >= 0;
 }
 
+// Send bytes on a unix socket with file descriptors attached (SCM_RIGHTS).
+// Returns the result of sendmsg().  The descriptors remain open in this process.
+ssize_t fd_send_with_fds(int sock, const char *buf, int len, const int *fds, int fd_count) {
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * FD_SEND_MAX)];
+	} cmsg_buf;
+	struct cmsghdr *cmsg;
+	struct iovec iov= { (void*) buf, len };
+	struct msghdr msg;
+	
+	assert(fd_count >= 0 && fd_count <= FD_SEND_MAX);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+	if (!fd_count)
+		return sendmsg(sock, &msg, MSG_NOSIGNAL);
+	msg.msg_control= cmsg_buf.buf;
+	msg.msg_controllen= CMSG_SPACE(sizeof(int) * fd_count);
+	cmsg= CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level= SOL_SOCKET;
+	cmsg->cmsg_type= SCM_RIGHTS;
+	cmsg->cmsg_len= CMSG_LEN(sizeof(int) * fd_count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+	return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+// Receive one message from a unix socket, along with up to FD_SEND_MAX file
+// descriptors.  *fd_count is set to the number received.  Extra descriptors
+// are closed.  Returns the result of recvmsg().
+ssize_t fd_recv_with_fds(int sock, char *buf, int len, int *fds, int *fd_count) {
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * FD_SEND_MAX)];
+	} cmsg_buf;
+	struct cmsghdr *cmsg;
+	struct iovec iov= { buf, len };
+	struct msghdr msg;
+	ssize_t n;
+	int i, fd;
+	
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+	msg.msg_control= cmsg_buf.buf;
+	msg.msg_controllen= sizeof(cmsg_buf.buf);
+	*fd_count= 0;
+	if ((n= recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0)
+		return n;
+	for (cmsg= CMSG_FIRSTHDR(&msg); cmsg; cmsg= CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			for (i= 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+				fd= ((int*) CMSG_DATA(cmsg))[i];
+				if (*fd_count < FD_SEND_MAX)
+					fds[(*fd_count)++]= fd;
+				else
+					close(fd);
+			}
+		}
+	}
+	return n;
+}
+
 // Open a pipe from one named FD to another
 // returns a ref to the read end, which holds a ref to the write end.
 fd_t * fd_new_pipe(strseg_t name1, int num1, strseg_t name2, int num2, fd_flags_t *flags) {
@@ -228,10 +301,10 @@ fd_t * fd_new_pipe(strseg_t name1, int num1, strseg_t name2, int num2, fd_flags_
 		return NULL;
 	
 	// Allocate new FD objects
-	f1= fd_new(sizeof(fd_t) + name1.len + 1, name1);
+	f1= fd_new(sizeof(fd_t), name1);
 	if (!f1) return NULL;
 	
-	f2= fd_new(sizeof(fd_t) + name2.len + 1, name2);
+	f2= fd_new(sizeof(fd_t), name2);
 	if (!f2) {
 		fd_delete(f1);
 		return NULL;
@@ -268,7 +341,7 @@ fd_t * fd_new_file(strseg_t name, int fdnum, fd_flags_t flags, strseg_t path) {
 		return NULL;
 	
 	// Allocate new obj
-	f= fd_new(sizeof(fd_t) + name.len + 1 + path.len + 1, name);
+	f= fd_new(sizeof(fd_t) + path.len + 1, name);
 	if (!f) return NULL;
 	
 	// it worked, so delete the old one, if any
@@ -277,8 +350,8 @@ fd_t * fd_new_file(strseg_t name, int fdnum, fd_flags_t flags, strseg_t path) {
 	f->fd= fdnum;
 	f->flags= flags;
 	// copy as much of path into the buffer as we can.
-	buf_free= f->size - sizeof(fd_t) - name.len - 1;
-	f->attr.file.path= append_elipses(f->buffer + name.len + 1, buf_free, path);
+	buf_free= f->size - sizeof(fd_t);
+	f->attr.file.path= append_elipses(f->buffer, buf_free, path);
 	
 	return f;
 }
@@ -307,7 +380,6 @@ const char* append_elipses(char *buffer, int bufsize, strseg_t source) {
 }
 
 fd_t * fd_by_name(strseg_t name) {
-	assert(name.len < NAME_BUF_SIZE);
 	RBTreeSearch s= RBTree_Find( &fd_by_name_index, &name );
 	if (s.Relation == 0)
 		return (fd_t*) s.Nearest->Object;
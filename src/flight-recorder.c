@@ -0,0 +1,125 @@
+/* flight-recorder.c - ring of recent internal events, for post-mortems
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* The flight recorder is a fixed array of FLIGHT_RECORDER_SIZE entries which
+ * is always on.  Main loop iterations, service state changes, forks, reaps,
+ * and controller commands each overwrite the oldest entry, which costs about
+ * as much as a memcpy.  Nothing is allocated, so the record is still intact
+ * when fatal() runs, and it is written out from there: to the named fd set
+ * by flight.dest, or else to the log descriptor.  Each fatal() only writes
+ * the entries added since the last time, so a daemonproxy limping along
+ * under the terminate guard doesn't flood its log.
+ *
+ * Entries are written by the main loop only.  'head' counts every entry ever
+ * written (wrapping around, so FLIGHT_RECORDER_SIZE must be a power of two),
+ * and is advanced after the entry is complete, so a reader (such as fatal()
+ * from a signal handler) sees whole entries.
+ */
+
+#define FLIGHT_TEXT_SIZE 40
+
+typedef struct flight_entry_s {
+	int64_t     ts;
+	const char *event;   // static string
+	int32_t     a, b;
+	char        text[FLIGHT_TEXT_SIZE];
+} flight_entry_t;
+
+static flight_entry_t flight_ring[FLIGHT_RECORDER_SIZE];
+static volatile uint32_t flight_head= 0;
+static uint32_t flight_filled= 0;
+static uint32_t flight_dumped= 0;
+static char     flight_dest_name_buf[NAME_LEN_MAX+1];
+static int      flight_dest_name_len= 0;
+
+/** Add an entry.  event must be a static string.  text may be NULL, and
+ * len may be -1 if text is NUL-terminated; it is truncated to fit.
+ */
+void flight_record(const char *event, int32_t a, int32_t b, const char *text, int len) {
+	flight_entry_t *e= &flight_ring[flight_head % FLIGHT_RECORDER_SIZE];
+	if (!text)
+		len= 0;
+	else if (len < 0)
+		len= strlen(text);
+	if (len >= FLIGHT_TEXT_SIZE)
+		len= FLIGHT_TEXT_SIZE - 1;
+	e->ts= wake->now;
+	e->event= event;
+	e->a= a;
+	e->b= b;
+	memcpy(e->text, text, len);
+	e->text[len]= '\0';
+	__sync_synchronize();
+	flight_head++;
+	if (flight_filled < FLIGHT_RECORDER_SIZE)
+		flight_filled++;
+}
+
+/** Sequence number of the oldest entry still in the ring, and one past the
+ * newest.
+ */
+uint32_t flight_first() {
+	return flight_head - flight_filled;
+}
+
+uint32_t flight_end() {
+	return flight_head;
+}
+
+/** Format entry seq as "TIME\tEVENT\tA\tB\tTEXT" (no newline).
+ * Returns the length, or -1 if the entry is no longer in the ring.
+ */
+int flight_format(uint32_t seq, char *buf, int bufsize) {
+	flight_entry_t *e= &flight_ring[seq % FLIGHT_RECORDER_SIZE];
+	int n;
+	// (sequence numbers wrap, so compare distances from head)
+	if ((uint32_t)(flight_head - seq - 1) >= flight_filled)
+		return -1;
+	n= snprintf(buf, bufsize, "%lld.%06d\t%s\t%d\t%d\t%s",
+		(long long)(e->ts >> 32), (int)(((e->ts & 0xFFFFFFFFLL) * 1000000) >> 32),
+		e->event, (int) e->a, (int) e->b, e->text);
+	return n < bufsize? n : bufsize - 1;
+}
+
+/** Set the name of the fd which fatal() writes the record to, or an empty
+ * name for the log.
+ */
+void flight_set_dest(strseg_t name) {
+	assert(name.len < sizeof(flight_dest_name_buf));
+	memcpy(flight_dest_name_buf, name.data, name.len);
+	flight_dest_name_buf[name.len]= '\0';
+	flight_dest_name_len= name.len;
+}
+
+/** Write the entries added since the previous dump, for fatal().
+ */
+void flight_dump() {
+	char buf[FLIGHT_TEXT_SIZE + 80];
+	fd_t *fd;
+	uint32_t seq, end= flight_head;
+	int n, dest= -1;
+	if (flight_dest_name_len && (fd= fd_by_name((strseg_t){ flight_dest_name_buf, flight_dest_name_len })))
+		dest= fd_get_fdnum(fd);
+	if (dest < 0)
+		dest= log_get_fd();
+	if (dest < 0)
+		return;
+	seq= (end - flight_dumped < flight_filled)? flight_dumped : end - flight_filled;
+	n= snprintf(buf, sizeof(buf), "flight recorder: %u entries\n", end - seq);
+	if (write(dest, buf, n) < 0)
+		return;
+	// sequence numbers wrap, so compare for equality only
+	for (; seq != end; seq++) {
+		if ((n= flight_format(seq, buf, sizeof(buf) - 1)) < 0)
+			continue;
+		buf[n++]= '\n';
+		if (write(dest, buf, n) < 0)
+			break;
+	}
+	flight_dumped= end;
+}
@@ -0,0 +1,243 @@
+/* fs-worker.c - helper processes for filesystem calls which might block
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* With --fs-workers, fd.open hands its mkdir and open() calls to one of a
+ * few helper processes, and the opened descriptor comes back over a unix
+ * socket.  A hung NFS mount then only stalls the controller which asked
+ * for the file, while the main loop keeps reaping and delivering signals.
+ *
+ * Each worker handles one request at a time.  A worker that doesn't answer
+ * within FS_WORKER_TIMEOUT is killed and replaced.
+ *
+ * Workers keep the directory daemonproxy was in when they were forked, so
+ * relative paths are made absolute (against daemonproxy's current directory,
+ * which chdir may have changed) before they are sent.
+ */
+
+typedef struct fs_req_s {
+	int32_t open_flags;
+	int32_t mkdir;
+	char    path[];
+} fs_req_t;
+
+typedef struct fs_reply_s {
+	int32_t err;   // errno, or 0 if a descriptor is attached
+} fs_reply_t;
+
+typedef struct fs_worker_s {
+	int     sock;
+	pid_t   pid;
+	bool    busy;
+	int64_t start_ts;
+} fs_worker_t;
+
+static fs_worker_t fs_worker[FS_WORKER_MAX];
+static int fs_worker_count= 0;
+
+static void fs_worker_main(int sock);
+
+static bool fs_worker_start(fs_worker_t *w) {
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0) {
+		log_error("socketpair: %s", strerror(errno));
+		return false;
+	}
+	if ((pid= fork()) < 0) {
+		log_error("fork: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if (pid == 0) {
+		sig_reset_for_exec();
+		fs_worker_main(sv[1]);
+		_exit(0);
+	}
+	close(sv[1]);
+	w->sock= sv[0];
+	w->pid= pid;
+	w->busy= false;
+	log_debug("fs worker is pid %d", (int) pid);
+	return true;
+}
+
+// Abandon a worker which is stuck or broken, and start a replacement
+static void fs_worker_restart(fs_worker_t *w) {
+	kill(w->pid, SIGKILL);
+	close(w->sock);
+	w->sock= -1;
+	w->pid= 0;
+	w->busy= false;
+	fs_worker_start(w);
+}
+
+/** Start count worker processes.
+ */
+bool fs_worker_init(int count) {
+	int i;
+	for (i= 0; i < count && i < FS_WORKER_MAX; i++) {
+		fs_worker[i].sock= -1;
+		if (!fs_worker_start(&fs_worker[i]))
+			return false;
+		fs_worker_count++;
+	}
+	return true;
+}
+
+bool fs_worker_enabled() {
+	return fs_worker_count > 0;
+}
+
+/** Ask a worker to open a file (creating missing directories first if mkdir
+ * is true).  Returns the worker index to pass to fs_worker_open_end, or -1
+ * with errno EAGAIN if all workers are busy, or another errno on failure.
+ */
+int fs_worker_open_begin(const char *path, int open_flags, bool mkdir) {
+	int i, path_len= strlen(path), cwd_len= 0;
+	char cwd[PATH_MAX];
+	fs_req_t *req;
+	fs_worker_t *w;
+
+	if (path[0] != '/') {
+		if (!getcwd(cwd, sizeof(cwd)))
+			return -1;
+		cwd_len= strlen(cwd);
+		if (cwd[cwd_len-1] != '/')
+			cwd[cwd_len++]= '/';
+	}
+	if (cwd_len + path_len >= PATH_MAX) {
+		errno= ENAMETOOLONG;
+		return -1;
+	}
+	for (i= 0; i < fs_worker_count; i++)
+		if (fs_worker[i].sock >= 0 && !fs_worker[i].busy)
+			break;
+	if (i >= fs_worker_count) {
+		// Wake again when a busy worker finishes
+		for (i= 0; i < fs_worker_count; i++)
+			if (fs_worker[i].sock >= 0)
+				wake_on_readable(fs_worker[i].sock);
+		errno= EAGAIN;
+		return -1;
+	}
+	w= &fs_worker[i];
+	req= alloca(sizeof(fs_req_t) + cwd_len + path_len + 1);
+	req->open_flags= open_flags;
+	req->mkdir= mkdir;
+	memcpy(req->path, cwd, cwd_len);
+	memcpy(req->path + cwd_len, path, path_len + 1);
+	if (send(w->sock, req, sizeof(fs_req_t) + cwd_len + path_len + 1, MSG_NOSIGNAL) < 0) {
+		log_error("fs worker %d: %s", (int) w->pid, strerror(errno));
+		fs_worker_restart(w);
+		errno= EIO;
+		return -1;
+	}
+	w->busy= true;
+	w->start_ts= wake->now;
+	return i;
+}
+
+/** Check for the result of fs_worker_open_begin.
+ *
+ * Returns false if it isn't finished yet (and sets up a wake for when it
+ * might be).  Otherwise, stores the new descriptor in *fd_out, or -1 with
+ * errno set.
+ */
+bool fs_worker_open_end(int idx, int *fd_out) {
+	fs_worker_t *w= &fs_worker[idx];
+	fs_reply_t reply;
+	int fds[FD_SEND_MAX], n_fds, i;
+	ssize_t n;
+
+	if (w->sock < 0 || !w->busy) {
+		*fd_out= -1;
+		errno= EIO;
+		return true;
+	}
+	if (!woke_on_readable(w->sock)) {
+		if (wake->now - w->start_ts >= FS_WORKER_TIMEOUT) {
+			log_error("fs worker %d did not respond in %d seconds; replacing it",
+				(int) w->pid, (int)(FS_WORKER_TIMEOUT >> 32));
+			fs_worker_restart(w);
+			*fd_out= -1;
+			errno= ETIMEDOUT;
+			return true;
+		}
+		wake_on_readable(w->sock);
+		wake_at_time(w->start_ts + FS_WORKER_TIMEOUT);
+		return false;
+	}
+	n= fd_recv_with_fds(w->sock, (char*) &reply, sizeof(reply), fds, &n_fds);
+	if (n != sizeof(reply) || (!reply.err && n_fds != 1)) {
+		log_error("fs worker %d: bad reply", (int) w->pid);
+		for (i= 0; i < n_fds; i++)
+			close(fds[i]);
+		fs_worker_restart(w);
+		*fd_out= -1;
+		errno= EIO;
+		return true;
+	}
+	w->busy= false;
+	if (reply.err) {
+		*fd_out= -1;
+		errno= reply.err;
+	}
+	else {
+		// match the flags of a descriptor we opened ourselves
+		fcntl(fds[0], F_SETFD, 0);
+		*fd_out= fds[0];
+	}
+	return true;
+}
+
+/** Give up on a request, such as when its controller went away.
+ */
+void fs_worker_abandon(int idx) {
+	if (fs_worker[idx].busy)
+		fs_worker_restart(&fs_worker[idx]);
+}
+
+// Main loop of a worker process.  Returns when daemonproxy goes away.
+static void fs_worker_main(int sock) {
+	static char buf[sizeof(fs_req_t) + PATH_MAX + 1];
+	fs_req_t *req= (fs_req_t*) buf;
+	fs_reply_t reply;
+	ssize_t n;
+	int i, fd;
+
+	// Keep only the socket and the log (stderr)
+	for (i= 0; i < FD_SETSIZE; i++)
+		if (i != sock && i != 2)
+			close(i);
+
+	while (1) {
+		n= recv(sock, buf, sizeof(buf) - 1, 0);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) continue;
+			return;
+		}
+		buf[n]= '\0';
+		if (n <= sizeof(fs_req_t)) {
+			reply.err= EINVAL;
+			fd= -1;
+		}
+		else {
+			if (req->mkdir)
+				// we don't check success on this.  we just let open() fail and check that.
+				create_missing_dirs(req->path);
+			fd= open(req->path, req->open_flags, 0600);
+			reply.err= fd < 0? errno : 0;
+		}
+		if (fd_send_with_fds(sock, (char*) &reply, sizeof(reply), &fd, fd < 0? 0 : 1) < 0)
+			return;
+		if (fd >= 0)
+			close(fd);
+	}
+}
@@ -0,0 +1,161 @@
+/* intern.c - shared table of service and fd names
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* Service and fd objects refer to their names through this table rather
+ * than holding a fixed-size buffer, so a short name costs only its own
+ * length and a name used by both a service and a handle is stored once.
+ * Each entry is reference counted and keeps the hash it was filed under.
+ *
+ * Names for objects in the --service-pool or --fd-pool come from an arena
+ * which is allocated along with the pools, so that those objects normally
+ * don't need malloc.  Freed arena entries are kept on a free list for their
+ * size class.  If the arena has no room for a name, it is allocated with
+ * malloc like any other.
+ */
+
+typedef struct name_entry_s {
+	struct name_entry_s *next;  // hash chain, or free list
+	uint32_t hash;
+	uint32_t refs;
+	uint16_t len;
+	bool     pooled;
+	char     str[];
+} name_entry_t;
+
+#define NAME_ENTRY(s) ((name_entry_t*) ((s) - offsetof(name_entry_t, str)))
+#define NAME_CLASS_SIZE 16
+#define NAME_CLASS_COUNT ((offsetof(name_entry_t, str) + NAME_LEN_MAX + 1 + NAME_CLASS_SIZE - 1) / NAME_CLASS_SIZE)
+
+static name_entry_t **name_table= NULL;
+static uint32_t name_table_mask= 0;
+static int name_count= 0;
+
+static char *name_arena= NULL, *name_arena_pos= NULL, *name_arena_lim= NULL;
+static name_entry_t *name_free_list[NAME_CLASS_COUNT];
+
+static uint32_t name_hash_seg(strseg_t name) {
+	uint32_t h= 2166136261u;  // FNV-1a
+	int i;
+	for (i= 0; i < name.len; i++)
+		h= (h ^ (uint8_t) name.data[i]) * 16777619u;
+	return h;
+}
+
+static bool name_table_resize(int new_size) {
+	name_entry_t **new_table, *e, *next;
+	uint32_t i;
+	if (!(new_table= calloc(new_size, sizeof(name_entry_t*))))
+		return false;
+	for (i= 0; name_table && i <= name_table_mask; i++)
+		for (e= name_table[i]; e; e= next) {
+			next= e->next;
+			e->next= new_table[e->hash & (new_size - 1)];
+			new_table[e->hash & (new_size - 1)]= e;
+		}
+	free(name_table);
+	name_table= new_table;
+	name_table_mask= new_size - 1;
+	return true;
+}
+
+/** Reserve the arena for names of pooled objects, and a hash table large
+ * enough that it never needs to grow for count names.
+ */
+bool name_preallocate(int count, int arena_size) {
+	int size= 64;
+	assert(name_arena == NULL);
+	while (size < count)
+		size <<= 1;
+	if (size - 1 > name_table_mask && !name_table_resize(size))
+		return false;
+	if (!(name_arena= malloc(arena_size)))
+		return false;
+	name_arena_pos= name_arena;
+	name_arena_lim= name_arena + arena_size;
+	return true;
+}
+
+static name_entry_t * name_alloc(int len, bool pooled) {
+	int cls= (offsetof(name_entry_t, str) + len + 1 + NAME_CLASS_SIZE - 1) / NAME_CLASS_SIZE;
+	name_entry_t *e;
+	if (pooled && name_arena) {
+		if ((e= name_free_list[cls - 1])) {
+			name_free_list[cls - 1]= e->next;
+			e->pooled= true;
+			return e;
+		}
+		if (name_arena_lim - name_arena_pos >= cls * NAME_CLASS_SIZE) {
+			e= (name_entry_t*) name_arena_pos;
+			name_arena_pos += cls * NAME_CLASS_SIZE;
+			e->pooled= true;
+			return e;
+		}
+	}
+	if ((e= malloc(offsetof(name_entry_t, str) + len + 1)))
+		e->pooled= false;
+	return e;
+}
+
+/** Get the shared copy of a name, adding it to the table if needed.
+ *
+ * The result is NUL-terminated and stays valid until the matching
+ * name_release.  Set pooled for names of objects in a preallocated pool.
+ * Returns NULL if the name is too long or there is no memory for it.
+ */
+const char * name_intern(strseg_t name, bool pooled) {
+	uint32_t hash;
+	name_entry_t *e;
+
+	if (name.len < 0 || name.len > NAME_LEN_MAX)
+		return NULL;
+	hash= name_hash_seg(name);
+	if (name_table)
+		for (e= name_table[hash & name_table_mask]; e; e= e->next)
+			if (e->hash == hash && e->len == name.len && 0 == memcmp(e->str, name.data, name.len)) {
+				e->refs++;
+				return e->str;
+			}
+	// Grow at a load factor of 2, unless the table was preallocated
+	if (!name_table || (!name_arena && name_count >= (name_table_mask + 1) * 2))
+		if (!name_table_resize(name_table? (name_table_mask + 1) * 2 : 64))
+			return NULL;
+	if (!(e= name_alloc(name.len, pooled)))
+		return NULL;
+	e->hash= hash;
+	e->refs= 1;
+	e->len= name.len;
+	memcpy(e->str, name.data, name.len);
+	e->str[name.len]= '\0';
+	e->next= name_table[hash & name_table_mask];
+	name_table[hash & name_table_mask]= e;
+	name_count++;
+	return e->str;
+}
+
+/** Drop a reference returned by name_intern.
+ */
+void name_release(const char *name) {
+	name_entry_t *e= NAME_ENTRY(name), **prev;
+	int cls;
+	if (--e->refs)
+		return;
+	for (prev= &name_table[e->hash & name_table_mask]; *prev != e; prev= &(*prev)->next)
+		assert(*prev);
+	*prev= e->next;
+	name_count--;
+	if (e->pooled) {
+		cls= (offsetof(name_entry_t, str) + e->len + 1 + NAME_CLASS_SIZE - 1) / NAME_CLASS_SIZE;
+		e->next= name_free_list[cls - 1];
+		name_free_list[cls - 1]= e;
+	}
+	else free(e);
+}
+
+int name_len(const char *name) {
+	return NAME_ENTRY(name)->len;
+}
@@ -7,7 +7,7 @@
 #include "daemonproxy.h"
 
 int  log_filter= LOG_LEVEL_DEBUG;
-char log_dest_fd_name_buf[NAME_BUF_SIZE];
+char log_dest_fd_name_buf[NAME_LEN_MAX+1];
 strseg_t log_dest_fd_name= (strseg_t){ log_dest_fd_name_buf, 0 };
 char log_buffer[1024];
 int  log_buf_pos= 0;
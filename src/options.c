@@ -22,6 +22,12 @@ char        opt_exec_on_exit_buf[256];
 strseg_t    opt_exec_on_exit_args;
 bool        opt_interactive= false;
 bool        opt_mlockall= false;
+bool        opt_coalesce_events= false;
+const char *opt_state_table_path= NULL;
+bool        opt_spawner= false;
+int         opt_fs_workers= 0;
+bool        opt_simulate= false;
+const char *opt_record_sessions_path= NULL;
 int64_t     opt_terminate_guard= 0;
 
 static void parse_option(char shortname, char* longname, char ***argv);
@@ -311,6 +317,121 @@ void set_opt_mlockall(char **argv) {
 	opt_mlockall= true;
 }
 
+/*
+=item --coalesce-events
+
+Report only the final state of each service per main loop iteration.
+A service that exits and is restarted immediately then produces a single
+'up' service.state event instead of 'down', 'start', and 'up'.  In this mode
+service.state events have extra fields so that nothing is lost; see EVENTS.
+Can also be changed with the event.coalesce command.
+
+=cut
+*/
+void set_opt_coalesce_events(char **argv) {
+	opt_coalesce_events= true;
+}
+
+/*
+=item --state-table PATH
+
+Publish the state of every service in a shared file at PATH.  Monitoring
+tools can mmap it and read it without sending any commands to daemonproxy.
+The file is a 64-byte header (magic "dpstate", then native-endian uint32
+version, header_size, record_size, capacity, and seq) followed by capacity
+records of record_size bytes: uint32 seq, uint32 state (0=unused, 1=down,
+2=start, 3=up), int32 pid, int32 wait_status, int64 up_ts, int64 reap_ts,
+uint32 restarts, 4 bytes padding, and a 32-byte NUL-padded name (longer
+names are truncated to 31 bytes).  Timestamps are CLOCK_MONOTONIC in 32.32
+fixed point.
+
+A record's seq is odd while it is being written; copy the record, and retry
+if seq was odd or is different afterward.  The header's seq changes the same
+way when the table grows, after which the file must be mapped again at its
+new size.
+
+=cut
+*/
+void set_opt_state_table(char **argv) {
+	opt_state_table_path= argv[0];
+}
+
+/*
+=item --spawner
+
+Start services from a small helper process, forked at startup before
+daemonproxy allocates its object pools.  The cost of forking a service then
+doesn't grow with the size of daemonproxy, and a failure during fork can't
+affect daemonproxy itself.  Services are still children of daemonproxy (which
+becomes a child subreaper, if not PID 1), so nothing else changes.  A service
+with more than 32 file descriptors, and all services after the helper dies or
+fails to answer within 2 seconds (it is then killed), are forked by daemonproxy
+itself.  service.spare has no effect while the helper is running.
+
+=cut
+*/
+void set_opt_spawner(char **argv) {
+	opt_spawner= true;
+}
+
+/*
+=item --fs-workers COUNT
+
+Perform the mkdir and open() calls of fd.open in COUNT helper processes (at
+most 8), so that a slow or hung filesystem can't stall the main loop.  The
+fd.open command then completes asynchronously; the controller which sent it
+waits for the result before running its next command, but everything else
+carries on.  A worker which takes more than 30 seconds is killed and replaced,
+and the command fails.
+
+=cut
+*/
+void set_opt_fs_workers(char **argv) {
+	char *end= NULL;
+	long n= strtol(argv[0], &end, 10);
+	
+	if (*end || n < 0 || n > FS_WORKER_MAX)
+		fatal(EXIT_BAD_OPTIONS, "--fs-workers must be an integer from 0 to %d", FS_WORKER_MAX);
+	opt_fs_workers= n;
+}
+
+/*
+=item --simulate
+
+Run services as pretend processes, on a virtual clock.
+
+For testing controller scripts, and for benchmarking.  Starting a service
+creates a pretend process instead of forking, which runs until it is
+signaled or until the exit scripted for it by sim.exit.  Time is virtual,
+starting at 1000 seconds, and only moves forward when a controller sends
+sim.advance; the same commands then always produce the same events.  Cron
+triggers read the virtual clock as seconds since the epoch.  Exec probes always
+succeed, and services get no standby process.
+
+=cut
+*/
+void set_opt_simulate(char **argv) {
+	opt_simulate= true;
+	sim_enable();
+}
+
+/*
+=item --record-sessions FILE
+
+Record the traffic of every controller to FILE.
+
+Each command is recorded with the time it ran, along with when the controller
+read its events and any overflows, so that a problem seen with a real
+controller script can be played back with scripts/replay_session.pl and
+measured.  FILE is truncated at startup.  Everything a controller sends is
+recorded as-is, but file descriptors passed over the control socket are not.
+
+=cut
+*/
+void set_opt_record_sessions(char **argv) {
+	opt_record_sessions_path= argv[0];
+}
+
 /*
 =item -v
 
@@ -0,0 +1,355 @@
+/* rules.c - built-in reactions to service and signal events
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* A rule is a simple policy which would otherwise need a controller script:
+ * when an event matches, daemonproxy runs the rule's action right away, in
+ * the same main loop iteration, instead of writing the event to a controller
+ * and waiting for a command to come back.
+ *
+ * Rules are parsed once, by rule_set, into a rule_t with the event fields to
+ * compare, and filed on a list for their event type, so an event only looks
+ * at the rules which could match it.  Service names and selectors are
+ * interned.  The definition text is kept for rule.list.
+ *
+ * An action can cause more events (starting a service announces its state),
+ * so rules can trigger other rules.  Nesting is limited to RULE_DEPTH_MAX to
+ * stop a set of rules from feeding on itself.
+ */
+
+#define RULE_EVENT_SERVICE_STATE 0
+#define RULE_EVENT_SIGNAL        1
+#define RULE_EVENT_COUNT         2
+
+#define RULE_STATE_ANY   0
+#define RULE_STATE_DOWN  1
+#define RULE_STATE_START 2
+#define RULE_STATE_UP    3
+
+#define RULE_ACTION_START  1
+#define RULE_ACTION_SIGNAL 2
+
+#define RULE_DEPTH_MAX 4
+
+typedef struct rule_s {
+	struct rule_s *next;      // next rule for the same event type
+	const char *name;         // interned
+	int      event;
+	const char *selector;     // interned service selector (service.state)
+	int      signum;          // signal received (signal)
+	int      want_state;      // RULE_STATE_*
+	int      want_exit;       // exit code, or -1 for any
+	int      want_signal;     // terminating signal, or 0 for any
+	const char *want_reason;  // interned exit reason, or NULL for any
+	int      action;
+	const char *target;       // interned service selector for the action
+	int      target_signal;
+	bool     group;
+	char     spec[];          // definition (everything after NAME)
+} rule_t;
+
+static rule_t *rule_list[RULE_EVENT_COUNT];
+static int     rule_depth= 0;
+
+static void rule_free(rule_t *rule);
+static bool rule_parse_conditions(rule_t *rule, strseg_t conditions, const char **error);
+static bool rule_parse_action(rule_t *rule, strseg_t *spec, const char **error);
+static void rule_fire(rule_t *rule);
+
+static void rule_free(rule_t *rule) {
+	if (rule->name)        name_release(rule->name);
+	if (rule->selector)    name_release(rule->selector);
+	if (rule->want_reason) name_release(rule->want_reason);
+	if (rule->target)      name_release(rule->target);
+	free(rule);
+}
+
+/** Parse a rule definition and add it, replacing any rule by the same name.
+ * spec is the TSV "EVENT SELECTOR CONDITIONS ACTION [ARGS...]".  On failure,
+ * *error describes the problem.
+ */
+bool rule_set(strseg_t name, strseg_t spec, const char **error) {
+	strseg_t str= spec, event, selector, conditions;
+	rule_t *rule, **prev;
+
+	if (!svc_check_name(name)) {
+		*error= "Invalid rule name";
+		return false;
+	}
+	if (!strseg_tok_next(&str, '\t', &event) || !strseg_tok_next(&str, '\t', &selector)
+		|| !strseg_tok_next(&str, '\t', &conditions)
+	) {
+		*error= "Expected EVENT SELECTOR CONDITIONS ACTION";
+		return false;
+	}
+	if (!(rule= calloc(1, sizeof(*rule) + spec.len + 1))) {
+		*error= "Out of memory";
+		return false;
+	}
+	memcpy(rule->spec, spec.data, spec.len);
+	rule->spec[spec.len]= '\0';
+	rule->want_exit= -1;
+
+	if (0 == strseg_cmp(event, STRSEG("service.state"))) {
+		rule->event= RULE_EVENT_SERVICE_STATE;
+		if (!svc_check_selector(selector)) {
+			*error= "Invalid service selector";
+			goto fail;
+		}
+		if (!(rule->selector= name_intern(selector, false))) {
+			*error= "Out of memory";
+			goto fail;
+		}
+		if (!rule_parse_conditions(rule, conditions, error))
+			goto fail;
+	}
+	else if (0 == strseg_cmp(event, STRSEG("signal"))) {
+		rule->event= RULE_EVENT_SIGNAL;
+		if ((rule->signum= sig_num_by_name(selector)) <= 0) {
+			*error= "Invalid signal";
+			goto fail;
+		}
+		if (0 != strseg_cmp(conditions, STRSEG("-"))) {
+			*error= "Signal rules take no conditions";
+			goto fail;
+		}
+	}
+	else {
+		*error= "Unknown event type";
+		goto fail;
+	}
+	if (!rule_parse_action(rule, &str, error))
+		goto fail;
+	if (!(rule->name= name_intern(name, false))) {
+		*error= "Out of memory";
+		goto fail;
+	}
+
+	// A new definition replaces the old one, and goes to the end of the list
+	rule_delete(name);
+	for (prev= &rule_list[rule->event]; *prev; prev= &(*prev)->next);
+	*prev= rule;
+	return true;
+fail:
+	rule_free(rule);
+	return false;
+}
+
+/** Parse "-" or a comma-separated list of state=, exit=, signal=, reason=.
+ */
+static bool rule_parse_conditions(rule_t *rule, strseg_t conditions, const char **error) {
+	strseg_t cond, key, val;
+	int64_t n;
+
+	if (0 == strseg_cmp(conditions, STRSEG("-")))
+		return true;
+	while (strseg_tok_next(&conditions, ',', &cond)) {
+		key= cond;
+		if (!strseg_split_1(&key, '=', &val) || !val.len) {
+			*error= "Expected conditions KEY=VALUE,...";
+			return false;
+		}
+		if (0 == strseg_cmp(key, STRSEG("state"))) {
+			if      (0 == strseg_cmp(val, STRSEG("down")))  rule->want_state= RULE_STATE_DOWN;
+			else if (0 == strseg_cmp(val, STRSEG("start"))) rule->want_state= RULE_STATE_START;
+			else if (0 == strseg_cmp(val, STRSEG("up")))    rule->want_state= RULE_STATE_UP;
+			else {
+				*error= "Invalid state condition";
+				return false;
+			}
+		}
+		else if (0 == strseg_cmp(key, STRSEG("exit"))) {
+			if (!strseg_atoi(&val, &n) || val.len || n < 0 || n > 255) {
+				*error= "Invalid exit condition";
+				return false;
+			}
+			rule->want_exit= (int) n;
+		}
+		else if (0 == strseg_cmp(key, STRSEG("signal"))) {
+			if ((rule->want_signal= sig_num_by_name(val)) <= 0) {
+				*error= "Invalid signal condition";
+				return false;
+			}
+		}
+		else if (0 == strseg_cmp(key, STRSEG("reason"))) {
+			if (rule->want_reason)
+				name_release(rule->want_reason);
+			if (!(rule->want_reason= name_intern(val, false))) {
+				*error= "Out of memory";
+				return false;
+			}
+		}
+		else {
+			*error= "Unknown condition";
+			return false;
+		}
+	}
+	// any exit detail implies the service went down
+	if ((rule->want_exit >= 0 || rule->want_signal || rule->want_reason)
+		&& rule->want_state != RULE_STATE_DOWN
+	) {
+		if (rule->want_state != RULE_STATE_ANY) {
+			*error= "Exit conditions only apply to state=down";
+			return false;
+		}
+		rule->want_state= RULE_STATE_DOWN;
+	}
+	return true;
+}
+
+/** Parse "service.start SELECTOR" or "service.signal SELECTOR SIGNAL [group]".
+ */
+static bool rule_parse_action(rule_t *rule, strseg_t *spec, const char **error) {
+	strseg_t action, target, arg;
+
+	if (!strseg_tok_next(spec, '\t', &action) || !strseg_tok_next(spec, '\t', &target)) {
+		*error= "Expected ACTION SELECTOR";
+		return false;
+	}
+	if (!svc_check_selector(target)) {
+		*error= "Invalid action selector";
+		return false;
+	}
+	if (0 == strseg_cmp(action, STRSEG("service.start")))
+		rule->action= RULE_ACTION_START;
+	else if (0 == strseg_cmp(action, STRSEG("service.signal"))) {
+		rule->action= RULE_ACTION_SIGNAL;
+		if (!strseg_tok_next(spec, '\t', &arg) || (rule->target_signal= sig_num_by_name(arg)) <= 0) {
+			*error= "Expected signal for service.signal";
+			return false;
+		}
+		if (strseg_tok_next(spec, '\t', &arg)) {
+			if (0 != strseg_cmp(arg, STRSEG("group"))) {
+				*error= "Unknown service.signal option";
+				return false;
+			}
+			rule->group= true;
+		}
+	}
+	else {
+		*error= "Unknown action";
+		return false;
+	}
+	if (strseg_tok_next(spec, '\t', &arg)) {
+		*error= "Too many arguments";
+		return false;
+	}
+	if (!(rule->target= name_intern(target, false))) {
+		*error= "Out of memory";
+		return false;
+	}
+	return true;
+}
+
+/** Remove the named rule.  Returns false if there was none.
+ */
+bool rule_delete(strseg_t name) {
+	rule_t *rule, **prev;
+	int i;
+	for (i= 0; i < RULE_EVENT_COUNT; i++)
+		for (prev= &rule_list[i]; (rule= *prev); prev= &rule->next)
+			if (name_len(rule->name) == name.len && 0 == memcmp(rule->name, name.data, name.len)) {
+				*prev= rule->next;
+				rule_free(rule);
+				return true;
+			}
+	return false;
+}
+
+/** Get the name and definition of the i'th rule, for listing.
+ * Returns false when i is past the end.
+ */
+bool rule_get(int i, const char **name_out, const char **spec_out) {
+	rule_t *rule;
+	int ev;
+	for (ev= 0; ev < RULE_EVENT_COUNT; ev++)
+		for (rule= rule_list[ev]; rule; rule= rule->next)
+			if (!i--) {
+				*name_out= rule->name;
+				*spec_out= rule->spec;
+				return true;
+			}
+	return false;
+}
+
+/** Run the rules for a service's new state.  Called by svc_notify_state.
+ */
+void rule_notify_svc_state(service_t *svc) {
+	rule_t *rule, *next;
+	int state, wstat;
+	const char *reason;
+
+	if (!rule_list[RULE_EVENT_SERVICE_STATE])
+		return;
+	// same interpretation as the service.state event
+	wstat= svc_get_wstat(svc);
+	if (!svc_get_up_ts(svc) || svc_get_reap_ts(svc))
+		state= RULE_STATE_DOWN;
+	else if (!svc_get_pid(svc))
+		state= RULE_STATE_START;
+	else
+		state= RULE_STATE_UP;
+	reason= svc_get_kill_reason(svc);
+	if (!reason && wstat >= 0)
+		reason= WIFEXITED(wstat)? "exit" : "signal";
+
+	for (rule= rule_list[RULE_EVENT_SERVICE_STATE]; rule; rule= next) {
+		next= rule->next;
+		if (rule->want_state && rule->want_state != state)
+			continue;
+		if (rule->want_exit >= 0 && !(wstat >= 0 && WIFEXITED(wstat) && WEXITSTATUS(wstat) == rule->want_exit))
+			continue;
+		if (rule->want_signal && !(wstat >= 0 && WIFSIGNALED(wstat) && WTERMSIG(wstat) == rule->want_signal))
+			continue;
+		if (rule->want_reason && !(reason && 0 == strcmp(reason, rule->want_reason)))
+			continue;
+		if (!svc_selector_match(rule->selector, svc))
+			continue;
+		rule_fire(rule);
+	}
+}
+
+/** Run the rules for a signal received by daemonproxy.
+ */
+void rule_notify_signal(int signum) {
+	rule_t *rule, *next;
+	for (rule= rule_list[RULE_EVENT_SIGNAL]; rule; rule= next) {
+		next= rule->next;
+		if (rule->signum == signum)
+			rule_fire(rule);
+	}
+}
+
+static void rule_fire(rule_t *rule) {
+	service_t *svc;
+	const char *argv;
+
+	if (rule_depth >= RULE_DEPTH_MAX) {
+		log_warn("rule \"%s\" not run: rules nested too deeply", rule->name);
+		return;
+	}
+	log_debug("rule \"%s\" matched", rule->name);
+	flight_record("rule", rule->action, 0, rule->name, -1);
+	rule_depth++;
+	for (svc= NULL; (svc= svc_select_next(rule->target, svc)); ) {
+		switch (rule->action) {
+		case RULE_ACTION_START:
+			argv= svc_get_argv(svc);
+			// (svc_handle_start ignores services which are not down)
+			if (argv[0] && argv[0] != '\t')
+				svc_handle_start(svc, wake->now);
+			break;
+		case RULE_ACTION_SIGNAL:
+			if (svc_get_pid(svc) > 0 && svc_get_wstat(svc) < 0
+				&& !svc_send_signal(svc, rule->target_signal, rule->group))
+				log_error("rule \"%s\": can't signal service \"%s\": %s", rule->name,
+					svc_get_name(svc), strerror(errno));
+			break;
+		}
+	}
+	rule_depth--;
+}
@@ -17,29 +17,96 @@
 #define SVC_STATE_UP            3
 #define SVC_STATE_REAPED        4
 
+#define SVC_PROBE_NONE          0
+#define SVC_PROBE_EXEC          1
+#define SVC_PROBE_CONNECT       2
+#define SVC_PROBE_FILE          3
+
+// Parsed form of a "cron:" auto_up trigger.  Each field is a bitmask of the
+// values it matches (day of month and month are 1-based, day of week has
+// Sunday as 0).  dom_any and dow_any record a '*' in those fields, which
+// decides whether they are combined with AND or OR like in crontab(5).
+typedef struct svc_cron_s {
+	uint64_t minutes;
+	uint32_t hours;
+	uint32_t days;
+	uint16_t months;
+	uint8_t  weekdays;
+	bool     dom_any: 1,
+	         dow_any: 1;
+} svc_cron_t;
+
 struct service_s {
 	int state;
-	char name_buf[NAME_BUF_SIZE];
 	strseg_t
-		name,              // constant.  points to name_buf
+		name,              // constant.  interned, see name_intern
 		vars;              // dynamic, unless service pool feature used.
 	RBTreeNode             // nodes for Red/Black tree indexing
 		name_index_node, 
 		pid_index_node;
 	struct service_s       // doubly linked lists
 		**active_prev_ptr, *active_next,
-		**sigwake_prev_ptr, *sigwake_next;
+		**sigwake_prev_ptr, *sigwake_next,
+		*dirty_next;
 	pid_t pid;
+	uint64_t epoch;        // ctl_snapshot_epoch when created
+	int state_table_slot;  // record in --state-table, or -1
+	int exec_fd;           // O_PATH handle of the executable while forking, else -1
+	int exec_dir;          // 1 + index of the PATH entry argv[0] was found in, or 0
 	bool auto_restart: 1,
 		sigwake: 1,
 		uses_control_event: 1,
 		uses_control_cmd: 1,
-		uses_control_socket: 1;
+		uses_control_socket: 1,
+		restart_pending: 1,    // restart after reaped, regardless of triggers
+		probe_restart: 1,      // restart when probe_threshold is reached
+		probe_group: 1,        // ...by signalling the process group
+		probe_running: 1,
+		probe_reported: 1,     // current health status has been announced
+		watchdog_group: 1,
+		kill_group: 1,         // ...for the SIGKILL at kill_deadline
+		max_runtime_group: 1,
+		cron: 1,               // auto_up has a cron trigger
+		state_dirty: 1,        // queued on svc_dirty_list
+		shadow_ready: 1,       // shadow instance declared itself ready
+		spare: 1,              // keep a pre-forked standby process
+		spare_pending: 1;      // fork a new standby while the service is up
 	int wait_status;
+	const char *kill_reason; // set if daemonproxy killed the service, reported as exit reason
+	int64_t  kill_deadline;      // send SIGKILL if still up at this time, or 0
+	int      restart_count;      // number of automatic restarts
+	int      last_wait_status;   // exit of the previous run, for coalesced events
+	const char *last_kill_reason;
 	int64_t  start_time;   // 32-bit-precision fixed point fraction
 	int64_t  reap_time;
 	int64_t  restart_interval;
 	sigset_t autostart_signals;
+	int      probe_type;
+	int      probe_threshold;
+	int      probe_failures;
+	pid_t    probe_pid;    // for exec probes
+	int      probe_fd;     // for connect probes
+	int64_t  probe_interval;
+	int64_t  probe_timeout;
+	int64_t  probe_ts;     // time of next probe, or deadline of the running probe
+	int      watchdog_signal;
+	int64_t  watchdog_timeout;
+	int64_t  heartbeat_ts; // time of last heartbeat (or start)
+	int      max_runtime_signal;
+	int64_t  max_runtime;
+	svc_cron_t cron_sched;
+	time_t   cron_next;    // wall-clock time of next cron trigger
+	pid_t    shadow_pid;   // replacement instance started by service.replace
+	pid_t    retired_pid;  // most recent previous instance, until it is reaped
+	int64_t  retired_start;
+	int      replace_signal;
+	int64_t  replace_deadline; // promote the shadow at this time, even if not ready
+	pid_t    spare_pid;    // standby process waiting to exec, or 0
+	int      spare_go_fd;  // write end of the standby's pipe, or -1
+	dev_t    spare_dev;    // executable the standby holds
+	ino_t    spare_ino;
+	uint32_t history_count;  // number of runs ever recorded
+	svc_run_t history[SVC_HISTORY_SIZE]; // ring of the most recent runs
 };
 
 // Service list - a vector of service references.
@@ -58,20 +125,52 @@ RBTree svc_by_name_index;           // sorted index by name
 RBTree svc_by_pid_index;            // sorted index by PID (only if running)
 service_t *svc_active_list= NULL;   // linked list of services that need processed each iteration
 service_t *svc_sigwake_list= NULL;  // linked list of services that can wake via signals
+service_t *svc_dirty_list= NULL;    // linked list of services with a pending state event
+service_t **svc_dirty_tail= &svc_dirty_list;
 int64_t svc_last_signal_ts= 0;      // last signal we saw, for triggering services.
+svc_sig_route_t svc_sig_routes[SVC_SIGNAL_ROUTE_MAX]; // see signal.route
+int svc_sig_route_count= 0;
+service_t *svc_probe_slot[PROBE_MAX_CONCURRENT]; // services with an exec or connect probe in progress
+int svc_spare_count= 0;             // number of standby processes
 
 static service_t *svc_new(strseg_t name);
-static void svc_ctor(service_t *svc, strseg_t name);
+static void svc_ctor(service_t *svc, const char *name);
 static void svc_dtor(service_t *svc);
 
 static bool svc_list_resize(int new_limit);
 static void svc_notify_state(service_t *svc);
 static void svc_change_pid(service_t *svc, pid_t pid);
 static bool svc_do_fork(service_t *svc);
+static pid_t svc_fork(service_t *svc);
+static void svc_set_up(service_t *svc);
+static bool svc_run_replace(service_t *svc);
+static void svc_replace_promote(service_t *svc, bool retire);
+static void svc_spare_fork(service_t *svc);
+static pid_t svc_spare_release(service_t *svc);
+static void svc_spare_discard(service_t *svc);
+static void svc_spare_reset(service_t *svc);
 static void svc_do_exec(service_t *svc);
 static void svc_set_active(service_t *svc, bool activate);
 static void svc_set_sigwake(service_t *svc, bool sigwake);
 static bool svc_check_sigwake(service_t *svc);
+static void svc_exec_argv(int exec_fd, char *arg_spec);
+static int svc_exec_open(service_t *svc);
+static void svc_exec_fd_open(service_t *svc);
+static void svc_exec_fd_close(service_t *svc);
+static bool svc_run_probe(service_t *svc);
+static bool svc_probe_start(service_t *svc);
+static void svc_probe_cancel(service_t *svc);
+static void svc_probe_result(service_t *svc, bool ok, const char *detail);
+static bool svc_run_watchdog(service_t *svc);
+static bool svc_run_max_runtime(service_t *svc);
+static bool svc_run_kill_grace(service_t *svc);
+static bool svc_cron_parse(strseg_t spec, svc_cron_t *cron);
+static time_t svc_cron_next(const svc_cron_t *cron, time_t after);
+static void svc_cron_clock(struct timespec *now);
+static bool svc_run_cron(service_t *svc);
+static void svc_clear_dirty(service_t *svc);
+static void svc_history_add(service_t *svc, int64_t start_time, pid_t pid, int wstat, const char *kill_reason, const struct rusage *ru);
+static void svc_sig_route_apply(int signum);
 
 int svc_by_name_compare(void *data, RBTreeNode *node) {
 	strseg_t *name= (strseg_t*) data;
@@ -123,24 +222,28 @@ bool svc_list_resize(int new_limit) {
 
 service_t *svc_new(strseg_t name) {
 	service_t *svc;
-	
-	assert(name.len < NAME_BUF_SIZE);
+	const char *iname;
 	
 	// enlarge the service vector if needed (and not using a pool)
 	if (svc_list_count >= svc_list_limit)
 		if (svc_pool || !svc_list_resize(svc_list_limit + 32))
 			return NULL;
 
+	if (!(iname= name_intern(name, svc_pool != NULL)))
+		return NULL;
+
 	// allocate space (unless using a pool)
 	if (svc_pool)
 		svc= svc_list[svc_list_count++];
 	else {
-		if (!(svc= (service_t*) malloc(sizeof(service_t))))
+		if (!(svc= (service_t*) malloc(sizeof(service_t)))) {
+			name_release(iname);
 			return NULL;
+		}
 		svc_list[svc_list_count++]= svc;
 	}
 	
-	svc_ctor(svc, name);
+	svc_ctor(svc, iname);
 	return svc;
 }
 
@@ -164,21 +267,22 @@ void svc_delete(service_t *svc) {
 	}
 }
 
-// Requires a buffer as large as sizeof(service_t) + name.len + 1 !
-void svc_ctor(service_t *svc, strseg_t name) {
-	assert(name.len < NAME_BUF_SIZE);
-
+// Takes ownership of a reference to the interned name
+void svc_ctor(service_t *svc, const char *name) {
 	memset(svc, 0, sizeof(service_t));
 	svc->state= SVC_STATE_DOWN;
+	svc->last_wait_status= -1; // no previous run
+	svc->epoch= ctl_snapshot_epoch;
+	svc->exec_fd= -1;
+	svc->spare_go_fd= -1;
 	
 	sigemptyset(&svc->autostart_signals); // probably redundant, but obeying API...
 	
-	memcpy(svc->name_buf, name.data, name.len);
-	svc->name= (strseg_t){ svc->name_buf, name.len };
+	svc->name= (strseg_t){ name, name_len(name) };
 	
 	if (svc_pool) {
-		// When part of a pool, the vars are allocated immediately after the name
-		svc->vars.data= svc->name.data + svc->name.len + 1;
+		// When part of a pool, the vars are allocated immediately after the struct
+		svc->vars.data= (char*) (svc + 1);
 	}
 	
 	RBTreeNode_Init( &svc->name_index_node );
@@ -187,7 +291,8 @@ void svc_ctor(service_t *svc, strseg_t name) {
 	RBTreeNode_Init( &svc->pid_index_node );
 	svc->pid_index_node.Object= svc;
 	
-	RBTree_Add( &svc_by_name_index, &svc->name_index_node, &name );
+	RBTree_Add( &svc_by_name_index, &svc->name_index_node, &svc->name );
+	svc->state_table_slot= state_table_alloc(svc);
 	// unless NDEBUG:
 		svc_check(svc);
 }
@@ -195,9 +300,17 @@ void svc_ctor(service_t *svc, strseg_t name) {
 void svc_dtor(service_t *svc) {
 	svc_set_active(svc, false); // remove from 'active' linked list
 	svc_set_sigwake(svc, false); // remove from 'sigwake' linked list
+	svc_probe_cancel(svc);
+	svc_clear_dirty(svc); // remove from 'dirty' linked list
+	ctl_detach_service(svc);
+	state_table_release(svc->state_table_slot);
+	if (svc->shadow_pid)
+		sim_kill(svc->shadow_pid, SIGTERM, false);
+	svc_spare_discard(svc);
 	if (svc->pid)
 		RBTreeNode_Prune( &svc->pid_index_node );
 	RBTreeNode_Prune( &svc->name_index_node );
+	name_release(svc->name.data);
 	// Free the variables pool, but only if service pool feature not enabled
 	if (!svc_pool && svc->vars.data)
 		free((char*)svc->vars.data);
@@ -209,7 +322,7 @@ const char * svc_get_name(service_t *svc) {
 
 bool svc_check_name(strseg_t name) {
 	const char *p, *lim;
-	if (name.len >= NAME_BUF_SIZE)
+	if (name.len > NAME_LEN_MAX)
 		return false;
 	for (p= name.data, lim= p+name.len; p < lim; p++)
 		if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '.' || *p == '_' || *p == '-'))
@@ -229,6 +342,21 @@ int64_t svc_get_up_ts(service_t *svc) {
 int64_t svc_get_reap_ts(service_t *svc) {
 	return svc->reap_time;
 }
+uint64_t svc_get_epoch(service_t *svc) {
+	return svc->epoch;
+}
+const char * svc_get_kill_reason(service_t *svc) {
+	return svc->kill_reason;
+}
+int     svc_get_restart_count(service_t *svc) {
+	return svc->restart_count;
+}
+int     svc_get_last_wstat(service_t *svc) {
+	return svc->last_wait_status;
+}
+const char * svc_get_last_kill_reason(service_t *svc) {
+	return svc->last_kill_reason;
+}
 
 /** Get a named variable.
  *
@@ -342,7 +470,85 @@ const char * svc_get_argv(service_t *svc) {
  * This can be slightly expensive, but args and fds are typically static.
  */
 bool svc_set_argv(service_t *svc, strseg_t new_argv) {
-	return svc_set_var(svc, STRSEG("args"), new_argv.len <= 0? NULL : &new_argv);
+	int fd;
+	if (!svc_set_var(svc, STRSEG("args"), new_argv.len <= 0? NULL : &new_argv))
+		return false;
+	// Look up the executable now, to warn about it early
+	svc->exec_dir= 0;
+	if ((fd= svc_exec_open(svc)) >= 0)
+		close(fd);
+	else if (new_argv.len > 0)
+		log_warn("service \"%s\": can't find executable \"%.*s\"", svc_get_name(svc),
+			(int) strcspn(svc_get_argv(svc), "\t"), svc_get_argv(svc));
+	// a standby would still exec the old arguments
+	svc_spare_reset(svc);
+	return true;
+}
+
+/** Resolve argv[0] of the service to an O_PATH handle, as execvp would.
+ *
+ * A name containing '/' is opened as-is (so a relative one is relative to
+ * daemonproxy's working directory at the time).  A bare name is searched in
+ * PATH, starting with the entry where it was found last time, so a start
+ * usually costs a single open().  Returns the handle, or -1.
+ */
+static int svc_exec_open(service_t *svc) {
+	const char *argv= svc_get_argv(svc), *dir, *end, *search;
+	char path[PATH_MAX];
+	int arg0_len= strcspn(argv, "\t"), dir_len, fd= -1, idx, pass;
+	struct stat st;
+
+	if (!arg0_len || arg0_len >= PATH_MAX)
+		return -1;
+	if (memchr(argv, '/', arg0_len)) {
+		memcpy(path, argv, arg0_len);
+		path[arg0_len]= '\0';
+		fd= open(path, O_PATH|O_CLOEXEC);
+	}
+	else {
+		// Same search as execvp
+		if (!(search= getenv("PATH")))
+			search= "/bin:/usr/bin";
+		// pass 0 tries only the remembered entry, pass 1 tries them all
+		for (pass= svc->exec_dir? 0 : 1; fd < 0 && pass < 2; pass++) {
+			for (dir= search, idx= 1; fd < 0 && *dir; dir= *end? end+1 : end, idx++) {
+				end= strchrnul(dir, ':');
+				dir_len= end - dir;
+				if ((pass == 0 && idx != svc->exec_dir) || dir_len + 1 + arg0_len >= PATH_MAX)
+					continue;
+				if (dir_len) {
+					memcpy(path, dir, dir_len);
+					path[dir_len++]= '/';
+				}
+				memcpy(path + dir_len, argv, arg0_len);
+				path[dir_len + arg0_len]= '\0';
+				if (access(path, X_OK) == 0 && (fd= open(path, O_PATH|O_CLOEXEC)) >= 0)
+					svc->exec_dir= idx;
+			}
+		}
+	}
+	if (fd >= 0 && (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+		close(fd);
+		fd= -1;
+	}
+	return fd;
+}
+
+/** Open the executable's handle for a fork which is about to happen.
+ *
+ * The handle is only held until the fork (or the spawner request) is done,
+ * so idle services don't each keep a descriptor open.  If it can't be
+ * opened, the child falls back to execvp.
+ */
+static void svc_exec_fd_open(service_t *svc) {
+	assert(svc->exec_fd < 0);
+	svc->exec_fd= svc_exec_open(svc);
+}
+
+static void svc_exec_fd_close(service_t *svc) {
+	if (svc->exec_fd >= 0)
+		close(svc->exec_fd);
+	svc->exec_fd= -1;
 }
 
 const char * svc_get_fds(service_t *svc) {
@@ -378,6 +584,7 @@ bool svc_set_fds(service_t *svc, strseg_t new_fds) {
 		if (strseg_cmp(name, STRSEG("control.socket")) == 0)
 			svc->uses_control_socket= true;
 	}
+	svc_spare_reset(svc);
 	return true;
 }
 
@@ -398,16 +605,25 @@ const char * svc_get_triggers(service_t *svc) {
 }
 
 bool svc_set_triggers(service_t *svc, strseg_t triggers_tsv) {
-	strseg_t list= triggers_tsv, trigger;
+	strseg_t list= triggers_tsv, trigger, kind, cron_spec;
 	sigset_t sigs;
+	svc_cron_t cron;
 	int signum;
-	bool autostart= false, enable_sigs= false;
+	struct timespec now;
+	bool autostart= false, enable_sigs= false, enable_cron= false;
 	
 	// convert triggers to bit flags
 	sigemptyset(&sigs);
 	while (strseg_tok_next(&list, '\t', &trigger) && trigger.len > 0) {
+		kind= trigger;
 		if (0 == strseg_cmp(trigger, STRSEG("always")))
 			autostart= true;
+		else if (strseg_split_1(&kind, ':', &cron_spec) && 0 == strseg_cmp(kind, STRSEG("cron"))) {
+			// only one schedule per service
+			if (enable_cron || !svc_cron_parse(cron_spec, &cron))
+				return false;
+			enable_cron= true;
+		}
 		else if ((signum= sig_num_by_name(trigger)) > 0) {
 			if (sigaddset(&sigs, signum) < 0)
 				return false;
@@ -423,6 +639,15 @@ bool svc_set_triggers(service_t *svc, strseg_t triggers_tsv) {
 	svc->auto_restart= autostart;
 	svc->autostart_signals= sigs;
 	svc_set_sigwake(svc, enable_sigs);
+	svc->cron= enable_cron;
+	if (enable_cron) {
+		svc_cron_clock(&now);
+		svc->cron_sched= cron;
+		svc->cron_next= svc_cron_next(&cron, now.tv_sec);
+		// the state machine arms the timer
+		svc_set_active(svc, true);
+		wake->next= wake->now;
+	}
 	
 	// finally, if a relevant signal is un-cleared, start the service.
 	if (svc->auto_restart || svc_check_sigwake(svc)) {
@@ -433,6 +658,205 @@ bool svc_set_triggers(service_t *svc, strseg_t triggers_tsv) {
 	return true;
 }
 	
+const char * svc_get_probe(service_t *svc) {
+	strseg_t val;
+	return svc_get_var(svc, STRSEG("probe"), &val)? val.data : "";
+}
+
+/** Set the health-check probe for the service.
+ *
+ * The spec is "INTERVAL TIMEOUT THRESHOLD FLAGS TYPE ARGS..." where TYPE is
+ * one of "exec ARGV...", "connect FD_NAME", or "file PATH MAX_AGE".
+ * An empty spec or '-' removes the probe.  The spec is stored verbatim as a
+ * service variable, and the numeric parts are cached in the service struct.
+ */
+bool svc_set_probe(service_t *svc, strseg_t probe_tsv) {
+	strseg_t spec= probe_tsv, field, flags, flag;
+	int64_t interval, timeout, threshold, max_age;
+	int type;
+	bool restart= false, group= false;
+
+	if (probe_tsv.len <= 0 || (probe_tsv.len == 1 && probe_tsv.data[0] == '-')) {
+		svc_probe_cancel(svc);
+		svc->probe_type= SVC_PROBE_NONE;
+		svc_set_var(svc, STRSEG("probe"), NULL);
+		return true;
+	}
+
+	if (!strseg_tok_next(&spec, '\t', &field) || !strseg_atoi(&field, &interval) || field.len
+		|| interval < 1 || (interval >> 31)
+		|| !strseg_tok_next(&spec, '\t', &field) || !strseg_atoi(&field, &timeout) || field.len
+		|| timeout < 1 || (timeout >> 31)
+		|| !strseg_tok_next(&spec, '\t', &field) || !strseg_atoi(&field, &threshold) || field.len
+		|| threshold < 1 || (threshold >> 16)
+		|| !strseg_tok_next(&spec, '\t', &flags))
+		return false;
+
+	while (strseg_tok_next(&flags, ',', &flag)) {
+		if (flag.len <= 0 || 0 == strseg_cmp(flag, STRSEG("-")))
+			continue;
+		else if (0 == strseg_cmp(flag, STRSEG("restart")))
+			restart= true;
+		else if (0 == strseg_cmp(flag, STRSEG("group")))
+			group= true;
+		else
+			return false;
+	}
+
+	if (!strseg_tok_next(&spec, '\t', &field))
+		return false;
+	if (0 == strseg_cmp(field, STRSEG("exec"))) {
+		type= SVC_PROBE_EXEC;
+		if (spec.len <= 0)
+			return false;
+	}
+	else if (0 == strseg_cmp(field, STRSEG("connect"))) {
+		type= SVC_PROBE_CONNECT;
+		if (!strseg_tok_next(&spec, '\t', &field) || !fd_check_name(field) || spec.len > 0)
+			return false;
+	}
+	else if (0 == strseg_cmp(field, STRSEG("file"))) {
+		type= SVC_PROBE_FILE;
+		if (!strseg_tok_next(&spec, '\t', &field) || field.len <= 0
+			|| !strseg_tok_next(&spec, '\t', &field) || !strseg_atoi(&field, &max_age) || field.len
+			|| max_age < 0 || spec.len > 0)
+			return false;
+	}
+	else
+		return false;
+
+	if (!svc_set_var(svc, STRSEG("probe"), &probe_tsv))
+		return false;
+
+	svc_probe_cancel(svc);
+	svc->probe_type= type;
+	svc->probe_interval= interval << 32;
+	svc->probe_timeout= timeout << 32;
+	svc->probe_threshold= (int) threshold;
+	svc->probe_restart= restart;
+	svc->probe_group= group;
+	svc->probe_failures= 0;
+	svc->probe_reported= false;
+
+	// If already running, begin probing one interval from now
+	if (svc->state == SVC_STATE_UP) {
+		svc->probe_ts= wake->now + svc->probe_interval;
+		svc_set_active(svc, true);
+		wake->next= wake->now;
+	}
+	return true;
+}
+
+const char * svc_get_watchdog(service_t *svc) {
+	strseg_t val;
+	return svc_get_var(svc, STRSEG("watchdog"), &val)? val.data : "";
+}
+
+/** Parse the "SECONDS [SIGNAL [FLAGS]]" spec shared by the watchdog and the
+ * maximum runtime.  SIGNAL defaults to SIGTERM, and the only flag is "group".
+ * Returns false if the spec is invalid.
+ */
+static bool svc_parse_timeout_spec(strseg_t spec, int64_t *seconds, int *signum, bool *group) {
+	strseg_t field, flag;
+
+	*signum= SIGTERM;
+	*group= false;
+	if (!strseg_tok_next(&spec, '\t', &field) || !strseg_atoi(&field, seconds) || field.len
+		|| *seconds < 1 || (*seconds >> 31))
+		return false;
+	if (strseg_tok_next(&spec, '\t', &field) && (*signum= sig_num_by_name(field)) <= 0)
+		return false;
+	while (strseg_tok_next(&spec, ',', &flag)) {
+		if (0 == strseg_cmp(flag, STRSEG("group")))
+			*group= true;
+		else if (flag.len > 0 && 0 != strseg_cmp(flag, STRSEG("-")))
+			return false;
+	}
+	return true;
+}
+
+/** Set the watchdog for the service.
+ *
+ * The spec is "TIMEOUT [SIGNAL [FLAGS]]".  If the service goes TIMEOUT
+ * seconds without a heartbeat, it is sent SIGNAL (default SIGTERM) and
+ * restarted.  The only flag is "group".  An empty spec or '-' removes it.
+ */
+bool svc_set_watchdog(service_t *svc, strseg_t watchdog_tsv) {
+	int64_t timeout;
+	int signum;
+	bool group;
+
+	if (watchdog_tsv.len <= 0 || (watchdog_tsv.len == 1 && watchdog_tsv.data[0] == '-')) {
+		svc->watchdog_timeout= 0;
+		svc_set_var(svc, STRSEG("watchdog"), NULL);
+		return true;
+	}
+
+	if (!svc_parse_timeout_spec(watchdog_tsv, &timeout, &signum, &group))
+		return false;
+	if (!svc_set_var(svc, STRSEG("watchdog"), &watchdog_tsv))
+		return false;
+
+	svc->watchdog_timeout= timeout << 32;
+	svc->watchdog_signal= signum;
+	svc->watchdog_group= group;
+	// A running service gets one full timeout from now to send its first heartbeat
+	if (svc->state == SVC_STATE_UP) {
+		svc->heartbeat_ts= wake->now;
+		svc_set_active(svc, true);
+		wake->next= wake->now;
+	}
+	return true;
+}
+
+const char * svc_get_max_runtime(service_t *svc) {
+	strseg_t val;
+	return svc_get_var(svc, STRSEG("max_runtime"), &val)? val.data : "";
+}
+
+/** Set the maximum runtime for the service.
+ *
+ * The spec is "SECONDS [SIGNAL [FLAGS]]".  If the service is still up
+ * SECONDS after it started, it is sent SIGNAL (default SIGTERM).  The only
+ * flag is "group".  An empty spec or '-' removes it.
+ */
+bool svc_set_max_runtime(service_t *svc, strseg_t max_runtime_tsv) {
+	int64_t seconds;
+	int signum;
+	bool group;
+
+	if (max_runtime_tsv.len <= 0 || (max_runtime_tsv.len == 1 && max_runtime_tsv.data[0] == '-')) {
+		svc->max_runtime= 0;
+		svc_set_var(svc, STRSEG("max_runtime"), NULL);
+		return true;
+	}
+
+	if (!svc_parse_timeout_spec(max_runtime_tsv, &seconds, &signum, &group))
+		return false;
+	if (!svc_set_var(svc, STRSEG("max_runtime"), &max_runtime_tsv))
+		return false;
+
+	svc->max_runtime= seconds << 32;
+	svc->max_runtime_signal= signum;
+	svc->max_runtime_group= group;
+	// Applies to the current run too, counted from when it started
+	if (svc->state == SVC_STATE_UP) {
+		svc_set_active(svc, true);
+		wake->next= wake->now;
+	}
+	return true;
+}
+
+/** Record a heartbeat from the service, postponing its watchdog.
+ * Returns false if the service is not running.
+ */
+bool svc_handle_heartbeat(service_t *svc) {
+	if (svc->state != SVC_STATE_UP)
+		return false;
+	svc->heartbeat_ts= wake->now;
+	return true;
+}
+
 static void svc_set_sigwake(service_t *svc, bool sigwake) {
 	svc->sigwake= sigwake;
 	// Add or remove this service from the sigwake list, as needed.
@@ -479,11 +903,18 @@ bool svc_handle_start(service_t *svc, int64_t when) {
 		log_debug("start service \"%s\" now", svc_get_name(svc));
 		when= wake->now;
 	}
+	// remember how the previous run ended
+	if (svc->reap_time) {
+		svc->last_wait_status= svc->wait_status;
+		svc->last_kill_reason= svc->kill_reason;
+	}
 	svc->state= SVC_STATE_START;
 	svc->start_time= (when == 0? 1 : when); // 0 means undefined
 	svc_change_pid(svc, 0);
 	svc->reap_time= 0;
 	svc->wait_status= -1;
+	svc->kill_reason= NULL;
+	svc->kill_deadline= 0;
 	svc_set_active(svc, true);
 	svc_notify_state(svc);
 	wake->next= wake->now;
@@ -498,7 +929,9 @@ bool svc_cancel_start(service_t *svc) {
 	
 	svc->state= SVC_STATE_DOWN;
 	svc->start_time= 0;
-	svc_set_active(svc, false);
+	// state machine decides whether it needs to stay active (for cron)
+	svc_set_active(svc, true);
+	wake->next= wake->now;
 	svc_notify_state(svc);
 	return true;
 }
@@ -507,9 +940,10 @@ bool svc_cancel_start(service_t *svc) {
  * This wakes up the service state machine, to possibly restart the daemon.
  * It is assumed that this is called by main() before iterating the active services.
  */
-void svc_handle_reaped(service_t *svc, int wstat) {
+void svc_handle_reaped(service_t *svc, int wstat, const struct rusage *ru) {
 	if (svc->state == SVC_STATE_UP) {
 		log_trace("Setting service \"%s\" state to reaped", svc_get_name(svc));
+		svc_history_add(svc, svc->start_time, svc->pid, wstat, svc->kill_reason, ru);
 		svc->wait_status= wstat;
 		svc->state= SVC_STATE_REAPED;
 		svc->reap_time= wake->now;
@@ -519,13 +953,117 @@ void svc_handle_reaped(service_t *svc, int wstat) {
 	else log_trace("Service \"%s\" pid %d reaped, but service is not up", svc_get_name(svc), svc->pid);
 }
 
+// Remember a finished run, overwriting the oldest once the ring is full
+static void svc_history_add(service_t *svc, int64_t start_time, pid_t pid, int wstat, const char *kill_reason, const struct rusage *ru) {
+	svc_run_t *run= &svc->history[svc->history_count++ % SVC_HISTORY_SIZE];
+	run->start_time= start_time;
+	run->reap_time= wake->now;
+	run->pid= pid;
+	run->wait_status= wstat;
+	run->kill_reason= kill_reason;
+	run->cpu_ms= ru->ru_utime.tv_sec * 1000 + ru->ru_utime.tv_usec / 1000
+		+ ru->ru_stime.tv_sec * 1000 + ru->ru_stime.tv_usec / 1000;
+	run->maxrss_kb= ru->ru_maxrss;
+}
+
+/** Get one of the service's past runs, oldest first, or NULL if there are
+ * no more.  Only the last SVC_HISTORY_SIZE runs are kept.
+ */
+const svc_run_t * svc_get_history(service_t *svc, int i) {
+	uint32_t n= svc->history_count < SVC_HISTORY_SIZE? svc->history_count : SVC_HISTORY_SIZE;
+	if (i < 0 || i >= n)
+		return NULL;
+	return &svc->history[(svc->history_count - n + i) % SVC_HISTORY_SIZE];
+}
+
 /** Send a signal to a service iff it is running.
  */
 bool svc_send_signal(service_t *svc, int signum, bool group) {
 	if (!svc || svc->pid <= 0) return false;
 	
 	log_debug("Sending signal %d to service \"%s\" pid %d", signum, svc_get_name(svc), (int)svc->pid);
-	return 0 == (group? killpg(svc->pid, signum) : kill(svc->pid, signum));
+	return 0 == sim_kill(svc->pid, signum, group);
+}
+
+/** Add or replace the route for signum to the services matching selector,
+ * or remove it if target is 0.  Returns false if the table is full or out of
+ * memory.
+ */
+bool svc_sig_route_set(int signum, strseg_t selector, int target, bool group) {
+	svc_sig_route_t *route;
+	int i;
+	for (i= 0; i < svc_sig_route_count; i++) {
+		route= &svc_sig_routes[i];
+		if (route->signum == signum && name_len(route->selector) == selector.len
+			&& 0 == memcmp(route->selector, selector.data, selector.len))
+			break;
+	}
+	if (!target) {
+		if (i < svc_sig_route_count) {
+			name_release(svc_sig_routes[i].selector);
+			memmove(svc_sig_routes + i, svc_sig_routes + i + 1, (svc_sig_route_count - i - 1) * sizeof(*svc_sig_routes));
+			svc_sig_route_count--;
+		}
+		return true;
+	}
+	route= &svc_sig_routes[i];
+	if (i == svc_sig_route_count) {
+		if (i >= SVC_SIGNAL_ROUTE_MAX || !(route->selector= name_intern(selector, false)))
+			return false;
+		route->signum= signum;
+		svc_sig_route_count++;
+	}
+	route->target= target;
+	route->group= group;
+	return true;
+}
+
+const svc_sig_route_t * svc_sig_route_get(int i) {
+	return i >= 0 && i < svc_sig_route_count? &svc_sig_routes[i] : NULL;
+}
+
+/** Forward a signal which daemonproxy received to every running service
+ * matched by a route for it.
+ */
+static void svc_sig_route_apply(int signum) {
+	const svc_sig_route_t *route;
+	service_t *svc;
+	int i;
+	for (i= 0; i < svc_sig_route_count; i++) {
+		route= &svc_sig_routes[i];
+		if (route->signum != signum)
+			continue;
+		for (svc= NULL; (svc= svc_select_next(route->selector, svc)); ) {
+			if (svc->state == SVC_STATE_UP && !svc_send_signal(svc, route->target, route->group))
+				log_error("can't forward signal %d to service \"%s\" (%s %d): %s", route->target,
+					svc_get_name(svc), route->group? "pgid":"pid", (int) svc->pid, strerror(errno));
+		}
+	}
+}
+
+/** Signal a service on behalf of one of daemonproxy's own monitors.
+ * The reason is reported as the exit reason once the process is reaped,
+ * and if restart is requested the service will be started again
+ * regardless of its auto_up triggers.  The monitors stand down until
+ * then, so a service which survives the signal is sent SIGKILL after
+ * SERVICE_KILL_GRACE.
+ */
+static bool svc_kill(service_t *svc, int signum, bool group, const char *reason, bool restart) {
+	svc->kill_reason= reason;
+	if (restart)
+		svc->restart_pending= true;
+	if (svc_send_signal(svc, signum, group)) {
+		if (signum != SIGKILL && !svc->kill_deadline) {
+			svc->kill_deadline= wake->now + SERVICE_KILL_GRACE;
+			svc->kill_group= group;
+			svc_set_active(svc, true);
+			wake->next= wake->now;
+		}
+		return true;
+	}
+	log_error("can't kill service \"%s\" (%s %d): %s", svc_get_name(svc),
+		group? "pgid":"pid", (int) svc->pid, strerror(errno));
+	return false;
 }
 
 /** Activate or deactivate a service.
@@ -560,18 +1098,23 @@ void svc_run_active() {
 	int signum, sig_count;
 	int64_t sig_ts;
 
-	// For any new signal received, check if it wakes any services
-	if (svc_sigwake_list)
-		while (sig_get_new_events(svc_last_signal_ts, &signum, &sig_ts, &sig_count)) {
-			svc= svc_sigwake_list;
-			while (svc) {
-				next= svc->sigwake_next;
-				if (sigismember(&svc->autostart_signals, signum))
-					svc_handle_start(svc, wake->now);
-				svc= next;
-			}
-			svc_last_signal_ts= sig_ts;
+	// For any new signal received, forward it along the signal routes, run
+	// the rules for it, and check if it wakes any services.  (This always
+	// keeps up with the signals, so routes and rules added later only see
+	// signals which arrive after them.)
+	while (sig_get_new_events(svc_last_signal_ts, &signum, &sig_ts, &sig_count)) {
+		if (svc_sig_route_count)
+			svc_sig_route_apply(signum);
+		rule_notify_signal(signum);
+		svc= svc_sigwake_list;
+		while (svc) {
+			next= svc->sigwake_next;
+			if (sigismember(&svc->autostart_signals, signum))
+				svc_handle_start(svc, wake->now);
+			svc= next;
 		}
+		svc_last_signal_ts= sig_ts;
+	}
 
 	// run state machine for any active service
 	svc= svc_active_list;
@@ -585,6 +1128,7 @@ void svc_run_active() {
 /** Run the state machine for one service.
  */
 void svc_run(service_t *svc) {
+	bool keep_active;
 	re_switch_state:
 	log_trace("service %s state = %d", svc_get_name(svc), svc->state);
 	switch (svc->state) {
@@ -606,18 +1150,46 @@ void svc_run(service_t *svc) {
 			goto re_switch_state;
 		}
 		
-		// service is started
-		svc->start_time= (wake->now? wake->now : 1); // time != 0 hack
-		svc->state= SVC_STATE_UP;
-		svc_notify_state(svc);
+		// service is started; get the next standby ready
+		svc->spare_pending= svc->spare;
+		svc_set_up(svc);
 	case SVC_STATE_UP:
-		svc_set_active(svc, false);
-		// waitpid in main loop will re-activate us and set state to REAPED
+		// waitpid in main loop will re-activate us and set state to REAPED,
+		// but the watchdog, runtime limit, health probe, and a pending
+		// replacement keep us active while they have something scheduled.
+		if (svc->spare_pending)
+			svc_spare_fork(svc);
+		keep_active= svc_run_replace(svc);
+		if (svc_run_watchdog(svc))
+			keep_active= true;
+		if (svc_run_max_runtime(svc))
+			keep_active= true;
+		if (svc_run_kill_grace(svc))
+			keep_active= true;
+		if (svc_run_cron(svc))
+			keep_active= true;
+		if (svc_run_probe(svc))
+			keep_active= true;
+		if (!keep_active)
+			svc_set_active(svc, false);
 		break;
 	case SVC_STATE_REAPED:
+		svc_probe_cancel(svc);
 		svc_notify_state(svc);
+		// If a replacement is waiting, it takes over right away
+		if (svc->shadow_pid) {
+			rule_notify_svc_state(svc);
+			svc_replace_promote(svc, false);
+			goto re_switch_state;
+		}
 		svc->state= SVC_STATE_DOWN;
-		if (svc->auto_restart || svc_check_sigwake(svc)) {
+		rule_notify_svc_state(svc);
+		// A rule may have started it already
+		if (svc->state != SVC_STATE_DOWN)
+			svc->restart_pending= false;
+		else if (svc->auto_restart || svc->restart_pending || svc_check_sigwake(svc)) {
+			svc->restart_pending= false;
+			svc->restart_count++;
 			// if restarting too fast, delay til future
 			svc_handle_start(svc, 
 				(svc->reap_time - svc->start_time < svc->restart_interval)?
@@ -626,7 +1198,11 @@ void svc_run(service_t *svc) {
 		}
 		goto re_switch_state;
 	case SVC_STATE_DOWN:
-		svc_set_active(svc, false);
+		// A standby only serves restarts; a stopped service doesn't keep one
+		svc_spare_discard(svc);
+		// remain active while waiting for a cron trigger
+		if (!svc_run_cron(svc))
+			svc_set_active(svc, false);
 		break;
 	// We can only arrive here as a result of a bug.  Catch it with asserts.
 	case SVC_STATE_UNDEF:
@@ -638,21 +1214,53 @@ void svc_run(service_t *svc) {
 		svc_check(svc);
 }
 
+// Set the descriptor number of the control.{socket,cmd,event} FD objects
+static void svc_set_control_fdnum(int fdnum) {
+	fd_set_fdnum(fd_by_name(STRSEG("control.socket")), fdnum);
+	fd_set_fdnum(fd_by_name(STRSEG("control.cmd")), fdnum);
+	fd_set_fdnum(fd_by_name(STRSEG("control.event")), fdnum);
+}
+
+// Mark a newly forked process as the running instance
+void svc_set_up(service_t *svc) {
+	svc->start_time= (wake->now? wake->now : 1); // time != 0 hack
+	svc->state= SVC_STATE_UP;
+	svc->probe_ts= wake->now + svc->probe_interval;
+	svc->probe_failures= 0;
+	svc->probe_reported= false;
+	svc->heartbeat_ts= wake->now;
+	svc_notify_state(svc);
+}
+
 bool svc_do_fork(service_t *svc) {
-	pid_t pid;
+	pid_t pid= svc_spare_release(svc);
+	if (pid <= 0 && (pid= svc_fork(svc)) < 0)
+		return false;
+	svc_change_pid(svc, pid);
+	flight_record("fork", pid, 0, svc_get_name(svc), -1);
+	return true;
+}
+
+/** Fork and exec a new instance of the service.
+ * Returns its pid, or -1 on failure.
+ */
+pid_t svc_fork(service_t *svc) {
+	pid_t pid= -1;
 	int sockets[2]= { -1, -1 };
+	int fd_list[FD_SEND_MAX], fd_count;
 	controller_t *ctl= NULL;
 	bool want_ctl_read= svc->uses_control_socket || svc->uses_control_event;
 	bool want_ctl_write= svc->uses_control_socket || svc->uses_control_cmd;
 	
+	if (sim_enabled())
+		return sim_spawn(svc_get_name(svc));
+
 	// If this service uses the control.{socket,cmd,event} file handles,
 	// then we need to create a socket, and attach to a new controller
 	if (svc->uses_control_socket || svc->uses_control_event || svc->uses_control_cmd) {
 		// We need a controller object, of which there are a fixed number
 		// Do we have one?  And can we create the sockets?
 		if (!(ctl= ctl_alloc())) {
-			ctl_free(ctl);
-			ctl= NULL;
 			log_error("can't allocate controller object");
 			goto fail;
 		}
@@ -664,6 +1272,8 @@ bool svc_do_fork(service_t *svc) {
 			log_error("can't initialize controller");
 			goto fail;
 		}
+		// commands like service.heartbeat act on this service by default
+		ctl_set_service(ctl, svc);
 		
 		// If the service is only using one of control.event or control.cmd, then we
 		// shut down the unused direction so that it doesn't accidentally fill up
@@ -681,22 +1291,35 @@ bool svc_do_fork(service_t *svc) {
 		}
 	}
 	
-	if ((pid= fork()) < 0) {
+	svc_exec_fd_open(svc);
+	
+	if (spawner_enabled() && (fd_count= svc_get_fd_list(svc, NULL)) + (svc->exec_fd >= 0) <= FD_SEND_MAX) {
+		// The control.* FD objects resolve to the service's end of the socketpair
+		svc_set_control_fdnum(sockets[1]);
+		fd_count= svc_get_fd_list(svc, fd_list);
+		svc_set_control_fdnum(-1);
+		if (fd_count < 0)
+			goto fail;
+		if ((pid= spawner_spawn(fd_list, fd_count, svc->exec_fd, svc_get_argv(svc))) < 0) {
+			log_error("spawner failed: %s", strerror(errno));
+			// If the helper was given up on, fork the service ourselves
+			if (spawner_enabled())
+				goto fail;
+		}
+	}
+	if (pid < 0 && (pid= fork()) < 0) {
 		log_error("fork failed: %s", strerror(errno));
 		goto fail;
 	}
 	
 	// Are we the client?  perform exec
-	if (pid == 0) {
+	else if (pid == 0) {
 		if (sockets[0] >= 0)
 			close(sockets[0]);
-		if (sockets[1] >= 0) {
-			// Store the FD number of the client's socket in each of the FD objects
-			// which svc_do_exec might be looking at.
-			fd_set_fdnum(fd_by_name(STRSEG("control.socket")), sockets[1]);
-			fd_set_fdnum(fd_by_name(STRSEG("control.cmd")), sockets[1]);
-			fd_set_fdnum(fd_by_name(STRSEG("control.event")), sockets[1]);
-		}
+		// Store the FD number of the client's socket in each of the FD objects
+		// which svc_do_exec might be looking at.
+		if (sockets[1] >= 0)
+			svc_set_control_fdnum(sockets[1]);
 		svc_do_exec(svc);
 		// never returns
 		assert(0);
@@ -704,13 +1327,13 @@ bool svc_do_fork(service_t *svc) {
 	
 	if (sockets[1] >= 0)
 		close(sockets[1]);
+	svc_exec_fd_close(svc);
 
-	svc_change_pid(svc, pid);
-	
-	return true;
+	return pid;
 
 	fail: // cleanup based on what was initialized
 	
+	svc_exec_fd_close(svc);
 	if (ctl) {
 		ctl_dtor(ctl); // this closes sockets[0]
 		ctl_free(ctl);
@@ -719,6 +1342,295 @@ bool svc_do_fork(service_t *svc) {
 		close(sockets[0]);
 	if (sockets[1] >= 0)
 		close(sockets[1]);
+	return -1;
+}
+
+/** Start a second instance of a running service, to take over from the
+ * current one once it reports ready (or after grace seconds).  The current
+ * instance is then sent signum.  Fails with EBUSY if the service isn't up,
+ * a replacement is still in progress, or the instance retired by the last
+ * one hasn't exited yet (it has the only slot for its history).
+ */
+bool svc_replace(service_t *svc, int64_t grace, int signum) {
+	pid_t pid;
+	if (svc->state != SVC_STATE_UP || svc->shadow_pid || svc->retired_pid) {
+		errno= EBUSY;
+		return false;
+	}
+	if ((pid= svc_fork(svc)) < 0) {
+		errno= EAGAIN;
+		return false;
+	}
+	log_info("service \"%s\": replacement is pid %d", svc_get_name(svc), (int) pid);
+	svc->shadow_pid= pid;
+	svc->shadow_ready= false;
+	svc->replace_signal= signum;
+	svc->replace_deadline= wake->now + grace;
+	ctl_notify_svc_replace(NULL, svc_get_name(svc), "started", pid, "-");
+	svc_set_active(svc, true);
+	wake->next= wake->now;
+	return true;
+}
+
+/** Record that the replacement instance is ready to take over.
+ * Returns false if there is no replacement in progress.
+ */
+bool svc_handle_ready(service_t *svc) {
+	if (!svc->shadow_pid)
+		return false;
+	svc->shadow_ready= true;
+	svc_set_active(svc, true);
+	wake->next= wake->now;
+	return true;
+}
+
+/** Promote the shadow instance once it is ready or its grace period ends.
+ *
+ * Returns true if the service needs to remain in the active list to wake
+ * at the deadline.
+ */
+static bool svc_run_replace(service_t *svc) {
+	if (!svc->shadow_pid)
+		return false;
+	if (!svc->shadow_ready && svc->replace_deadline - wake->now > 0) {
+		wake_at_time(svc->replace_deadline);
+		return true;
+	}
+	svc_replace_promote(svc, true);
+	return false;
+}
+
+// Make the shadow instance the running one, retiring the current instance
+// if it is still running.
+static void svc_replace_promote(service_t *svc, bool retire) {
+	pid_t pid= svc->shadow_pid;
+	if (retire) {
+		svc->retired_pid= svc->pid;
+		svc->retired_start= svc->start_time;
+		if (sim_kill(svc->retired_pid, svc->replace_signal, false) < 0)
+			log_error("can't signal previous instance of \"%s\" (pid %d): %s",
+				svc_get_name(svc), (int) svc->retired_pid, strerror(errno));
+	}
+	else {
+		// remember how the previous run ended, as svc_handle_start does
+		svc->last_wait_status= svc->wait_status;
+		svc->last_kill_reason= svc->kill_reason;
+	}
+	svc_probe_cancel(svc);
+	svc->shadow_pid= 0;
+	svc->shadow_ready= false;
+	svc_change_pid(svc, pid);
+	svc->reap_time= 0;
+	svc->wait_status= -1;
+	svc->kill_reason= NULL;
+	svc->kill_deadline= 0;
+	ctl_notify_svc_replace(NULL, svc_get_name(svc), "promoted", pid, "-");
+	svc_set_up(svc);
+}
+
+/** Check whether a reaped pid was a shadow or retired instance of a service.
+ */
+bool svc_handle_replace_reaped(pid_t pid, int wstat, const struct rusage *ru) {
+	int i;
+	service_t *svc;
+	const char *signame;
+	char detail[32];
+	
+	for (i= 0; i < svc_list_count; i++) {
+		svc= svc_list[i];
+		if (svc->shadow_pid == pid) {
+			svc->shadow_pid= 0;
+			svc->shadow_ready= false;
+			if (WIFEXITED(wstat))
+				snprintf(detail, sizeof(detail), "exit %d", WEXITSTATUS(wstat));
+			else {
+				signame= sig_name_by_num(WTERMSIG(wstat));
+				snprintf(detail, sizeof(detail), "signal SIG%s", signame? signame : "-?");
+			}
+			log_warn("service \"%s\": replacement pid %d ended (%s) before taking over",
+				svc_get_name(svc), (int) pid, detail);
+			ctl_notify_svc_replace(NULL, svc_get_name(svc), "failed", pid, detail);
+			return true;
+		}
+		if (svc->retired_pid == pid) {
+			log_info("service \"%s\": previous instance pid %d exited", svc_get_name(svc), (int) pid);
+			svc_history_add(svc, svc->retired_start, pid, wstat, "replace", ru);
+			svc->retired_pid= 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Keep a standby process for the service, or stop doing so.
+ */
+void svc_set_spare(service_t *svc, bool enable) {
+	svc->spare= enable;
+	svc_spare_reset(svc);
+}
+
+bool svc_get_spare(service_t *svc) {
+	return svc->spare;
+}
+
+/** Pre-fork a standby process for the service.
+ *
+ * The standby waits on a pipe before exec, so that the next start of the
+ * service only needs to wake it rather than fork a copy of daemonproxy.
+ * It resolves the service's handles at the time it is forked, so it gets
+ * replaced whenever those might change.  Services which use a control
+ * handle don't get one, since their controller can't be set up in advance.
+ * Nor does anything while the --spawner helper is running, since the point
+ * of it is that daemonproxy itself doesn't fork.
+ */
+static void svc_spare_fork(service_t *svc) {
+	int go[2], fd_count, *fd_list, i, j;
+	bool keep;
+	pid_t pid;
+	ssize_t n;
+	char c;
+	struct stat st;
+
+	svc->spare_pending= false;
+	if (svc->spare_pid || svc->uses_control_socket || svc->uses_control_event || svc->uses_control_cmd
+		|| sim_enabled() || spawner_enabled())
+		return;
+	fd_count= svc_get_fd_list(svc, NULL);
+	fd_list= alloca((fd_count+1) * sizeof(int));
+	if (svc_get_fd_list(svc, fd_list) < 0)
+		return;
+	if (pipe2(go, O_CLOEXEC) < 0) {
+		log_error("can't create pipe for standby of \"%s\": %s", svc_get_name(svc), strerror(errno));
+		return;
+	}
+	svc_exec_fd_open(svc);
+	if (svc->exec_fd >= 0 && fstat(svc->exec_fd, &st) == 0) {
+		svc->spare_dev= st.st_dev;
+		svc->spare_ino= st.st_ino;
+	}
+	else
+		svc->spare_dev= svc->spare_ino= 0;
+	if ((pid= fork()) < 0) {
+		log_error("can't fork standby of \"%s\": %s", svc_get_name(svc), strerror(errno));
+		close(go[0]);
+		close(go[1]);
+		svc_exec_fd_close(svc);
+		return;
+	}
+	if (pid == 0) {
+		sig_reset_for_exec();
+		// Keep only what the exec needs, so the standby doesn't hold other
+		// handles (such as pipes or client connections) open while it waits
+		for (i= 0; i < FD_SETSIZE; i++) {
+			keep= (i == go[0] || i == svc->exec_fd || i == log_get_fd());
+			for (j= 0; j < fd_count && !keep; j++)
+				keep= (fd_list[j] == i);
+			if (!keep)
+				close(i);
+		}
+		// EOF means the standby was discarded, or daemonproxy is gone
+		do n= read(go[0], &c, 1);
+		while (n < 0 && errno == EINTR);
+		if (n != 1)
+			_exit(0);
+		close(go[0]);
+		svc_exec_fds_argv(fd_list, fd_count, svc->exec_fd, (char*) svc_get_argv(svc));
+		// never returns
+	}
+	close(go[0]);
+	svc_exec_fd_close(svc);
+	svc->spare_pid= pid;
+	svc->spare_go_fd= go[1];
+	svc_spare_count++;
+	log_debug("service \"%s\": standby is pid %d", svc_get_name(svc), (int) pid);
+}
+
+// Let the standby process exec.  Returns its pid, or 0 if there is none.
+static pid_t svc_spare_release(service_t *svc) {
+	pid_t pid;
+	int fd;
+	struct stat st;
+
+	if (!(pid= svc->spare_pid))
+		return 0;
+	// The standby holds the file it was forked with.  If the name now refers
+	// to another file (such as after a package upgrade), fork a fresh process.
+	if ((fd= svc_exec_open(svc)) < 0 || fstat(fd, &st) < 0)
+		st.st_dev= st.st_ino= 0;
+	if (fd >= 0)
+		close(fd);
+	if (st.st_dev != svc->spare_dev || st.st_ino != svc->spare_ino) {
+		log_debug("service \"%s\": executable changed since the standby was forked", svc_get_name(svc));
+		svc_spare_reset(svc);
+		return 0;
+	}
+	if (write(svc->spare_go_fd, "", 1) != 1) {
+		log_error("can't wake standby of \"%s\": %s", svc_get_name(svc), strerror(errno));
+		svc_spare_discard(svc);
+		return 0;
+	}
+	log_debug("service \"%s\": using standby pid %d", svc_get_name(svc), (int) pid);
+	close(svc->spare_go_fd);
+	svc->spare_go_fd= -1;
+	svc->spare_pid= 0;
+	svc_spare_count--;
+	return pid;
+}
+
+// Close the standby's pipe, which makes it exit
+static void svc_spare_discard(service_t *svc) {
+	if (!svc->spare_pid)
+		return;
+	log_debug("service \"%s\": discarding standby pid %d", svc_get_name(svc), (int) svc->spare_pid);
+	close(svc->spare_go_fd);
+	svc->spare_go_fd= -1;
+	svc->spare_pid= 0;
+	svc_spare_count--;
+}
+
+// Discard the standby, and fork a fresh one if the service is up
+static void svc_spare_reset(service_t *svc) {
+	svc_spare_discard(svc);
+	svc->spare_pending= svc->spare;
+	if (svc->spare && svc->state == SVC_STATE_UP) {
+		svc_set_active(svc, true);
+		wake->next= wake->now;
+	}
+}
+
+/** Replace the standby processes of services which name the handle
+ * fd_name, because it has been closed or reassigned.  (A standby closes
+ * every descriptor its service doesn't name, so no others can hold it.)
+ */
+void svc_reset_spares(strseg_t fd_name) {
+	int i;
+	strseg_t fd_spec, name;
+	for (i= 0; i < svc_list_count && svc_spare_count > 0; i++) {
+		if (!svc_list[i]->spare_pid)
+			continue;
+		fd_spec= STRSEG(svc_get_fds(svc_list[i]));
+		while (strseg_tok_next(&fd_spec, '\t', &name))
+			if (0 == strseg_cmp(name, fd_name)) {
+				svc_spare_reset(svc_list[i]);
+				break;
+			}
+	}
+}
+
+/** Check whether a reaped pid was the standby process of a service.
+ * A standby which dies before it is used is not replaced until the
+ * service starts again.
+ */
+bool svc_handle_spare_reaped(pid_t pid, int wstat) {
+	int i;
+	for (i= 0; i < svc_list_count && svc_spare_count > 0; i++)
+		if (svc_list[i]->spare_pid == pid) {
+			log_warn("service \"%s\": standby pid %d exited (wait status 0x%X)",
+				svc_get_name(svc_list[i]), (int) pid, wstat);
+			svc_list[i]->spare_pending= false;
+			svc_spare_discard(svc_list[i]);
+			return true;
+		}
 	return false;
 }
 
@@ -726,42 +1638,60 @@ bool svc_do_fork(service_t *svc) {
  * This sets up FDs, and calls exec() with the argv for the service.
  */
 void svc_do_exec(service_t *svc) {
-	int fd_count, arg_count, i;
-	int *fd_list= NULL;
-	fd_t *fd;
-	char **argv, *arg_spec, *p;
-	strseg_t fd_spec, tmp, fd_name;
+	int fd_count;
+	int *fd_list;
 
 	// clear signal mask and handlers
 	log_trace("resetting signal mask");
 	sig_reset_for_exec();
 	
+	fd_count= svc_get_fd_list(svc, NULL);
+	fd_list= alloca((fd_count+1) * sizeof(int));
+	if (svc_get_fd_list(svc, fd_list) < 0)
+		abort();
+	
+	// just modify the buffer in the service object, since we're execing soon
+	svc_exec_fds_argv(fd_list, fd_count, svc->exec_fd, (char*) svc_get_argv(svc));
+}
+
+/** Resolve the service's file descriptor names to descriptor numbers.
+ * A name of '-' resolves to -1 (closed).  Pass NULL to just count them.
+ * Returns the count, or -1 if a name doesn't exist.
+ */
+int svc_get_fd_list(service_t *svc, int *fd_list) {
+	int fd_count= 0;
+	fd_t *fd;
+	strseg_t fd_spec, fd_name;
+
 	fd_spec.data= svc_get_fds(svc);
 	fd_spec.len= strlen(fd_spec.data);
-	fd_count= 0;
-	if (fd_spec.len) {
-		// count our file descriptors, to allocate buffer
-		tmp= fd_spec;
-		while (strseg_tok_next(&tmp, '\t', &fd_name))
+	while (strseg_tok_next(&fd_spec, '\t', &fd_name)) {
+		if (fd_name.len <= 0)
+			log_warn("ignoring zero-length file descriptor name");
+		else if (!fd_list)
 			fd_count++;
-		fd_list= alloca(fd_count);
-		// now iterate again to resolve them from name to number
-		fd_count= 0;
-		tmp= fd_spec;
-		while (strseg_tok_next(&tmp, '\t', &fd_name)) {
-			if (fd_name.len <= 0)
-				log_warn("ignoring zero-length file descriptor name");
-			else if (fd_name.len == 1 && fd_name.data[0] == '-')
-				fd_list[fd_count++]= -1; // dash means "closed"
-			else if ((fd= fd_by_name(fd_name)))
-				fd_list[fd_count++]= fd_get_fdnum(fd);
-			else {
-				log_error("file descriptor \"%.*s\" does not exist", fd_name.len, fd_name.data);
-				abort();
-			}
+		else if (fd_name.len == 1 && fd_name.data[0] == '-')
+			fd_list[fd_count++]= -1; // dash means "closed"
+		else if ((fd= fd_by_name(fd_name)))
+			fd_list[fd_count++]= fd_get_fdnum(fd);
+		else {
+			log_error("file descriptor \"%.*s\" does not exist", fd_name.len, fd_name.data);
+			return -1;
 		}
 	}
+	return fd_count;
+}
+
+/** Move the descriptors in fd_list to 0..fd_count-1, close all others,
+ * and exec the TSV argument list.  If exec_fd is not -1, it is the handle
+ * of the executable to run.  Never returns.
+ */
+void svc_exec_fds_argv(int *fd_list, int fd_count, int exec_fd, char *arg_spec) {
+	int i;
 	
+	// Keep the executable's handle out of the way too
+	if (exec_fd >= 0 && exec_fd < fd_count)
+		exec_fd= fcntl(exec_fd, F_DUPFD_CLOEXEC, fd_count);
 	// Now move them into correct places
 	// But first, we need to make sure all the file descriptors we're about to copy
 	//   are out of the way...
@@ -789,16 +1719,26 @@ void svc_do_exec(service_t *svc) {
 		else close(i);
 	}
 	// close all fd we aren't keeping
-	while (i < FD_SETSIZE) close(i++);
+	for (; i < FD_SETSIZE; i++)
+		if (i != exec_fd)
+			close(i);
 	
-	// just modify the buffer in the service object, since we're execing soon
-	arg_spec= (char*) svc_get_argv(svc);
+	svc_exec_argv(exec_fd, arg_spec);
+}
+
+/** Convert a TSV argument list into argv[] (modifying the buffer in place)
+ * and exec it, through exec_fd if it is not -1.  Never returns.
+ */
+void svc_exec_argv(int exec_fd, char *arg_spec) {
+	int arg_count, i;
+	char **argv, *p;
+
 	// convert argv into pointers
 	// count, allocate, then populate
 	for (arg_count= 1, p= arg_spec; *p; p++)
 		if (*p == '\t')
 			arg_count++;
-	argv= alloca(arg_count+1);
+	argv= alloca((arg_count+1) * sizeof(char*));
 	// then populate
 	i= 0;
 	for (argv[0]= p= arg_spec; *p; p++)
@@ -808,14 +1748,549 @@ void svc_do_exec(service_t *svc) {
 		}
 	argv[++i]= NULL;
 	
+	// fexecve fails for scripts, since the interpreter can't open a
+	// close-on-exec handle, so fall back to the PATH search.
+	if (exec_fd >= 0)
+		fexecve(exec_fd, argv, environ);
 	execvp(argv[0], argv);
 	log_error("exec(%s, ...) failed: %s", argv[0], strerror(errno));
 	_exit(EXIT_INVALID_ENVIRONMENT);
 }
 	
+/** Check the watchdog of a service that is up.
+ *
+ * Returns true if the service needs to remain in the active list to wake
+ * at the watchdog deadline.
+ */
+static bool svc_run_watchdog(service_t *svc) {
+	int64_t deadline;
+
+	if (!svc->watchdog_timeout || svc->restart_pending)
+		return false;
+
+	deadline= svc->heartbeat_ts + svc->watchdog_timeout;
+	if (deadline - wake->now > 0) {
+		wake_at_time(deadline);
+		return true;
+	}
+	log_warn("service \"%s\" missed its heartbeat for %d seconds, restarting",
+		svc_get_name(svc), (int)((wake->now - svc->heartbeat_ts) >> 32));
+	svc_kill(svc, svc->watchdog_signal, svc->watchdog_group, "watchdog", true);
+	return false;
+}
+
+/** Enforce the maximum runtime of a service that is up.
+ *
+ * Returns true if the service needs to remain in the active list to wake
+ * when its time runs out.
+ */
+static bool svc_run_max_runtime(service_t *svc) {
+	int64_t deadline;
+
+	// Only signal once; a kill from any monitor is already on its way
+	if (!svc->max_runtime || svc->kill_reason)
+		return false;
+
+	deadline= svc->start_time + svc->max_runtime;
+	if (deadline - wake->now > 0) {
+		wake_at_time(deadline);
+		return true;
+	}
+	log_warn("service \"%s\" exceeded its maximum runtime of %d seconds",
+		svc_get_name(svc), (int)(svc->max_runtime >> 32));
+	svc_kill(svc, svc->max_runtime_signal, svc->max_runtime_group, "timeout", false);
+	return false;
+}
+
+/** Escalate to SIGKILL if the service is still up SERVICE_KILL_GRACE after
+ * svc_kill signalled it.
+ *
+ * Returns true if the service needs to remain in the active list to wake
+ * at the deadline.
+ */
+static bool svc_run_kill_grace(service_t *svc) {
+	if (!svc->kill_deadline)
+		return false;
+	if (svc->kill_deadline - wake->now > 0) {
+		wake_at_time(svc->kill_deadline);
+		return true;
+	}
+	svc->kill_deadline= 0;
+	log_warn("service \"%s\" still running %d seconds after %s signal, sending SIGKILL",
+		svc_get_name(svc), (int)(SERVICE_KILL_GRACE >> 32), svc->kill_reason? svc->kill_reason : "its");
+	if (!svc_send_signal(svc, SIGKILL, svc->kill_group))
+		log_error("can't kill service \"%s\" (%s %d): %s", svc_get_name(svc),
+			svc->kill_group? "pgid":"pid", (int) svc->pid, strerror(errno));
+	return false;
+}
+
+/** Parse one field of a cron expression into a bitmask.
+ *
+ * The field is a comma-separated list of '*', 'N', or 'N-M', each optionally
+ * followed by '/STEP'.  Values must be within min..max.
+ */
+static bool svc_cron_parse_field(strseg_t field, int min, int max, uint64_t *bits_out, bool *any_out) {
+	strseg_t item, step_str;
+	int64_t lo, hi, step, i;
+	uint64_t bits= 0;
+
+	*any_out= false;
+	while (strseg_tok_next(&field, ',', &item)) {
+		step= 1;
+		if (strseg_split_1(&item, '/', &step_str)) {
+			if (!strseg_atoi(&step_str, &step) || step_str.len || step < 1)
+				return false;
+		}
+		if (item.len == 1 && item.data[0] == '*') {
+			lo= min;
+			hi= max;
+			if (step == 1)
+				*any_out= true;
+		}
+		else {
+			if (!strseg_atoi(&item, &lo))
+				return false;
+			hi= lo;
+			if (item.len && item.data[0] == '-') {
+				item.data++;
+				item.len--;
+				if (!strseg_atoi(&item, &hi))
+					return false;
+			}
+			if (item.len || lo < min || hi > max || lo > hi)
+				return false;
+		}
+		for (i= lo; i <= hi; i+= step)
+			bits |= 1ULL << i;
+	}
+	*bits_out= bits;
+	return true;
+}
+
+/** Parse a cron expression "MIN HOUR DOM MON DOW" or one of the shortcuts
+ * '@hourly', '@daily', '@weekly', '@monthly', '@yearly'.
+ */
+static bool svc_cron_parse(strseg_t spec, svc_cron_t *cron) {
+	strseg_t field[5];
+	uint64_t bits;
+	bool dom_any, dow_any, any;
+	int i;
+
+	if      (0 == strseg_cmp(spec, STRSEG("@hourly")))  spec= STRSEG("0 * * * *");
+	else if (0 == strseg_cmp(spec, STRSEG("@daily")))   spec= STRSEG("0 0 * * *");
+	else if (0 == strseg_cmp(spec, STRSEG("@weekly")))  spec= STRSEG("0 0 * * 0");
+	else if (0 == strseg_cmp(spec, STRSEG("@monthly"))) spec= STRSEG("0 0 1 * *");
+	else if (0 == strseg_cmp(spec, STRSEG("@yearly")))  spec= STRSEG("0 0 1 1 *");
+
+	for (i= 0; i < 5; i++)
+		if (!strseg_tok_next(&spec, ' ', &field[i]) || !field[i].len)
+			return false;
+	if (spec.len >= 0)
+		return false;
+
+	memset(cron, 0, sizeof(*cron));
+	if (!svc_cron_parse_field(field[0], 0, 59, &bits, &any)) return false;
+	cron->minutes= bits;
+	if (!svc_cron_parse_field(field[1], 0, 23, &bits, &any)) return false;
+	cron->hours= (uint32_t) bits;
+	if (!svc_cron_parse_field(field[2], 1, 31, &bits, &dom_any)) return false;
+	cron->days= (uint32_t) bits;
+	if (!svc_cron_parse_field(field[3], 1, 12, &bits, &any)) return false;
+	cron->months= (uint16_t) bits;
+	// 7 is also Sunday
+	if (!svc_cron_parse_field(field[4], 0, 7, &bits, &dow_any)) return false;
+	cron->weekdays= (uint8_t) (bits | (bits >> 7));
+	cron->dom_any= dom_any;
+	cron->dow_any= dow_any;
+	return true;
+}
+
+/** Read the wall clock that cron schedules follow.  When simulating, the
+ * virtual clock stands in for it.
+ */
+static void svc_cron_clock(struct timespec *now) {
+	if (sim_enabled()) {
+		now->tv_sec= (time_t)(sim_time() >> 32);
+		now->tv_nsec= (long)(((sim_time() & 0xFFFFFFFFLL) * 1000000000) >> 32);
+	}
+	else if (clock_gettime(CLOCK_REALTIME, now) != 0) {
+		now->tv_sec= time(NULL);
+		now->tv_nsec= 0;
+	}
+}
+
+/** Return the first wall-clock minute after 'after' (in local time) which
+ * matches the cron schedule, or 0 if none matches in the next few years.
+ */
+static time_t svc_cron_next(const svc_cron_t *cron, time_t after) {
+	struct tm tm;
+	time_t t= after - (after % 60) + 60;
+	int limit_year;
+	bool dom_match, dow_match, day_match;
+
+	localtime_r(&t, &tm);
+	limit_year= tm.tm_year + 5;
+	while (tm.tm_year < limit_year) {
+		tm.tm_sec= 0;
+		if (!(cron->months & (1U << (tm.tm_mon + 1)))) {
+			tm.tm_mon++;
+			tm.tm_mday= 1;
+			tm.tm_hour= tm.tm_min= 0;
+		}
+		else {
+			dom_match= cron->days & (1U << tm.tm_mday);
+			dow_match= cron->weekdays & (1U << tm.tm_wday);
+			day_match= (cron->dom_any || cron->dow_any)?
+				(dom_match && dow_match) : (dom_match || dow_match);
+			if (!day_match) {
+				tm.tm_mday++;
+				tm.tm_hour= tm.tm_min= 0;
+			}
+			else if (!(cron->hours & (1U << tm.tm_hour))) {
+				tm.tm_hour++;
+				tm.tm_min= 0;
+			}
+			else if (!(cron->minutes & (1ULL << tm.tm_min)))
+				tm.tm_min++;
+			else
+				return t;
+		}
+		// normalize, letting mktime deal with month lengths and DST
+		tm.tm_isdst= -1;
+		t= mktime(&tm);
+		localtime_r(&t, &tm);
+	}
+	return 0;
+}
+
+/** Check the cron trigger of a service, starting it if the scheduled time
+ * has arrived and it is down.  A run that is still going when the next
+ * trigger arrives causes that trigger to be skipped.
+ *
+ * Returns true if the service needs to remain in the active list to wake
+ * at the next trigger.
+ */
+static bool svc_run_cron(service_t *svc) {
+	struct timespec now;
+	int64_t remaining;
+
+	if (!svc->cron)
+		return false;
+
+	svc_cron_clock(&now);
+	if (svc->cron_next && now.tv_sec >= svc->cron_next) {
+		if (svc->state == SVC_STATE_DOWN)
+			svc_handle_start(svc, wake->now);
+		else
+			log_debug("service \"%s\" still running at cron trigger", svc_get_name(svc));
+		svc->cron_next= svc_cron_next(&svc->cron_sched, now.tv_sec);
+	}
+	if (!svc->cron_next) {
+		log_warn("cron schedule for service \"%s\" never matches", svc_get_name(svc));
+		svc->cron= false;
+		return false;
+	}
+
+	// Map the wall-clock time onto the monotonic clock, but re-check
+	// periodically in case the wall clock gets adjusted.
+	remaining= ((int64_t)(svc->cron_next - now.tv_sec) << 32)
+		- (int64_t)((((uint64_t) now.tv_nsec) << 32) / 1000000000);
+	if (remaining > CRON_RECHECK_INTERVAL)
+		remaining= CRON_RECHECK_INTERVAL;
+	wake_at_time(wake->now + remaining);
+	return true;
+}
+
+/** Return the type-specific arguments of the probe spec (after TYPE)
+ */
+static strseg_t svc_probe_args(service_t *svc) {
+	strseg_t spec= STRSEG(svc_get_probe(svc));
+	int i;
+	for (i= 0; i < 5; i++)
+		strseg_tok_next(&spec, '\t', NULL);
+	return spec;
+}
+
+/** Run the health-check probe of a service that is up.
+ *
+ * Returns true if the service needs to remain in the active list, either
+ * because a probe is in progress or because the next one is scheduled.
+ */
+static bool svc_run_probe(service_t *svc) {
+	int err;
+	socklen_t len;
+	char detail[64];
+
+	if (svc->probe_type == SVC_PROBE_NONE || svc->restart_pending)
+		return false;
+
+	if (svc->probe_running) {
+		// connect probe completes when the socket becomes writeable
+		if (svc->probe_type == SVC_PROBE_CONNECT && woke_on_writeable(svc->probe_fd)) {
+			len= sizeof(err);
+			if (getsockopt(svc->probe_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+				err= errno;
+			snprintf(detail, sizeof(detail), "connect: %s", err? strerror(err) : "ok");
+			svc_probe_cancel(svc);
+			svc_probe_result(svc, !err, detail);
+		}
+		// exec probes are completed by svc_handle_probe_reaped, else time out
+		else if (svc->probe_ts - wake->now <= 0) {
+			svc_probe_cancel(svc);
+			svc_probe_result(svc, false, "timeout");
+		}
+	}
+	else if (svc->probe_ts - wake->now <= 0) {
+		// If all probe slots are busy, wait until svc_probe_cancel frees one.
+		if (!svc_probe_start(svc))
+			return true;
+	}
+
+	// The result might have caused us to kill the service
+	if (svc->restart_pending)
+		return false;
+
+	if (svc->probe_running && svc->probe_type == SVC_PROBE_CONNECT)
+		wake_on_writeable(svc->probe_fd);
+	wake_at_time(svc->probe_ts);
+	return true;
+}
+
+/** Begin a health-check probe.
+ *
+ * File probes complete immediately.  Exec and connect probes take a slot
+ * (limited to PROBE_MAX_CONCURRENT) and complete on a later iteration.
+ * Returns false if no slot is available.
+ */
+static bool svc_probe_start(service_t *svc) {
+	int i, slot, sock= -1;
+	pid_t pid;
+	fd_t *fd;
+	strseg_t args, path, max_age_str;
+	int64_t max_age, age;
+	struct stat st;
+	struct sockaddr_storage addr;
+	socklen_t addrlen= sizeof(addr);
+	char detail[64];
+
+	args= svc_probe_args(svc);
+	if (svc->probe_type == SVC_PROBE_FILE) {
+		strseg_tok_next(&args, '\t', &path);
+		strseg_tok_next(&args, '\t', &max_age_str);
+		strseg_atoi(&max_age_str, &max_age);
+		// path is followed by a tab, so terminate it in a temp buffer
+		char *pathbuf= alloca(path.len + 1);
+		memcpy(pathbuf, path.data, path.len);
+		pathbuf[path.len]= '\0';
+		if (stat(pathbuf, &st) < 0) {
+			snprintf(detail, sizeof(detail), "stat: %s", strerror(errno));
+			svc_probe_result(svc, false, detail);
+		}
+		else {
+			age= time(NULL) - st.st_mtime;
+			snprintf(detail, sizeof(detail), "age %lld", (long long) age);
+			svc_probe_result(svc, age <= max_age, detail);
+		}
+		return true;
+	}
+
+	for (slot= 0; slot < PROBE_MAX_CONCURRENT; slot++)
+		if (!svc_probe_slot[slot])
+			break;
+	if (slot >= PROBE_MAX_CONCURRENT) {
+		log_trace("no free probe slot for service \"%s\"", svc_get_name(svc));
+		return false;
+	}
+
+	if (svc->probe_type == SVC_PROBE_EXEC) {
+		if ((pid= sim_enabled()? sim_spawn(NULL) : fork()) < 0) {
+			snprintf(detail, sizeof(detail), "fork: %s", strerror(errno));
+			svc_probe_result(svc, false, detail);
+			return true;
+		}
+		if (pid == 0) {
+			sig_reset_for_exec();
+			i= log_get_fd();
+			if (dup2(fd_dev_null, 0) < 0 || dup2(fd_dev_null, 1) < 0
+				|| dup2(i >= 0? i : fd_dev_null, 2) < 0)
+				_exit(EXIT_INVALID_ENVIRONMENT);
+			for (i= 3; i < FD_SETSIZE; i++)
+				close(i);
+			// just modify the buffer in the service object, since we're execing soon
+			svc_exec_argv(-1, (char*) args.data);
+		}
+		log_debug("probe for service \"%s\" is pid %d", svc_get_name(svc), (int) pid);
+		svc->probe_pid= pid;
+	}
+	else {
+		strseg_tok_next(&args, '\t', &path);
+		if (!(fd= fd_by_name(path))) {
+			snprintf(detail, sizeof(detail), "no fd \"%.*s\"", path.len, path.data);
+			svc_probe_result(svc, false, detail);
+			return true;
+		}
+		// connect to the address the socket is bound to, using loopback for wildcards
+		memset(&addr, 0, sizeof(addr));
+		if (getsockname(fd_get_fdnum(fd), (struct sockaddr*) &addr, &addrlen) < 0) {
+			snprintf(detail, sizeof(detail), "getsockname: %s", strerror(errno));
+			svc_probe_result(svc, false, detail);
+			return true;
+		}
+		if (addr.ss_family == AF_INET
+			&& ((struct sockaddr_in*)&addr)->sin_addr.s_addr == htonl(INADDR_ANY))
+			((struct sockaddr_in*)&addr)->sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+		#ifdef AF_INET6
+		if (addr.ss_family == AF_INET6
+			&& 0 == memcmp(&((struct sockaddr_in6*)&addr)->sin6_addr, &in6addr_any, sizeof(in6addr_any)))
+			((struct sockaddr_in6*)&addr)->sin6_addr= in6addr_loopback;
+		#endif
+		if ((sock= socket(addr.ss_family, SOCK_STREAM, 0)) < 0
+			|| !fd_set_nonblock(sock)
+			|| fcntl(sock, F_SETFD, FD_CLOEXEC) < 0
+			|| (connect(sock, (struct sockaddr*) &addr, addrlen) < 0 && errno != EINPROGRESS)
+		) {
+			snprintf(detail, sizeof(detail), "connect: %s", strerror(errno));
+			if (sock >= 0) close(sock);
+			svc_probe_result(svc, false, detail);
+			return true;
+		}
+		svc->probe_fd= sock;
+	}
+	svc_probe_slot[slot]= svc;
+	svc->probe_running= true;
+	svc->probe_ts= wake->now + svc->probe_timeout;
+	return true;
+}
+
+/** Abandon any probe in progress, and free its slot.
+ */
+static void svc_probe_cancel(service_t *svc) {
+	int i;
+	if (!svc->probe_running)
+		return;
+	if (svc->probe_type == SVC_PROBE_EXEC && svc->probe_pid > 0) {
+		// The zombie gets reaped by the main loop, and ignored.
+		sim_kill(svc->probe_pid, SIGKILL, false);
+		svc->probe_pid= 0;
+	}
+	if (svc->probe_type == SVC_PROBE_CONNECT && svc->probe_fd >= 0) {
+		close(svc->probe_fd);
+		svc->probe_fd= -1;
+	}
+	for (i= 0; i < PROBE_MAX_CONCURRENT; i++)
+		if (svc_probe_slot[i] == svc)
+			svc_probe_slot[i]= NULL;
+	svc->probe_running= false;
+	// another service might be waiting for the slot
+	wake->next= wake->now;
+}
+
+/** Record the outcome of a probe, announce it, and take action.
+ *
+ * Successes are only reported when the status changes, but every failure is
+ * reported along with the count of consecutive failures.  When the count
+ * reaches the threshold, the status becomes "unhealthy" and the service is
+ * restarted if the probe has the "restart" flag.
+ */
+static void svc_probe_result(service_t *svc, bool ok, const char *detail) {
+	svc->probe_ts= wake->now + svc->probe_interval;
+	if (ok) {
+		if (svc->probe_failures || !svc->probe_reported)
+			ctl_notify_svc_health(NULL, svc_get_name(svc), "ok", 0, detail);
+		svc->probe_failures= 0;
+		svc->probe_reported= true;
+		return;
+	}
+	svc->probe_failures++;
+	svc->probe_reported= false;
+	if (svc->probe_failures < svc->probe_threshold) {
+		ctl_notify_svc_health(NULL, svc_get_name(svc), "fail", svc->probe_failures, detail);
+		return;
+	}
+	ctl_notify_svc_health(NULL, svc_get_name(svc), "unhealthy", svc->probe_failures, detail);
+	if (svc->probe_restart && svc->pid > 0) {
+		log_warn("service \"%s\" failed %d health probes, restarting", svc_get_name(svc), svc->probe_failures);
+		svc_kill(svc, SIGTERM, svc->probe_group, "probe", true);
+		svc->probe_failures= 0;
+	}
+}
+
+/** Check whether a reaped pid was an exec probe, and record its result.
+ *
+ * Returns false if the pid is not a probe in progress.
+ */
+bool svc_handle_probe_reaped(pid_t pid, int wstat) {
+	int i;
+	service_t *svc;
+	const char *signame;
+	char detail[32];
+	
+	for (i= 0; i < PROBE_MAX_CONCURRENT; i++) {
+		svc= svc_probe_slot[i];
+		if (svc && svc->probe_type == SVC_PROBE_EXEC && svc->probe_pid == pid) {
+			svc->probe_pid= 0;
+			svc_probe_cancel(svc);
+			if (WIFEXITED(wstat))
+				snprintf(detail, sizeof(detail), "exit %d", WEXITSTATUS(wstat));
+			else {
+				signame= sig_name_by_num(WTERMSIG(wstat));
+				snprintf(detail, sizeof(detail), "signal SIG%s", signame? signame : "-?");
+			}
+			svc_probe_result(svc, WIFEXITED(wstat) && WEXITSTATUS(wstat) == 0, detail);
+			svc_set_active(svc, true);
+			return true;
+		}
+	}
+	return false;
+}
+
 void svc_notify_state(service_t *svc) {
+	static const char * const flight_event[]= { "state.undef", "state.down", "state.start", "state.up", "state.reaped" };
 	log_trace("service %s state = %d", svc_get_name(svc), svc->state);
-	ctl_notify_svc_state(NULL, svc->name.data, svc->start_time, svc->reap_time, svc->wait_status, svc->pid);
+	flight_record(flight_event[svc->state], svc->pid, 0, svc_get_name(svc), -1);
+	state_table_publish(svc->state_table_slot, svc);
+	if (!opt_coalesce_events)
+		ctl_notify_svc_state(NULL, svc);
+	else {
+		// Queue the service, and announce only its final state for this iteration
+		if (!svc->state_dirty) {
+			svc->state_dirty= true;
+			svc->dirty_next= NULL;
+			*svc_dirty_tail= svc;
+			svc_dirty_tail= &svc->dirty_next;
+		}
+		wake->next= wake->now;
+	}
+	// Rules go last, so that the event comes before anything they cause.
+	// For a reaped service, svc_run calls them once it is down, so that a
+	// rule can start it again.
+	if (svc->state != SVC_STATE_REAPED)
+		rule_notify_svc_state(svc);
+}
+
+/** Announce the current state of every service queued by svc_notify_state.
+ * Called once per main loop iteration; does nothing unless events are
+ * being coalesced.
+ */
+void svc_flush_state_events() {
+	service_t *svc;
+	while ((svc= svc_dirty_list)) {
+		svc_dirty_list= svc->dirty_next;
+		svc->state_dirty= false;
+		ctl_notify_svc_state(NULL, svc);
+	}
+	svc_dirty_tail= &svc_dirty_list;
+}
+
+static void svc_clear_dirty(service_t *svc) {
+	service_t **ptr;
+	if (!svc->state_dirty)
+		return;
+	for (ptr= &svc_dirty_list; *ptr != svc; ptr= &(*ptr)->dirty_next);
+	*ptr= svc->dirty_next;
+	if (svc_dirty_tail == &svc->dirty_next)
+		svc_dirty_tail= ptr;
+	svc->state_dirty= false;
 }
 
 service_t *svc_by_name(strseg_t name, bool create) {
@@ -870,13 +2345,48 @@ service_t * svc_iter_next(service_t *svc, const char *from_name) {
 	return node? (service_t *) node->Object : NULL;
 }
 
+/** Check the syntax of a service selector: a service name, "*" for every
+ * service, or "tag:TAG" for the services with TAG among their tags.
+ */
+bool svc_check_selector(strseg_t selector) {
+	if (selector.len == 1 && selector.data[0] == '*')
+		return true;
+	if (selector.len > 4 && 0 == memcmp(selector.data, "tag:", 4))
+		return selector.len <= NAME_LEN_MAX;
+	return svc_check_name(selector);
+}
+
+bool svc_selector_match(const char *selector, service_t *svc) {
+	strseg_t tags, tag;
+	int len;
+	if (0 == strncmp(selector, "tag:", 4)) {
+		len= strlen(selector + 4);
+		tags= STRSEG(svc_get_tags(svc));
+		while (strseg_tok_next(&tags, '\t', &tag))
+			if (tag.len == len && 0 == memcmp(tag.data, selector + 4, len))
+				return true;
+		return false;
+	}
+	return 0 == strcmp(selector, "*") || 0 == strcmp(selector, svc_get_name(svc));
+}
+
+/** Iterate the services matched by a selector, starting from NULL.
+ * A plain service name is looked up directly rather than scanned for.
+ */
+service_t * svc_select_next(const char *selector, service_t *prev) {
+	if (strcmp(selector, "*") && strncmp(selector, "tag:", 4))
+		return prev? NULL : svc_by_name(STRSEG(selector), false);
+	while ((prev= svc_iter_next(prev, prev? NULL : "")) && !svc_selector_match(selector, prev));
+	return prev;
+}
+
 #ifndef NDEBUG
 void svc_check(service_t *svc) {
 	assert(svc != NULL);
 
 	assert(svc->name.len > 0);
-	assert(svc->name.len < NAME_BUF_SIZE);
-	assert(svc->name.data == svc->name_buf);
+	assert(svc->name.len <= NAME_LEN_MAX);
+	assert(svc->name.len == name_len(svc->name.data));
 	assert(svc->name.data[svc->name.len] == 0);
 
 	assert(svc->vars.len >= 0);
@@ -885,7 +2395,7 @@ void svc_check(service_t *svc) {
 		assert(svc->vars.data[svc->vars.len-1] == 0);
 	}
 	if (svc_pool) {
-		assert(svc->name.data + svc->name.len + 1 == svc->vars.data);
+		assert((char*) (svc + 1) == svc->vars.data);
 		assert( ((char*)svc) + svc_pool_size_each >= svc->vars.data + svc->vars.len );
 	}
 
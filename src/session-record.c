@@ -0,0 +1,83 @@
+/* session-record.c - record of controller traffic, for replay
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* With --record-sessions, every controller's traffic is appended to a file
+ * so that scripts/replay_session.pl can play it back against a test
+ * daemonproxy.  Each line is
+ *
+ *   SECONDS  SESSION  TYPE  [DATA]
+ *
+ * separated by tabs, where SECONDS is the time since daemonproxy started
+ * (with microseconds) and SESSION numbers each controller from 1 in the
+ * order they were created.  TYPE is 'open' or 'close' for the controller's
+ * lifetime, 'cmd' with the text of each command as it is run, 'read' with
+ * the number of bytes the controller consumed from its event stream, and
+ * 'overflow' when its output overflowed.  The first line is a comment
+ * naming the format version.
+ *
+ * The file is written with plain blocking writes; it should be on a local
+ * filesystem.  If a write fails, recording stops.
+ */
+
+#define SESSION_RECORD_VERSION 1
+
+static int     record_fd= -1;
+static int64_t record_start_ts;
+static int     record_session_count= 0;
+
+/** Create (or truncate) the record file, and begin recording.
+ */
+bool session_record_open(const char *path) {
+	char header[64];
+	int n;
+	if ((record_fd= open(path, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0600)) < 0) {
+		log_error("open(%s): %s", path, strerror(errno));
+		return false;
+	}
+	record_start_ts= wake->now;
+	n= snprintf(header, sizeof(header), "# daemonproxy session record %d\n", SESSION_RECORD_VERSION);
+	if (write(record_fd, header, n) != n) {
+		log_error("write(%s): %s", path, strerror(errno));
+		close(record_fd);
+		record_fd= -1;
+		return false;
+	}
+	return true;
+}
+
+/** Allocate the number of a new controller session, and record its start.
+ * Returns 0 if not recording.
+ */
+int session_record_begin() {
+	if (record_fd < 0)
+		return 0;
+	session_record(++record_session_count, "open", "", 0);
+	return record_session_count;
+}
+
+/** Append one line to the record.  Does nothing for session 0.
+ */
+void session_record(int session, const char *type, const char *data, int len) {
+	char buf[CONTROLLER_RECV_BUF_SIZE + 64];
+	int64_t t= wake->now - record_start_ts;
+	int n;
+	if (record_fd < 0 || !session)
+		return;
+	n= snprintf(buf, sizeof(buf), "%lld.%06d\t%d\t%s%s%.*s\n",
+		(long long)(t >> 32), (int)(((t & 0xFFFFFFFFLL) * 1000000) >> 32),
+		session, type, len? "\t" : "", len, data);
+	if (n >= sizeof(buf)) {
+		n= sizeof(buf) - 1;
+		buf[n-1]= '\n';
+	}
+	if (write(record_fd, buf, n) != n) {
+		log_error("session record write failed: %s; recording stopped", strerror(errno));
+		close(record_fd);
+		record_fd= -1;
+	}
+}
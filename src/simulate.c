@@ -0,0 +1,216 @@
+/* simulate.c - virtual clock and pretend child processes for --simulate
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* With --simulate, daemonproxy never forks a service.  Each start creates a
+ * pretend process with a pid above the kernel's pid range, which "runs" until
+ * it is signaled or until the exit scripted for its service by sim.exit.
+ * Signals to these pids, and reaping them, are handled here instead of by
+ * the kernel.
+ *
+ * Time comes from a virtual clock which only moves when a controller asks for
+ * it with sim.advance.  The main loop then jumps the clock straight to the
+ * next wake time or scripted exit, so restart delays and timeouts play out
+ * without real sleeps, and the same input always produces the same events.
+ * Controller and log descriptors are still real, and polled without waiting
+ * while the clock has somewhere to go.
+ *
+ * sim_kill, sim_wait4 and sim_select pass straight through to the system
+ * when not simulating.
+ */
+
+#define SIM_PID_FIRST  0x400000                // above any real pid_max
+#define SIM_CLOCK_START ((int64_t) 1000 << 32)  // fixed, for reproducible timestamps
+
+typedef struct sim_proc_s {
+	pid_t   pid;
+	int64_t exit_ts;   // when it exits, or 0 for never
+	int     wstat;
+} sim_proc_t;
+
+typedef struct sim_script_s {
+	struct sim_script_s *next;
+	const char *name;  // interned service name
+	int64_t delay;
+	int     wstat;
+} sim_script_t;
+
+static bool        sim_enabled_flag= false;
+static int64_t     sim_clock= SIM_CLOCK_START;
+static int64_t     sim_target= SIM_CLOCK_START;
+static pid_t       sim_next_pid= SIM_PID_FIRST;
+static sim_proc_t *sim_proc= NULL;
+static int         sim_proc_count= 0, sim_proc_alloc= 0;
+static sim_script_t *sim_scripts= NULL;
+
+void sim_enable() {
+	sim_enabled_flag= true;
+}
+
+bool sim_enabled() {
+	return sim_enabled_flag;
+}
+
+int64_t sim_time() {
+	return sim_clock;
+}
+
+/** Let the virtual clock run forward as far as target.
+ */
+void sim_advance(int64_t target) {
+	if (target - sim_target > 0)
+		sim_target= target;
+}
+
+/** Set how each later run of the named service ends: after delay, with wait
+ * status wstat.  A negative delay removes the script, so runs last until they
+ * are signaled.
+ */
+bool sim_set_exit(strseg_t name, int64_t delay, int wstat) {
+	sim_script_t *s, **prev;
+	for (prev= &sim_scripts; (s= *prev); prev= &s->next)
+		if (name_len(s->name) == name.len && 0 == memcmp(s->name, name.data, name.len))
+			break;
+	if (delay < 0) {
+		if (s) {
+			*prev= s->next;
+			name_release(s->name);
+			free(s);
+		}
+		return true;
+	}
+	if (!s) {
+		if (!(s= malloc(sizeof(*s))))
+			return false;
+		if (!(s->name= name_intern(name, false))) {
+			free(s);
+			return false;
+		}
+		s->next= sim_scripts;
+		sim_scripts= s;
+	}
+	s->delay= delay;
+	s->wstat= wstat;
+	return true;
+}
+
+static sim_proc_t * sim_proc_by_pid(pid_t pid) {
+	int i;
+	for (i= 0; i < sim_proc_count; i++)
+		if (sim_proc[i].pid == pid)
+			return &sim_proc[i];
+	return NULL;
+}
+
+/** Create a pretend process for the named service (or NULL for a probe,
+ * which exits 0 right away).  Returns its pid, or -1 if out of memory.
+ */
+pid_t sim_spawn(const char *name) {
+	sim_script_t *s;
+	sim_proc_t *p;
+	if (sim_proc_count >= sim_proc_alloc) {
+		int n= sim_proc_alloc? sim_proc_alloc * 2 : 16;
+		if (!(p= realloc(sim_proc, n * sizeof(*p))))
+			return -1;
+		sim_proc= p;
+		sim_proc_alloc= n;
+	}
+	p= &sim_proc[sim_proc_count++];
+	p->pid= sim_next_pid++;
+	if (sim_next_pid <= 0)
+		sim_next_pid= SIM_PID_FIRST;
+	p->exit_ts= name? 0 : sim_clock;
+	p->wstat= 0;
+	for (s= sim_scripts; name && s; s= s->next)
+		if (0 == strcmp(s->name, name)) {
+			p->exit_ts= sim_clock + s->delay;
+			p->wstat= s->wstat;
+			break;
+		}
+	log_debug("simulated process %d for \"%s\"", (int) p->pid, name? name : "(probe)");
+	return p->pid;
+}
+
+/** Send a signal to a process (or process group).  A pretend process exits
+ * from any signal except 0 and the stop/continue signals.
+ */
+int sim_kill(pid_t pid, int signum, bool group) {
+	sim_proc_t *p;
+	if (!sim_enabled_flag || pid < SIM_PID_FIRST)
+		return group? killpg(pid, signum) : kill(pid, signum);
+	if (!(p= sim_proc_by_pid(pid))) {
+		errno= ESRCH;
+		return -1;
+	}
+	if (signum && signum != SIGSTOP && signum != SIGTSTP && signum != SIGCONT
+		&& (!p->exit_ts || p->exit_ts - sim_clock > 0)
+	) {
+		p->exit_ts= sim_clock;
+		p->wstat= signum;   // as from WTERMSIG
+	}
+	return 0;
+}
+
+/** Reap one child, without blocking.  Returns its pid, 0 if none have
+ * exited, or -1 if there are no children (or on error).
+ *
+ * Helper processes (--spawner, --fs-workers) are real children even when
+ * simulating, so those are reaped first.
+ */
+pid_t sim_wait4(int *wstat, struct rusage *ru) {
+	int i, found= -1;
+	pid_t pid;
+	bool real_children;
+	if ((pid= wait4(-1, wstat, WNOHANG, ru)) > 0 || !sim_enabled_flag)
+		return pid;
+	real_children= pid == 0;
+	// reap in order of exit time (then of creation), to stay reproducible
+	for (i= 0; i < sim_proc_count; i++)
+		if (sim_proc[i].exit_ts && sim_proc[i].exit_ts - sim_clock <= 0
+			&& (found < 0 || sim_proc[i].exit_ts - sim_proc[found].exit_ts < 0))
+			found= i;
+	if (found < 0) {
+		errno= ECHILD;
+		return sim_proc_count || real_children? 0 : -1;
+	}
+	pid= sim_proc[found].pid;
+	*wstat= sim_proc[found].wstat;
+	memset(ru, 0, sizeof(*ru));
+	memmove(sim_proc + found, sim_proc + found + 1, (sim_proc_count - found - 1) * sizeof(*sim_proc));
+	sim_proc_count--;
+	return pid;
+}
+
+/** Wait for descriptors, as select() does.  When simulating, the clock moves
+ * to the earlier of wake->next and the next scripted exit, if that is within
+ * the limit set by sim_advance, and descriptors are only polled.  Otherwise
+ * (or while waiting to write) the clock stands still and this waits for a
+ * descriptor.
+ */
+int sim_select(int nfds, fd_set *rd, fd_set *wr, fd_set *er, struct timeval *tv) {
+	struct timeval poll_tv= { 0, 0 };
+	int64_t next;
+	int i;
+	if (!sim_enabled_flag)
+		return select(nfds, rd, wr, er, tv);
+	next= wake->next;
+	for (i= 0; i < sim_proc_count; i++)
+		if (sim_proc[i].exit_ts && sim_proc[i].exit_ts - next < 0)
+			next= sim_proc[i].exit_ts;
+	if (next - sim_clock <= 0)
+		return select(nfds, rd, wr, er, &poll_tv);
+	// A blocked writer (such as a controller which is slow to read its events)
+	// would time out in no time at all on the virtual clock, so wait for it.
+	for (i= 0; i < nfds; i++)
+		if (FD_ISSET(i, wr))
+			return select(nfds, rd, wr, er, NULL);
+	if (next - sim_target <= 0) {
+		sim_clock= next;
+		return select(nfds, rd, wr, er, &poll_tv);
+	}
+	return select(nfds, rd, wr, er, NULL);
+}
@@ -0,0 +1,234 @@
+/* spawner.c - helper process which forks services on our behalf
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+#include <sys/prctl.h>
+
+/* With --spawner, daemonproxy forks a small helper process at startup,
+ * before allocating most of its memory, and the helper performs the fork
+ * and exec of each service.  The cost of fork() then no longer depends on
+ * the size of daemonproxy, and a failure while forking can't harm it.
+ *
+ * Requests travel over a SOCK_SEQPACKET socketpair, with the service's file
+ * descriptors attached.  The helper forks an intermediate child, which forks
+ * the service, reports the service's pid back to daemonproxy, and exits.
+ * The orphaned service is then re-parented to daemonproxy (which is either
+ * PID 1 or a child subreaper), so it is reaped by the main loop like any
+ * other service.
+ *
+ * The main loop waits for each reply, but only for SPAWNER_TIMEOUT_MS.  A
+ * helper which doesn't answer in time (stopped, or stuck in fork) is killed
+ * and services are forked directly from then on.
+ */
+
+typedef struct spawner_req_s {
+	int32_t fd_count;
+	int32_t fd_map[FD_SEND_MAX]; // index into the attached descriptors, or -1
+	int32_t exec_fd;             // same, for the executable's handle
+	char    argv[];              // NUL-terminated TSV argument list
+} spawner_req_t;
+
+typedef struct spawner_reply_s {
+	int32_t pid;   // pid of the service, or 0
+	int32_t err;   // errno, if pid is 0
+} spawner_reply_t;
+
+static int   spawner_sock= -1;
+static pid_t spawner_pid= 0;
+
+static void spawner_main(int sock);
+static void spawner_abandon();
+
+/** Start the spawner helper process.
+ */
+bool spawner_start() {
+	int sv[2];
+	pid_t pid;
+	struct timeval tv= { SPAWNER_TIMEOUT_MS / 1000, (SPAWNER_TIMEOUT_MS % 1000) * 1000 };
+
+	if (getpid() != 1) {
+		#ifdef PR_SET_CHILD_SUBREAPER
+		if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0) {
+			log_error("prctl(PR_SET_CHILD_SUBREAPER): %s", strerror(errno));
+			return false;
+		}
+		#else
+		log_error("spawner requires PID 1 or child-subreaper support");
+		return false;
+		#endif
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0) {
+		log_error("socketpair: %s", strerror(errno));
+		return false;
+	}
+	if (setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0
+		|| setsockopt(sv[0], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0
+	) {
+		log_error("setsockopt: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if ((pid= fork()) < 0) {
+		log_error("fork: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		spawner_main(sv[1]);
+		_exit(0);
+	}
+	close(sv[1]);
+	spawner_sock= sv[0];
+	spawner_pid= pid;
+	log_info("spawner helper is pid %d", (int) pid);
+	return true;
+}
+
+bool spawner_enabled() {
+	return spawner_sock >= 0;
+}
+
+/** Ask the helper to start a process.
+ *
+ * fd_list holds fd_count descriptors (or -1 for closed) which become the
+ * process's descriptors 0..fd_count-1.  exec_fd is the handle of the
+ * executable, or -1 to search PATH.  Returns the pid, or -1 if the request
+ * couldn't be completed (with errno set).  If the helper timed out, it has
+ * been abandoned and spawner_enabled() is now false.
+ */
+pid_t spawner_spawn(const int *fd_list, int fd_count, int exec_fd, const char *argv) {
+	int fds[FD_SEND_MAX], n_fds= 0, i, argv_len= strlen(argv);
+	spawner_req_t *req;
+	spawner_reply_t reply;
+	ssize_t n;
+
+	if (fd_count + (exec_fd >= 0) > FD_SEND_MAX || argv_len >= SPAWNER_MAX_MSG - sizeof(spawner_req_t)) {
+		errno= E2BIG;
+		return -1;
+	}
+	req= alloca(sizeof(spawner_req_t) + argv_len + 1);
+	req->fd_count= fd_count;
+	for (i= 0; i < fd_count; i++) {
+		if (fd_list[i] < 0)
+			req->fd_map[i]= -1;
+		else {
+			req->fd_map[i]= n_fds;
+			fds[n_fds++]= fd_list[i];
+		}
+	}
+	req->exec_fd= -1;
+	if (exec_fd >= 0) {
+		req->exec_fd= n_fds;
+		fds[n_fds++]= exec_fd;
+	}
+	memcpy(req->argv, argv, argv_len + 1);
+	if (fd_send_with_fds(spawner_sock, (char*) req, sizeof(spawner_req_t) + argv_len + 1, fds, n_fds) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			spawner_abandon();
+		return -1;
+	}
+	// The helper replies as soon as it has forked, so just block for it
+	// (up to SO_RCVTIMEO).
+	do n= recv(spawner_sock, &reply, sizeof(reply), 0);
+	while (n < 0 && errno == EINTR);
+	if (n != sizeof(reply)) {
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			spawner_abandon();
+			errno= ETIMEDOUT;
+		}
+		else if (n >= 0)
+			errno= EPIPE;
+		return -1;
+	}
+	if (!reply.pid) {
+		errno= reply.err;
+		return -1;
+	}
+	return reply.pid;
+}
+
+// Give up on a helper which stopped answering.  It is reaped as usual.
+static void spawner_abandon() {
+	log_error("spawner helper did not answer in %d ms; killing it and forking services directly",
+		SPAWNER_TIMEOUT_MS);
+	kill(spawner_pid, SIGKILL);
+	close(spawner_sock);
+	spawner_sock= -1;
+}
+
+/** Check whether a reaped pid was the helper.
+ *
+ * If the helper dies, services are forked by daemonproxy again.
+ */
+bool spawner_handle_reaped(pid_t pid, int wstat) {
+	if (!spawner_pid || pid != spawner_pid)
+		return false;
+	if (spawner_sock >= 0) {
+		log_error("spawner helper exited (wait status 0x%X); forking services directly", wstat);
+		close(spawner_sock);
+		spawner_sock= -1;
+	}
+	spawner_pid= 0;
+	return true;
+}
+
+static void spawner_reply(int sock, pid_t pid, int err) {
+	spawner_reply_t reply= { pid, err };
+	if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0)
+		_exit(EXIT_BROKEN_PROGRAM_STATE);
+}
+
+// Main loop of the helper process.  Returns when daemonproxy goes away.
+static void spawner_main(int sock) {
+	static char buf[SPAWNER_MAX_MSG];
+	spawner_req_t *req= (spawner_req_t*) buf;
+	int fds[FD_SEND_MAX], n_fds, fd_list[FD_SEND_MAX], i;
+	ssize_t n;
+	pid_t pid, svc_pid;
+
+	// Keep only the socket and the log (stderr); anything else could hold
+	// a pipe open, such as stdout of an interactive daemonproxy.
+	for (i= 0; i < FD_SETSIZE; i++)
+		if (i != sock && i != 2)
+			close(i);
+
+	while (1) {
+		n= fd_recv_with_fds(sock, buf, sizeof(buf) - 1, fds, &n_fds);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) continue;
+			return;
+		}
+		buf[n]= '\0';
+		if (n < sizeof(spawner_req_t) || req->fd_count < 0 || req->fd_count > FD_SEND_MAX) {
+			spawner_reply(sock, 0, EINVAL);
+		}
+		else if ((pid= fork()) < 0) {
+			spawner_reply(sock, 0, errno);
+		}
+		else if (pid == 0) {
+			// Intermediate child: fork the service, report its pid, and exit so
+			// that the service is adopted by daemonproxy.
+			if ((svc_pid= fork()) == 0) {
+				for (i= 0; i < req->fd_count; i++)
+					fd_list[i]= (req->fd_map[i] >= 0 && req->fd_map[i] < n_fds)? fds[req->fd_map[i]] : -1;
+				svc_exec_fds_argv(fd_list, req->fd_count,
+					(req->exec_fd >= 0 && req->exec_fd < n_fds)? fds[req->exec_fd] : -1,
+					req->argv);
+				// never returns
+			}
+			spawner_reply(sock, svc_pid > 0? svc_pid : 0, svc_pid > 0? 0 : errno);
+			_exit(0);
+		}
+		else {
+			while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+		}
+		for (i= 0; i < n_fds; i++)
+			close(fds[i]);
+	}
+}
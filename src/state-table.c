@@ -0,0 +1,175 @@
+/* state-table.c - read-only shared memory table of service states
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+/* The table is a file which monitoring tools can mmap and poll without
+ * talking to daemonproxy.  It holds a fixed header followed by one
+ * fixed-size record per service.  Each record has a sequence number which
+ * is odd while the record is being written; a reader copies the record,
+ * and retries if the sequence was odd or changed during the copy.
+ * The header has its own sequence number, which changes when the table is
+ * enlarged (and so needs to be mapped again).
+ */
+
+#define STATE_TABLE_MAGIC   "dpstate"
+#define STATE_TABLE_VERSION 1
+#define STATE_TABLE_NAME_SIZE 32  // longer names are truncated
+
+typedef struct state_table_header_s {
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t capacity;
+	uint32_t seq;
+	uint32_t reserved[9];
+} state_table_header_t;
+
+typedef struct state_table_rec_s {
+	uint32_t seq;
+	uint32_t state;
+	int32_t  pid;
+	int32_t  wait_status;
+	int64_t  up_ts;
+	int64_t  reap_ts;
+	uint32_t restart_count;
+	uint32_t reserved;
+	char     name[STATE_TABLE_NAME_SIZE];
+} state_table_rec_t;
+
+#define STATE_TABLE_FREE  0
+#define STATE_TABLE_DOWN  1
+#define STATE_TABLE_START 2
+#define STATE_TABLE_UP    3
+
+static int state_table_fd= -1;
+static state_table_header_t *state_table= NULL;
+static state_table_rec_t *state_table_rec= NULL;
+
+static size_t state_table_size(int capacity) {
+	return sizeof(state_table_header_t) + capacity * sizeof(state_table_rec_t);
+}
+
+static bool state_table_map(int capacity) {
+	void *mem;
+	if (ftruncate(state_table_fd, state_table_size(capacity)) < 0) {
+		log_error("ftruncate(state table): %s", strerror(errno));
+		return false;
+	}
+	mem= mmap(NULL, state_table_size(capacity), PROT_READ|PROT_WRITE, MAP_SHARED, state_table_fd, 0);
+	if (mem == MAP_FAILED) {
+		log_error("mmap(state table): %s", strerror(errno));
+		return false;
+	}
+	if (state_table)
+		munmap(state_table, state_table_size(state_table->capacity));
+	state_table= (state_table_header_t*) mem;
+	state_table_rec= (state_table_rec_t*) (state_table + 1);
+	return true;
+}
+
+/** Create the state table file at path, replacing any previous file.
+ */
+bool state_table_open(const char *path) {
+	int fd= open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) {
+		log_error("open(%s): %s", path, strerror(errno));
+		return false;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	// readable by monitoring tools regardless of our umask
+	fchmod(fd, 0644);
+	state_table_fd= fd;
+	if (!state_table_map(STATE_TABLE_INITIAL_CAPACITY)) {
+		close(fd);
+		state_table_fd= -1;
+		return false;
+	}
+	memcpy(state_table->magic, STATE_TABLE_MAGIC, sizeof(STATE_TABLE_MAGIC));
+	state_table->version= STATE_TABLE_VERSION;
+	state_table->header_size= sizeof(state_table_header_t);
+	state_table->record_size= sizeof(state_table_rec_t);
+	state_table->capacity= STATE_TABLE_INITIAL_CAPACITY;
+	return true;
+}
+
+// Double the number of records, updating the header under its seqlock
+static bool state_table_grow() {
+	int old_cap= state_table->capacity, new_cap= old_cap * 2;
+	state_table->seq++;
+	__sync_synchronize();
+	if (!state_table_map(new_cap)) {
+		__sync_synchronize();
+		state_table->seq++;
+		return false;
+	}
+	// The file was extended with zeroes, which are free records
+	state_table->capacity= new_cap;
+	__sync_synchronize();
+	state_table->seq++;
+	return true;
+}
+
+/** Claim a record for a new service.  Returns the record index, or -1 if
+ * the table isn't enabled or can't be enlarged.
+ */
+int state_table_alloc(service_t *svc) {
+	int i;
+	if (!state_table)
+		return -1;
+	for (i= 0; i < state_table->capacity; i++)
+		if (state_table_rec[i].state == STATE_TABLE_FREE)
+			break;
+	if (i >= state_table->capacity && !state_table_grow()) {
+		log_warn("state table full; service %s not published", svc_get_name(svc));
+		return -1;
+	}
+	state_table_publish(i, svc);
+	return i;
+}
+
+/** Copy the current state of the service into its record.
+ */
+void state_table_publish(int slot, service_t *svc) {
+	state_table_rec_t *rec;
+	int64_t up_ts= svc_get_up_ts(svc);
+	pid_t pid= svc_get_pid(svc);
+	if (slot < 0 || !state_table)
+		return;
+	rec= &state_table_rec[slot];
+	rec->seq++;
+	__sync_synchronize();
+	// Same classification as the service.state event
+	rec->state= !up_ts? STATE_TABLE_DOWN
+		: ((up_ts - wake->now) >= 0 && !pid)? STATE_TABLE_START
+		: !svc_get_reap_ts(svc)? STATE_TABLE_UP
+		: STATE_TABLE_DOWN;
+	rec->pid= pid;
+	rec->wait_status= svc_get_wstat(svc);
+	rec->up_ts= up_ts;
+	rec->reap_ts= svc_get_reap_ts(svc);
+	rec->restart_count= svc_get_restart_count(svc);
+	strncpy(rec->name, svc_get_name(svc), sizeof(rec->name) - 1);
+	__sync_synchronize();
+	rec->seq++;
+}
+
+/** Mark the record of a deleted service as free.
+ */
+void state_table_release(int slot) {
+	state_table_rec_t *rec;
+	if (slot < 0 || !state_table)
+		return;
+	rec= &state_table_rec[slot];
+	rec->seq++;
+	__sync_synchronize();
+	rec->state= STATE_TABLE_FREE;
+	rec->pid= 0;
+	memset(rec->name, 0, sizeof(rec->name));
+	__sync_synchronize();
+	rec->seq++;
+}
@@ -0,0 +1,70 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Socket;
+use IO::Select;
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/104-controller-buffers.sock';
+unlink $sockpath;
+$dp->run('-i', '--simulate', '-S', $sockpath);
+$dp->timeout(3);
+$dp->sync;
+
+socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+connect($s, sockaddr_un($sockpath)) || die "connect: $!";
+$s->autoflush(1);
+
+# Send lines to the socket controller, and return everything it writes up to
+# a line matching the pattern.
+sub sock_recv {
+	my $pattern= shift;
+	my $reply= '';
+	my $sel= IO::Select->new($s);
+	while ($reply !~ $pattern && $sel->can_read($dp->timeout)) {
+		sysread($s, $reply, 65536, length $reply) or last;
+	}
+	return $reply;
+}
+sub sock_cmd {
+	$s->print(@_, "echo\t-marker-\n");
+	return sock_recv(qr/^-marker-\n/m);
+}
+
+# Buffers start at 256 bytes and double as needed, up to 2048 for output and
+# 4096 for input.
+my $long= 'a' x 2046;
+like( sock_cmd("echo\t$long\n"), qr/^$long\n/m, 'largest output line fits' );
+
+my $cmd= "log.filter\t" . ('x' x (4095 - length "log.filter\t"));
+like( sock_cmd("$cmd\n"), qr/^error\tInvalid loglevel argument/m, 'largest input line is parsed' );
+
+# Past the caps, the usual overflow handling applies
+like( sock_cmd("$cmd"."x\n"), qr/^error\tline too long/m, 'input line over the cap rejected' );
+$s->print("echo\t${long}b\n");
+like( sock_recv(qr/^overflow\n/m), qr/^overflow\n/m, 'output line over the cap flags overflow' );
+like( sock_cmd("echo\tafter\n"), qr/^after\n/m, 'output resumes after the overflow' );
+
+# Once idle for 10 seconds, the buffers are released
+$dp->send('log.filter', 'trace');
+$dp->recv_ok( qr/^log.filter\ttrace$/m, 'show debug messages' );
+$dp->send('sim.advance', 9);
+$dp->recv_ok( qr/^sim.time\t1009$/m, 'nine seconds later' );
+$dp->send('echo', '-sync-');
+$dp->recv_stderr_ok( qr/command: "echo\t-sync-"/, 'sync' );
+unlike( $dp->{last_input_removed}, qr/controller\[1\] idle/, 'buffers kept while recently used' );
+$dp->send('sim.advance', 1);
+$dp->recv_stderr_ok( qr/controller\[1\] idle, releasing buffers/, 'buffers released after 10 seconds' );
+
+like( sock_cmd("echo\t$long\n"), qr/^$long\n/m, 'buffers grow again after release' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $sockpath;
+
+done_testing;
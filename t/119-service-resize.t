@@ -23,11 +23,11 @@ $dp->send('service.args', 'foo', '');
 $dp->recv_ok( qr/^service.args	foo\t?$/m, 'args of length 0' );
 
 # verify that it checks service names before creating them
-$dp->send('service.args', ("x"x 32), '/bin/true');
-$dp->recv_ok( qr/^error	.*service.args\tx/m, 'service name length 32 fails' );
+$dp->send('service.args', ("x"x 128), '/bin/true');
+$dp->recv_ok( qr/^error	.*service.args\tx/m, 'service name length 128 fails' );
 
-$dp->send('service.args', ("x"x 31), '/bin/true');
-$dp->recv_ok( qr/^service.args\tx{31}\t/m, 'service name length 31 succeeds' );
+$dp->send('service.args', ("x"x 127), '/bin/true');
+$dp->recv_ok( qr/^service.args\tx{127}\t/m, 'service name length 127 succeeds' );
 
 $dp->terminate_ok;
 $dp->exit_is( 0 );
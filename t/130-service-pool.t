@@ -39,8 +39,17 @@ $dp->recv_ok( qr/^service.state	service1	deleted/m, 'freed a slot' );
 $dp->send('service.args', 'service7', '/bin/true');
 $dp->recv_ok( qr/^service.args	service7/m, 'created service7' );
 
+# names longer than the old fixed buffer work in the pool too
+my $long= 'x' x 100;
+$dp->send('service.delete', 'service2');
+$dp->recv_ok( qr/^service.state	service2	deleted/m, 'freed another slot' );
+$dp->send('service.args', $long, '/bin/true');
+$dp->recv_ok( qr/^service.args	$long	/m, 'created service with long name' );
+$dp->send('service.delete', $long);
+$dp->recv_ok( qr/^service.state	$long	deleted/m, 'deleted it' );
+
 # free them all
-for (2..7) {
+for (3..7) {
 	$dp->send('service.delete', "service$_");
 	$dp->recv( qr/^service.state	service$_	deleted/m );
 }
@@ -0,0 +1,83 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp;
+$dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+my $tempdir= sprintf("%s/tmp/t%03d", $FindBin::Bin, do { $FindBin::Script =~ /(\d+)/? $1 : $$ });
+system('mkdir','-p',$tempdir) == 0 or die;
+system('rm','-r',$tempdir) == 0 or die;
+system('mkdir','-p',$tempdir) == 0 or die;
+
+$dp->send('service.args', 'foo', 'perl', '-e', 'sleep 100');
+$dp->send('service.probe', 'foo', 1, 2, 1, 'bogus', 'exec', 'true');
+$dp->recv_ok( qr/^error.*service.probe/m, 'invalid flag rejected' );
+$dp->send('service.probe', 'foo', 1, 2, 1, '-', 'file', 'x');
+$dp->recv_ok( qr/^error.*service.probe/m, 'missing max age rejected' );
+
+# Passing exec probe reports ok once
+$dp->send('service.probe', 'foo', 1, 2, 2, '-', 'exec', 'perl', '-e', 'exit 0');
+$dp->recv_ok( qr/^service.probe\tfoo\t1\t2\t2\t-\texec\tperl\t-e\texit 0$/m, 'probe configured' );
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup/m, 'service up' );
+$dp->recv_ok( qr/^service.health\tfoo\tok\t0\texit 0$/m, 'exec probe ok' );
+
+# Failing exec probe with restart kills and restarts the service
+$dp->send('service.probe', 'foo', 1, 2, 2, 'restart', 'exec', 'perl', '-e', 'exit 3');
+$dp->recv_ok( qr/^service.health\tfoo\tfail\t1\texit 3$/m, 'first failure' );
+$dp->recv_ok( qr/^service.health\tfoo\tunhealthy\t2\texit 3$/m, 'unhealthy at threshold' );
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t\d+\tprobe\tSIGTERM\t/m, 'killed by probe' );
+$dp->recv_ok( qr/^service.state\tfoo\tup/m, 'restarted' );
+
+# Timeout
+$dp->send('service.probe', 'foo', 1, 1, 5, '-', 'exec', 'perl', '-e', 'sleep 10');
+$dp->recv_ok( qr/^service.health\tfoo\tfail\t1\ttimeout$/m, 'probe timed out' );
+
+# File age
+my $hb= "$tempdir/heartbeat";
+open my $fh, '>', $hb or die "$!"; close $fh;
+$dp->send('service.probe', 'foo', 1, 1, 5, '-', 'file', $hb, 10);
+$dp->recv_ok( qr/^service.health\tfoo\tok\t0\tage \d+$/m, 'fresh file ok' );
+utime(time - 60, time - 60, $hb);
+$dp->recv_ok( qr/^service.health\tfoo\tfail\t1\tage \d+$/m, 'stale file fails' );
+
+# Connect to a named socket
+$dp->send('fd.socket', 'lsock', 'unix,listen', "$tempdir/l.sock");
+$dp->send('service.probe', 'foo', 1, 1, 5, '-', 'connect', 'lsock');
+$dp->recv_ok( qr/^service.health\tfoo\tok\t0\tconnect: ok$/m, 'connect ok' );
+$dp->send('fd.socket', 'bsock', 'unix,bind', "$tempdir/b.sock");
+$dp->send('service.probe', 'foo', 1, 1, 5, '-', 'connect', 'bsock');
+$dp->recv_ok( qr/^service.health\tfoo\tfail\t1\tconnect: /m, 'connect to non-listening socket fails' );
+
+$dp->send('service.probe', 'foo', '-');
+$dp->recv_ok( qr/^service.probe\tfoo\t-$/m, 'probe removed' );
+
+$dp->send('service.signal', 'foo', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t\d+\tsignal\tSIGTERM\t/m, 'normal exit reason' );
+
+# A service which survives the probe's SIGTERM is sent SIGKILL, and probed again
+$dp->send('service.args', 'stubborn', 'perl', '-e', '$SIG{TERM}= "IGNORE"; sleep 100');
+$dp->send('service.probe', 'stubborn', 1, 2, 1, 'restart', 'exec', 'perl', '-e', 'exit 3');
+$dp->send('service.start', 'stubborn');
+$dp->recv_ok( qr/^service.health\tstubborn\tunhealthy\t1\texit 3$/m, 'stubborn unhealthy' );
+$dp->timeout(9);
+$dp->recv_ok( qr/^service.state\tstubborn\tdown\t\d+\t\d+\tprobe\tSIGKILL\t/m, 'escalated to SIGKILL' );
+$dp->recv_ok( qr/^service.state\tstubborn\tup/m, 'stubborn restarted' );
+$dp->recv_ok( qr/^service.health\tstubborn\tunhealthy\t1\texit 3$/m, 'probing resumed' );
+$dp->send('service.probe', 'stubborn', '-');
+$dp->send('service.signal', 'stubborn', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tstubborn\tdown/m, 'stubborn stopped' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
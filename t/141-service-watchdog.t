@@ -0,0 +1,72 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp;
+$dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+$dp->send('service.watchdog', 'foo', 0);
+$dp->recv_ok( qr/^error.*service.watchdog/m, 'zero timeout rejected' );
+$dp->send('service.watchdog', 'foo', 2, 'SIGBOGUS');
+$dp->recv_ok( qr/^error.*service.watchdog/m, 'invalid signal rejected' );
+
+$dp->send('service.heartbeat');
+$dp->recv_ok( qr/^error.*service.heartbeat/m, 'heartbeat needs a name outside a service connection' );
+
+# Service sends three heartbeats over its control socket, then hangs
+my $script= 'use Time::HiRes "sleep"; open(my $c, ">&=3") or die; $c->autoflush(1);'
+	.' for (1..3) { print $c "service.heartbeat\n"; sleep .5 } sleep 100';
+$dp->send('service.args', 'foo', 'perl', '-e', $script);
+$dp->send('service.fds', 'foo', 'null', 'stderr', 'stderr', 'control.socket');
+$dp->send('service.watchdog', 'foo', 2, 'SIGKILL');
+$dp->recv_ok( qr/^service.watchdog\tfoo\t2\tSIGKILL$/m, 'watchdog configured' );
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup/m, 'service up' );
+$dp->timeout(5);
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t\d+\twatchdog\tSIGKILL\t(\d+)\t/m, 'killed by watchdog' );
+cmp_ok( $dp->last_captures->[0], '>=', 3, 'heartbeats postponed the watchdog' );
+$dp->recv_ok( qr/^service.state\tfoo\tup/m, 'restarted' );
+
+# Heartbeats from another controller keep it alive too
+$dp->send('service.args', 'bar', 'perl', '-e', 'sleep 100');
+$dp->send('service.watchdog', 'bar', 1);
+$dp->send('service.start', 'bar');
+$dp->recv_ok( qr/^service.state\tbar\tup/m, 'bar up' );
+for (1..4) {
+	sleep .5;
+	$dp->send('service.heartbeat', 'bar');
+}
+$dp->send('service.watchdog', 'bar', '-');
+$dp->recv_ok( qr/^service.watchdog\tbar\t-$/m, 'watchdog removed' );
+$dp->send('service.signal', 'bar', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tbar\tdown\t\d+\t\d+\tsignal\tSIGTERM\t/m, 'bar stayed up until signalled' );
+
+$dp->send('service.watchdog', 'foo', '-');
+$dp->send('service.signal', 'foo', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tfoo\tdown/m, 'foo down' );
+
+# A service which survives the signal is sent SIGKILL after a grace period
+$dp->send('service.args', 'baz', 'perl', '-e', '$SIG{HUP}= "IGNORE"; sleep 100');
+$dp->send('service.watchdog', 'baz', 1, 'SIGHUP');
+$dp->send('service.start', 'baz');
+$dp->recv_ok( qr/^service.state\tbaz\tup/m, 'baz up' );
+$dp->recv_stderr_ok( qr/"baz" missed its heartbeat/, 'baz sent SIGHUP' );
+$dp->timeout(8);
+$dp->recv_ok( qr/^service.state\tbaz\tdown\t\d+\t\d+\twatchdog\tSIGKILL\t/m, 'escalated to SIGKILL' );
+$dp->recv_ok( qr/^service.state\tbaz\tup/m, 'baz restarted' );
+$dp->send('service.watchdog', 'baz', '-');
+$dp->send('service.signal', 'baz', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tbaz\tdown/m, 'baz down' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
@@ -0,0 +1,59 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp;
+$dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+$dp->send('service.max_runtime', 'foo', 0);
+$dp->recv_ok( qr/^error.*service.max_runtime/m, 'zero seconds rejected' );
+$dp->send('service.max_runtime', 'foo', 1, 'SIGTERM', 'bogus');
+$dp->recv_ok( qr/^error.*service.max_runtime/m, 'invalid flag rejected' );
+
+# A periodic job which hangs gets killed, and the next run starts on schedule
+$dp->send('service.args', 'job', 'perl', '-e', 'sleep 100');
+$dp->send('service.max_runtime', 'job', 1, 'SIGKILL');
+$dp->recv_ok( qr/^service.max_runtime\tjob\t1\tSIGKILL$/m, 'max_runtime configured' );
+$dp->send('service.auto_up', 'job', 2, 'always');
+$dp->recv_ok( qr/^service.state\tjob\tup/m, 'job up' );
+$dp->recv_ok( qr/^service.state\tjob\tdown\t\d+\t\d+\ttimeout\tSIGKILL\t(\d+)\t/m, 'killed with timeout reason' );
+$dp->recv_ok( qr/^service.state\tjob\tup/m, 'next run started' );
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.max_runtime\tjob\t1\tSIGKILL$/m, 'max_runtime in statedump' );
+
+$dp->send('service.auto_up', 'job', '-');
+$dp->send('service.max_runtime', 'job', '-');
+$dp->recv_ok( qr/^service.max_runtime\tjob\t-$/m, 'max_runtime removed' );
+
+# Setting a limit applies to a service which is already running
+$dp->send('service.args', 'bar', 'perl', '-e', 'sleep 100');
+$dp->send('service.start', 'bar');
+$dp->recv_ok( qr/^service.state\tbar\tup/m, 'bar up' );
+sleep 1.5;
+$dp->send('service.max_runtime', 'bar', 1);
+$dp->recv_ok( qr/^service.state\tbar\tdown\t\d+\t\d+\ttimeout\tSIGTERM\t/m, 'running service killed' );
+
+$dp->send('service.signal', 'job', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tjob\tdown\t\d+\t\d+\tsignal\tSIGKILL\t/m, 'normal exit reason' );
+# A job which ignores the signal is sent SIGKILL after a grace period
+$dp->send('service.args', 'stubborn', 'perl', '-e', '$SIG{TERM}= "IGNORE"; sleep 100');
+$dp->send('service.max_runtime', 'stubborn', 1);
+$dp->send('service.start', 'stubborn');
+$dp->recv_ok( qr/^service.state\tstubborn\tup/m, 'stubborn up' );
+$dp->timeout(9);
+$dp->recv_ok( qr/^service.state\tstubborn\tdown\t\d+\t\d+\ttimeout\tSIGKILL\t(\d+)\t/m, 'escalated to SIGKILL' );
+cmp_ok( $dp->last_captures->[0], '>=', 6, 'after the grace period' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
@@ -0,0 +1,75 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp;
+$dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(1);
+
+$dp->send('service.args', 'job', 'perl', '-e', 'sleep 100');
+
+for my $bad ('cron:60 * * * *', 'cron:0 3 * *', 'cron:0 3 * * * *', 'cron:0 3 0 * *',
+	'cron:*/0 * * * *', 'cron:5-1 * * * *', 'cron:0 3 * * mon', 'cron:@often', 'crontab:0 3 * * *'
+) {
+	$dp->send('service.auto_up', 'job', 1, $bad);
+	$dp->recv_ok( qr/^error.*service.auto_up/m, "reject '$bad'" );
+}
+$dp->send('service.auto_up', 'job', 1, 'cron:0 3 * * *', 'cron:0 4 * * *');
+$dp->recv_ok( qr/^error.*service.auto_up/m, 'only one cron trigger' );
+
+# A schedule which can't match for a long time doesn't start the service
+$dp->send('service.auto_up', 'job', 1, 'cron:0 0 29 2 *', 'SIGUSR1');
+$dp->recv_ok( qr/^service.auto_up\tjob\t1\tcron:0 0 29 2 \*\tSIGUSR1$/m, 'cron trigger accepted' );
+ok( !$dp->recv( qr/^service.state\tjob\tup/m ), 'not started' );
+$dp->send('service.auto_up', 'job', 1, 'cron:*/5,7 1-3/2 * 1,6-12 0-4,7', 'cron:@daily');
+$dp->recv_ok( qr/^error.*service.auto_up/m, 'two schedules rejected' );
+
+for my $ok ('cron:*/5,7 1-3/2 * 1,6-12 0-4,7', 'cron:@weekly', 'cron:30 2 13 * 5') {
+	$dp->send('service.auto_up', 'job', 1, $ok);
+	$dp->recv_ok( qr/^service.auto_up\tjob\t1\t\Q$ok\E$/m, "accept '$ok'" );
+}
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.auto_up\tjob\t1\tcron:30 2 13 \* 5$/m, 'cron trigger in statedump' );
+
+# Starting by hand and cancelling keeps the schedule
+$dp->send('service.start', 'job');
+$dp->recv_ok( qr/^service.state\tjob\tup/m, 'manual start' );
+$dp->send('service.signal', 'job', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tjob\tdown/m, 'down again, not restarted by cron' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+# On the virtual clock (1000 = 1970-01-01 00:16:40 UTC), check when it fires
+$ENV{TZ}= 'UTC';
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '--simulate');
+$dp->timeout(5);
+$dp->send('sim.exit', 'job', 10, 'exit', 0);
+$dp->send('service.args', 'job', 'true');
+$dp->send('service.auto_up', 'job', 1, 'cron:*/5 * * * *');
+$dp->send('sim.advance', 600);
+$dp->recv_ok( qr/^service.state\tjob\tup\t1200\t/m, 'first run at 00:20' );
+$dp->recv_ok( qr/^service.state\tjob\tup\t1500\t/m, 'next run at 00:25' );
+$dp->recv_ok( qr/^sim.time\t1600$/m, 'clock' );
+unlike( $dp->{last_input_removed}, qr/\tup\t1800\t/, 'not early' );
+
+# Day 31 is the top bit of the day mask; February and April are skipped
+$dp->send('service.auto_up', 'job', 1, 'cron:0 0 31 * *');
+$dp->send('sim.advance', 8000000);
+$dp->recv_ok( qr/^service.state\tjob\tup\t2592000\t/m, 'runs on Jan 31' );
+$dp->recv_ok( qr/^service.state\tjob\tup\t7689600\t/m, 'then on Mar 31' );
+$dp->recv_ok( qr/^sim.time\t8001600$/m, 'clock' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
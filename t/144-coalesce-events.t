@@ -0,0 +1,41 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp;
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '--coalesce-events');
+$dp->timeout(3);
+
+$dp->send('event.coalesce', 2);
+$dp->recv_ok( qr/^error.*event.coalesce/m, 'invalid value rejected' );
+
+$dp->send('service.args', 'foo', 'perl', '-e', 'select(undef,undef,undef,1.2); exit 3');
+$dp->send('service.auto_up', 'foo', 1, 'always');
+$dp->recv_ok( qr/^service.state\tfoo\t(\w+)\t.*\t(\d+)\t(\S+)\t(\S+)$/m, 'first event' );
+is_deeply( $dp->last_captures, [ 'up', 0, '-', '-' ], 'started once, no previous run' );
+
+# Exit and immediate restart are reported as a single 'up' event
+$dp->recv_ok( qr/^service.state\tfoo\t(\w+)\t.*\t(\d+)\t(\S+)\t(\S+)$/m, 'next event' );
+is_deeply( $dp->last_captures, [ 'up', 1, 'exit', 3 ], 'restart coalesced, exit preserved' );
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t.*\t\d+\texit\t3$/m, 'statedump has extra fields' );
+
+# Without coalescing, every transition is reported again
+$dp->send('event.coalesce', 0);
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t\d+\texit\t3\t\d+\t\d+$/m, 'down' );
+$dp->recv_ok( qr/^service.state\tfoo\tstart\t/m, 'start' );
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t\d+\t-\t-\t\d+\t-$/m, 'up' );
+
+$dp->send('service.auto_up', 'foo', '-');
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
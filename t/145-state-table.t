@@ -0,0 +1,70 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp= Test::DaemonProxy->new;
+my $path= $dp->temp_path . '/145-state-table.bin';
+unlink $path;
+$dp->run('-i', '--state-table', $path);
+$dp->timeout(3);
+
+# Read the table the way a monitoring tool would, honoring the seqlocks
+sub read_table {
+	open my $fh, '<', $path or die "open($path): $!";
+	local $/;
+	my $data= <$fh>;
+	my ($magic, $version, $hsize, $rsize, $cap, $seq)= unpack('Z8 L5', $data);
+	my %svc;
+	for my $i (0 .. $cap-1) {
+		my ($rseq, $state, $pid, $wstat, $up, $reap, $restarts, $name)=
+			unpack('L L l l q q L x4 Z32', substr($data, $hsize + $i * $rsize, $rsize));
+		next if $rseq & 1 or !$state;
+		$svc{$name}= { state => $state, pid => $pid, wstat => $wstat, restarts => $restarts };
+	}
+	return { magic => $magic, version => $version, record_size => $rsize, capacity => $cap, svc => \%svc };
+}
+
+$dp->send('echo', '-ready-');
+$dp->recv_ok( qr/^-ready-$/m, 'started' );
+
+my $t= read_table();
+is( $t->{magic}, 'dpstate', 'magic' );
+is( $t->{version}, 1, 'version' );
+is( $t->{record_size}, 72, 'record size' );
+is_deeply( $t->{svc}, {}, 'no services' );
+
+$dp->send('service.args', 'foo', 'perl', '-e', 'sleep 100');
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t(\d+)/m, 'foo up' );
+my ($pid)= @{ $dp->last_captures };
+$t= read_table();
+is( $t->{svc}{foo}{state}, 3, 'published as up' );
+is( $t->{svc}{foo}{pid}, $pid, 'pid published' );
+
+$dp->send('service.signal', 'foo', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tfoo\tdown/m, 'foo down' );
+$t= read_table();
+is( $t->{svc}{foo}{state}, 1, 'published as down' );
+is( $t->{svc}{foo}{wstat} & 0x7F, 15, 'exit signal published' );
+
+# Enough services to make the table grow
+$dp->send('service.args', "s$_", 'true') for 1..100;
+$dp->send('service.delete', 's100');
+$dp->send('echo', '-marker-');
+$dp->recv_ok( qr/^-marker-$/m, 'services created' );
+$t= read_table();
+ok( $t->{capacity} >= 100, 'table grew' );
+is( scalar keys %{ $t->{svc} }, 100, 'all services published' );
+ok( !$t->{svc}{s100}, 'deleted service removed' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $path;
+
+done_testing;
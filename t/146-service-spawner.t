@@ -0,0 +1,66 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--spawner');
+$dp->timeout(3);
+
+my $fname= $dp->temp_path . '/146-spawner.out';
+unlink $fname;
+
+# Output through a named FD proves the descriptors were passed along
+$dp->send('fd.open', 'out', 'write,create,trunc', $fname);
+$dp->send('service.fds', 'foo', 'null', 'out', 'out');
+$dp->send('service.args', 'foo', 'perl', '-e', '$|=1; print "hello\n"; sleep 100');
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t(\d+)/m, 'service up' );
+my ($pid)= @{ $dp->last_captures };
+
+# Once the helper's intermediate child exits, the service belongs to daemonproxy
+my $ppid;
+for (1..20) {
+	open my $fh, '<', "/proc/$pid/stat" or last;
+	($ppid)= (scalar <$fh>) =~ /^\d+ \(.*?\) \S (\d+)/;
+	last if $ppid == $dp->pid;
+	sleep .1;
+}
+is( $ppid, $dp->pid, 'service was adopted by daemonproxy' );
+
+for (1..20) { last if -s $fname; sleep .1; }
+open my $fh, '<', $fname or die "open($fname): $!";
+is( scalar <$fh>, "hello\n", 'service wrote to its descriptor' );
+
+$dp->send('service.signal', 'foo', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t$pid\tsignal\tSIGTERM\t/m, 'service reaped by daemonproxy' );
+
+# Control socket descriptors are passed as well
+$dp->send('service.fds', 'bar', 'null', 'control.cmd', 'null');
+$dp->send('service.args', 'bar', 'perl', '-e', '$|=1; print "service.tags\tbar\tfrom-bar\n"; sleep 100');
+$dp->send('service.start', 'bar');
+$dp->recv_ok( qr/^service.tags\tbar\tfrom-bar$/m, 'service used control.cmd' );
+$dp->send('service.signal', 'bar', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tbar\tdown/m, 'bar stopped' );
+
+# A helper which stops answering is given up on, and the service forked directly
+my ($helper)= grep { $_ != $pid } map { /(\d+)/ } do {
+	open my $ch, '<', "/proc/".$dp->pid."/task/".$dp->pid."/children" or die "children: $!";
+	split ' ', scalar <$ch>;
+};
+ok( $helper && kill('STOP', $helper), 'stopped the spawner helper' );
+$dp->send('service.start', 'bar');
+$dp->recv_ok( qr/^service.tags\tbar\tfrom-bar$/m, 'service started without the helper' );
+$dp->send('service.signal', 'bar', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tbar\tdown/m, 'bar stopped again' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $fname;
+
+done_testing;
@@ -0,0 +1,56 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use File::Copy 'copy';
+
+my ($echo)= grep { -x $_ } '/bin/echo', '/usr/bin/echo';
+my ($false)= grep { -x $_ } '/bin/false', '/usr/bin/false';
+plan skip_all => 'need echo and false binaries' unless $echo && $false;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+my $prog= $dp->temp_path . '/147-prog';
+unlink $prog;
+
+# A missing executable is reported when the arguments are assigned
+$dp->send('service.args', 'foo', 'no-such-program-147');
+$dp->recv_stderr_ok( qr/can't find executable "no-such-program-147"/, 'missing executable reported' );
+
+copy($echo, $prog) && chmod(0755, $prog) or die "copy: $!";
+$dp->send('service.args', 'foo', $prog, 'one');
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t.*\texit\t0\t/m, 'ran cached executable' );
+
+# Replacing the file by rename (like a package upgrade) is noticed at start
+copy($false, "$prog.new") && chmod(0755, "$prog.new") or die "copy: $!";
+rename("$prog.new", $prog) or die "rename: $!";
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t.*\texit\t1\t/m, 'ran replacement executable' );
+
+# Names are resolved through PATH
+$dp->send('service.args', 'bar', 'true');
+$dp->send('service.start', 'bar');
+$dp->recv_ok( qr/^service.state\tbar\tdown\t.*\texit\t0\t/m, 'ran executable from PATH' );
+
+# Idle services don't hold a handle of their executable
+sub fd_count { opendir my $d, "/proc/".$dp->pid."/fd" or die "opendir: $!"; scalar grep { /^\d/ } readdir $d }
+$dp->send('echo', 'sync1');
+$dp->recv_ok( qr/^sync1$/m, 'sync' );
+my $before= fd_count();
+$dp->send('service.args', "idle$_", 'true') for 1..20;
+$dp->send('echo', 'sync2');
+$dp->recv_ok( qr/^sync2$/m, 'sync' );
+is( fd_count(), $before, 'no descriptors held for idle services' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $prog;
+
+done_testing;
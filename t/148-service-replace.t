@@ -0,0 +1,87 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(5);
+
+$dp->send('service.replace', 'foo');
+$dp->recv_ok( qr/^error\tNo such service/m, 'unknown service' );
+
+$dp->send('service.args', 'foo', 'sleep', '100');
+$dp->send('service.replace', 'foo');
+$dp->recv_ok( qr/^error\tservice is not running/m, 'service must be running' );
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t(\d+)/m, 'foo up' );
+my ($pid1)= @{ $dp->last_captures };
+
+$dp->send('service.replace', 'foo', 30);
+$dp->recv_ok( qr/^service.replace\tfoo\tstarted\t(\d+)\t-$/m, 'replacement started' );
+my ($pid2)= @{ $dp->last_captures };
+isnt( $pid2, $pid1, 'new pid' );
+ok( kill(0, $pid1), 'old instance still running' );
+$dp->send('service.ready', 'foo');
+$dp->recv_ok( qr/^service.replace\tfoo\tpromoted\t$pid2\t-$/m, 'promoted when ready' );
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t$pid2\t/m, 'service.state reports new pid' );
+ok( !$dp->recv(qr/^service.state\tfoo\tdown/m), 'no down event' );
+for (1..20) { last unless kill(0, $pid1); sleep .1; }
+ok( !kill(0, $pid1), 'old instance was terminated' );
+$dp->send('service.signal', 'foo', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tfoo\tdown/m, 'foo stopped' );
+
+# Without service.ready, the grace period decides
+$dp->send('service.args', 'bar', 'sleep', '100');
+$dp->send('service.start', 'bar');
+$dp->recv_ok( qr/^service.state\tbar\tup\t\d+\t(\d+)/m, 'bar up' );
+($pid1)= @{ $dp->last_captures };
+$dp->send('service.replace', 'bar', 1);
+$dp->recv_ok( qr/^service.replace\tbar\tstarted\t(\d+)/m, 'replacement started' );
+($pid2)= @{ $dp->last_captures };
+$dp->recv_ok( qr/^service.replace\tbar\tpromoted\t$pid2\t-$/m, 'promoted after grace period' );
+
+# A replacement which dies leaves the old instance running
+$dp->send('service.args', 'bar', 'sh', '-c', 'exit 3');
+$dp->send('service.replace', 'bar', 30);
+$dp->recv_ok( qr/^service.replace\tbar\tfailed\t\d+\texit 3$/m, 'replacement failed' );
+ok( kill(0, $pid2), 'current instance still running' );
+
+# If the old instance exits during the grace period, the new one takes over
+$dp->send('service.args', 'bar', 'sleep', '100');
+$dp->send('service.replace', 'bar', 30);
+$dp->recv_ok( qr/^service.replace\tbar\tstarted\t(\d+)/m, 'replacement started' );
+my ($pid3)= @{ $dp->last_captures };
+$dp->send('service.signal', 'bar', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tbar\tdown\t\d+\t$pid2\t/m, 'old instance reported down' );
+$dp->recv_ok( qr/^service.state\tbar\tup\t\d+\t$pid3\t/m, 'new instance took over' );
+
+$dp->send('service.replace', 'bar', '2147483648');
+$dp->recv_ok( qr/^error\tinvalid grace period/m, 'grace period out of range' );
+
+# While the retired instance is still running, another replace is refused
+$dp->send('service.replace', 'bar', 0, 'SIGCONT');
+$dp->recv_ok( qr/^service.replace\tbar\tpromoted\t(\d+)/m, 'promoted, old instance ignored its signal' );
+my ($pid4)= @{ $dp->last_captures };
+$dp->send('service.replace', 'bar', 0);
+$dp->recv_ok( qr/^error\treplacement already in progress/m, 'second replace refused' );
+kill KILL => $pid3;
+for (1..20) { last unless kill(0, $pid3); sleep .1; }
+$dp->send('service.history', 'bar');
+$dp->recv_ok( qr/^service.history\tbar\t.*\t$pid3\t/m, 'retired run recorded' );
+$dp->send('service.replace', 'bar', 0);
+$dp->recv_ok( qr/^service.replace\tbar\tpromoted\t(\d+)/m, 'replace allowed once it exited' );
+isnt( $dp->last_captures->[0], $pid4, 'new instance' );
+kill KILL => $pid4;
+
+$dp->send('service.signal', 'bar', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tbar\tdown/m, 'bar stopped' );
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
@@ -0,0 +1,108 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+# Find the standby: a child of daemonproxy which hasn't exec'd
+sub standby_pid {
+	my ($exclude)= @_;
+	for (1..20) {
+		for my $stat (glob '/proc/[0-9]*/stat') {
+			open my $fh, '<', $stat or next;
+			my ($pid, $comm, $ppid)= (scalar <$fh>) =~ /^(\d+) \((.*?)\) \S (\d+)/ or next;
+			return $pid if $ppid == $dp->pid && $comm eq 'daemonproxy' && (!$exclude || $pid != $exclude);
+		}
+		sleep .1;
+	}
+	return undef;
+}
+
+$dp->send('service.args', 'foo', 'sleep', '100');
+$dp->send('service.spare', 'foo', 2);
+$dp->recv_ok( qr/^error\texpected 0 or 1/m, 'invalid setting' );
+$dp->send('service.spare', 'foo', 1);
+$dp->recv_ok( qr/^service.spare\tfoo\t1$/m, 'spare enabled' );
+$dp->send('service.auto_up', 'foo', '1', 'always');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t(\d+)/m, 'service up' );
+my ($pid)= @{ $dp->last_captures };
+
+my $spare= standby_pid();
+ok( $spare, 'standby was forked' );
+
+# When the service dies, the standby becomes the new instance
+$dp->send('service.signal', 'foo', 'SIGKILL');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t(\d+)/m, 'service restarted' );
+my ($pid2)= @{ $dp->last_captures };
+is( $pid2, $spare, 'restart used the standby' );
+
+my $spare2= standby_pid($spare);
+ok( $spare2 && $spare2 != $spare, 'next standby was forked' );
+
+# Changing the arguments replaces the standby
+$dp->send('service.args', 'foo', 'sleep', '101');
+my $spare3= standby_pid($spare2);
+ok( $spare3 && $spare3 != $spare2, 'standby replaced after service.args' );
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.spare\tfoo\t1$/m, 'listed by statedump' );
+
+$dp->send('service.spare', 'foo', 0);
+$dp->recv_ok( qr/^service.spare\tfoo\t0$/m, 'spare disabled' );
+
+# Deleting a handle only replaces the standbys of services which name it
+sub standby_pids {
+	my @pids;
+	for my $stat (glob '/proc/[0-9]*/stat') {
+		open my $fh, '<', $stat or next;
+		my ($pid, $comm, $ppid)= (scalar <$fh>) =~ /^(\d+) \((.*?)\) \S (\d+)/ or next;
+		push @pids, $pid if $ppid == $dp->pid && $comm eq 'daemonproxy';
+	}
+	return sort @pids;
+}
+$dp->send('fd.open', 'xout', 'write,create', $dp->temp_path . '/149-x.out');
+for my $name (qw( uses-x no-x )) {
+	$dp->send('service.args', $name, 'sleep', '100');
+	$dp->send('service.fds', $name, 'null', $name eq 'uses-x'? 'xout' : 'null', 'null');
+	$dp->send('service.spare', $name, 1);
+	$dp->send('service.start', $name);
+	$dp->recv_ok( qr/^service.state\t$name\tup/m, "$name up" );
+}
+my @before;
+for (1..20) { last if (@before= standby_pids()) == 2; sleep .1; }
+is( scalar @before, 2, 'two standbys' );
+$dp->send('fd.delete', 'xout');
+$dp->recv_ok( qr/^fd.state\txout\tdeleted/m, 'handle deleted' );
+my @after;
+for (1..20) { last if (@after= standby_pids()) == 1; sleep .1; }
+is( scalar(grep { my $p= $_; grep { $_ == $p } @before } @after), 1, 'standby of the other service kept' );
+$dp->send('service.signal', $_, 'SIGKILL') for qw( uses-x no-x );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+# With --spawner, services are started by the helper, and no standby is kept
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '--spawner');
+$dp->timeout(3);
+# (the helper is also a child named daemonproxy)
+my $helper= standby_pid();
+$dp->send('service.args', 'foo', 'sleep', '100');
+$dp->send('service.spare', 'foo', 1);
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t\d+\t(\d+)/m, 'service up with spawner' );
+$dp->send('echo', 'sync');
+$dp->recv_ok( qr/^sync$/m, 'sync' );
+ok( $helper && !defined standby_pid($helper), 'no standby with spawner' );
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
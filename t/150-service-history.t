@@ -0,0 +1,53 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+$dp->send('service.history', 'foo');
+$dp->recv_ok( qr/^error\tno such service/mi, 'unknown service' );
+
+$dp->send('service.args', 'foo', 'sh', '-c', 'exit $0', 0);
+$dp->send('service.history', 'foo');
+$dp->send('echo', '-marker1-');
+$dp->recv_ok( qr/^-marker1-$/m, 'marker' );
+unlike( $dp->{last_input_removed}, qr/^service.history/m, 'no history before the first run' );
+
+# Run it 10 times, with a different exit code each time
+my @pids;
+for my $code (1..10) {
+	$dp->send('service.args', 'foo', 'sh', '-c', 'exit $0', $code);
+	$dp->send('service.start', 'foo');
+	$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t(\d+)\texit\t$code\t/m, "run $code exited" );
+	push @pids, $dp->last_captures->[0];
+}
+
+$dp->send('service.history', 'foo');
+my @runs;
+for (3..10) {
+	$dp->recv_ok( qr/^service.history\tfoo\t(\d+)\t(\d+)\t(\d+)\t(\w+)\t(\S+)\t(\d+)\t(\d+)$/m, "history line" );
+	push @runs, [ @{ $dp->last_captures } ];
+}
+is_deeply( [ map { $_->[2] } @runs ], [ @pids[2..9] ], 'last 8 runs, oldest first' );
+is_deeply( [ map { $_->[4] } @runs ], [ 3..10 ], 'exit codes recorded' );
+ok( $runs[-1][6] > 0, 'peak RSS recorded' );
+
+$dp->send('service.args', 'foo', 'sleep', '100');
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tup/m, 'up' );
+$dp->send('service.signal', 'foo', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tfoo\tdown/m, 'down' );
+$dp->send('service.history', 'foo');
+$dp->recv_ok( qr/^service.history\tfoo\t\d+\t\d+\t\d+\tsignal\tSIGTERM\t\d+\t\d+$/m, 'signal recorded' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
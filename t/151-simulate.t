@@ -0,0 +1,57 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+$dp->send('sim.advance', 1);
+$dp->recv_ok( qr/^error\tnot running with --simulate/m, 'sim commands need --simulate' );
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '--simulate');
+$dp->timeout(2);
+
+# Each run exits 3 after two seconds; restarts are held back by auto_up's interval
+$dp->send('sim.exit', 'foo', 2, 'exit', 3);
+$dp->send('service.args', 'foo', 'false');
+$dp->send('service.auto_up', 'foo', 5, 'always');
+$dp->recv_ok( qr/^service.state\tfoo\tup\t1000\t(\d+)/m, 'up on virtual clock' );
+my ($pid)= @{ $dp->last_captures };
+cmp_ok( $pid, '>=', 0x400000, 'pretend pid is outside the kernel range' );
+
+$dp->send('sim.advance', 2);
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t1002\t$pid\texit\t3\t2\t/m, 'scripted exit' );
+$dp->recv_ok( qr/^service.state\tfoo\tstart\t1007\t/m, 'restart delayed by interval' );
+$dp->recv_ok( qr/^sim.time\t1002$/m, 'clock stopped at target' );
+unlike( $dp->{last_input_removed}, qr/\tup\t/, 'not restarted yet' );
+
+$dp->send('sim.advance', 5);
+$dp->recv_ok( qr/^service.state\tfoo\tup\t1007\t(\d+)/m, 'restarted at 1007' );
+$dp->recv_ok( qr/^sim.time\t1007$/m, 'clock' );
+$dp->send('sim.exit', 'foo');
+
+# The run started before the script was cleared still exits; the next one doesn't
+$dp->send('sim.advance', 3600);
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t1009\t/m, 'earlier script still applied' );
+$dp->recv_ok( qr/^service.state\tfoo\tup\t1014\t(\d+)/m, 'started again' );
+($pid)= @{ $dp->last_captures };
+$dp->recv_ok( qr/^sim.time\t4607$/m, 'hour passed' );
+unlike( $dp->{last_input_removed}, qr/\tdown\t/, 'unscripted run keeps running' );
+
+$dp->send('service.auto_up', 'foo', 5);
+$dp->send('service.signal', 'foo', 'SIGTERM');
+$dp->recv_ok( qr/^service.state\tfoo\tdown\t4607\t$pid\tsignal\tSIGTERM\t/m, 'signal ends pretend process' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
@@ -0,0 +1,42 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+my $fname= $dp->temp_path . '/152-session-record.txt';
+unlink $fname;
+$dp->run('-i', '--record-sessions', $fname);
+$dp->timeout(2);
+
+$dp->send('service.args', 'foo', 'true');
+$dp->recv_ok( qr/^service.args\tfoo\ttrue$/m, 'command ran' );
+$dp->send('service.tags', 'foo', 'a', 'b');
+$dp->send('echo', 'marker');
+$dp->recv_ok( qr/^marker$/m, 'echo' );
+# ending the interactive session ends daemonproxy
+$dp->send('exit');
+$dp->exit_is( 0 );
+
+open my $fh, '<', $fname or die "open($fname): $!";
+my @lines= <$fh>;
+close $fh;
+like( $lines[0], qr/^# daemonproxy session record 1$/, 'header' );
+like( $lines[1], qr/^\d+\.\d{6}\t1\topen$/, 'session opened' );
+my @cmds= map { /^[\d.]+\t1\tcmd\t(.*)$/? ($1) : () } @lines;
+is_deeply( \@cmds, [ "service.args\tfoo\ttrue", "service.tags\tfoo\ta\tb", "echo\tmarker", "exit" ], 'commands recorded' );
+ok( (grep { /^[\d.]+\t1\tread\t\d+$/ } @lines), 'event reads recorded' );
+like( $lines[-1], qr/^[\d.]+\t1\tclose$/, 'session closed' );
+
+# Play it back against a simulated daemonproxy
+my $report= `$^X $FindBin::Bin/../scripts/replay_session.pl --fast --simulate --daemonproxy ${\ $dp->binary_path} $fname 2>/dev/null`;
+like( $report, qr/^commands\s+4$/m, 'replayed all commands' );
+like( $report, qr/^errors\s+0$/m, 'no errors' );
+like( $report, qr/^overflows\s+0$/m, 'no overflows' );
+
+unlink $fname;
+done_testing;
@@ -0,0 +1,49 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+my $fname= $dp->temp_path . '/153-flight.txt';
+unlink $fname;
+$dp->run('-i');
+$dp->timeout(2);
+
+$dp->send('service.args', 'foo', 'sh', '-c', 'exit 3');
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tdown.*exit\t3/m, 'foo ran' );
+
+$dp->send('flight.dump');
+$dp->send('echo', 'done');
+$dp->recv_ok( qr/(.*)^done$/ms, 'flight.dump' );
+my $dump= $dp->last_captures->[0];
+like( $dump, qr/^flight\t[\d.]+\tcmd\t\d+\t0\tservice.args\tfoo\tsh\t-c\texit 3$/m, 'command recorded' );
+like( $dump, qr/^flight\t[\d.]+\tfork\t(\d+)\t0\tfoo$/m, 'fork recorded' );
+my ($pid)= $dump =~ /^flight\t[\d.]+\tfork\t(\d+)/m;
+like( $dump, qr/^flight\t[\d.]+\tstate.up\t$pid\t0\tfoo$/m, 'state change recorded' );
+like( $dump, qr/^flight\t[\d.]+\treap\t$pid\t768\t$/m, 'reap recorded' );
+like( $dump, qr/^flight\t[\d.]+\tloop\t/m, 'main loop recorded' );
+
+$dp->send('flight.dest', 'nonsense');
+$dp->recv_ok( qr/^error/m, 'bad destination rejected' );
+
+# A fatal exit writes the record to the chosen fd
+$dp->send('fd.open', 'flight', 'write,create,trunc', $fname);
+$dp->send('flight.dest', 'fd', 'flight');
+$dp->send('terminate.exec_args', 'sh', '-c', 'exit 42');
+$dp->send('terminate', 5);
+$dp->exit_is( 42, 'exec on exit' );
+
+open my $fh, '<', $fname or die "open($fname): $!";
+my @lines= <$fh>;
+close $fh;
+like( $lines[0], qr/^flight recorder: \d+ entries$/, 'header' );
+ok( (grep { /^[\d.]+\tcmd\t\d+\t0\tterminate\t5$/ } @lines), 'last command written' );
+like( $lines[-1], qr/^[\d.]+\tfatal\t5\t0\tterminated normally$/, 'fatal entry last' );
+
+unlink $fname;
+done_testing;
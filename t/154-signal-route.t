@@ -0,0 +1,56 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+for my $name (qw( web1 web2 db )) {
+	$dp->send('service.args', $name, 'sleep', 30);
+	$dp->send('service.tags', $name, $name eq 'db'? 'db' : 'web');
+	$dp->send('service.start', $name);
+	$dp->recv_ok( qr/^service.state\t$name\tup/m, "$name up" );
+}
+
+$dp->send('signal.route', 'SIGUSR1', 'tag:web', 'SIGTERM');
+$dp->send('signal.route', 'SIGUSR2', 'db', 'SIGKILL', 'group');
+# replacing a route replaces its flags (these services don't lead a process group)
+$dp->send('signal.route', 'SIGUSR2', 'db', 'SIGKILL');
+$dp->send('signal.route', 'SIGHUP', '*', 'SIGTERM');
+$dp->send('signal.route', 'SIGHUP', '*', '-');
+$dp->send('signal.route');
+$dp->send('echo', 'done');
+$dp->recv_ok( qr/(.*)^done$/ms, 'routes listed' );
+is( join('', $dp->last_captures->[0] =~ /^(signal.route\t.*\n)/mg),
+	"signal.route\tSIGUSR1\ttag:web\tSIGTERM\t-\n"
+	."signal.route\tSIGUSR2\tdb\tSIGKILL\t-\n",
+	'route table' );
+
+$dp->send('signal.route', 'SIGUSR1', 'tag:', 'SIGTERM');
+$dp->recv_ok( qr/^error.*selector/m, 'empty tag rejected' );
+$dp->send('signal.route', 'SIGUSR1', 'web1', 'SIGTERM', 'nonsense');
+$dp->recv_ok( qr/^error.*unknown option/m, 'bad flag rejected' );
+
+kill USR1 => $dp->pid;
+# the two may be reaped in either order
+$dp->recv_ok( qr/^service.state\t(web[12])\tdown.*signal\tSIGTERM/m, 'first web got SIGTERM' );
+my $other= $dp->last_captures->[0] eq 'web1'? 'web2' : 'web1';
+$dp->recv_ok( qr/^service.state\t$other\tdown.*signal\tSIGTERM/m, "$other got SIGTERM" );
+$dp->send('service.signal', 'db', 'SIGCONT');
+$dp->send('echo', 'done');
+$dp->recv_ok( qr/(.*)^done$/ms, 'db still running' );
+unlike( $dp->last_captures->[0], qr/^error/m, 'db was not signaled' );
+
+kill USR2 => $dp->pid;
+$dp->recv_ok( qr/^service.state\tdb\tdown.*signal\tSIGKILL/m, 'db got SIGKILL' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
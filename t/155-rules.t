@@ -0,0 +1,68 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+$dp->send('service.args', 'db', 'sh', '-c', 'exit 3');
+$dp->send('service.args', 'cleanup', 'true');
+for my $name (qw( app1 app2 )) {
+	$dp->send('service.args', $name, 'sleep', 30);
+	$dp->send('service.tags', $name, 'reload');
+}
+$dp->send('rule.set', 'db-crash', 'service.state', 'db', 'exit=3', 'service.start', 'cleanup');
+$dp->send('rule.set', 'db-ok', 'service.state', 'db', 'exit=0', 'service.start', 'app1');
+$dp->send('rule.set', 'reload', 'signal', 'SIGUSR1', '-', 'service.signal', 'tag:reload', 'SIGTERM');
+$dp->send('rule.set', 'bad', 'service.state', 'db', 'state=up,exit=3', 'service.start', 'cleanup');
+$dp->recv_ok( qr/^error.*state=down/m, 'conflicting conditions rejected' );
+$dp->send('rule.set', 'bad', 'service.state', 'db', '-', 'service.frobnicate', 'cleanup');
+$dp->recv_ok( qr/^error.*Unknown action/m, 'unknown action rejected' );
+$dp->send('rule.list');
+$dp->send('echo', 'done');
+$dp->recv_ok( qr/(.*)^done$/ms, 'rules listed' );
+is( join('', $dp->last_captures->[0] =~ /^(rule\t.*\n)/mg),
+	"rule\tdb-crash\tservice.state\tdb\texit=3\tservice.start\tcleanup\n"
+	."rule\tdb-ok\tservice.state\tdb\texit=0\tservice.start\tapp1\n"
+	."rule\treload\tsignal\tSIGUSR1\t-\tservice.signal\ttag:reload\tSIGTERM\n",
+	'rule table' );
+
+# db exits with 3, which starts cleanup without any command from us
+$dp->send('service.start', 'db');
+$dp->recv_ok( qr/^service.state\tdb\tdown.*exit\t3.*^service.state\tcleanup\tstart/ms,
+	'db exited 3, then cleanup started by rule' );
+$dp->recv_ok( qr/^service.state\tcleanup\tup/m, 'cleanup up' );
+$dp->recv_ok( qr/^service.state\tcleanup\tdown.*exit\t0/m, 'cleanup ran' );
+
+# A rule can restart the service whose exit triggered it
+$dp->send('service.args', 'self', 'sh', '-c', 'exit 4');
+$dp->send('rule.set', 'self', 'service.state', 'self', 'exit=4', 'service.start', 'self');
+$dp->send('service.start', 'self');
+$dp->recv_ok( qr/^service.state\tself\tdown.*exit\t4.*^service.state\tself\tstart/ms, 'self restarted by its own rule' );
+$dp->send('rule.delete', 'self');
+$dp->recv_ok( qr/^service.state\tself\tdown.*exit\t4/m, 'second run exited' );
+
+$dp->send('service.start', 'app1');
+$dp->send('service.start', 'app2');
+$dp->recv_ok( qr/^service.state\tapp1\tup.*^service.state\tapp2\tup|^service.state\tapp2\tup.*^service.state\tapp1\tup/ms,
+	'app1 and app2 up' );
+kill USR1 => $dp->pid;
+# the two may be reaped in either order
+$dp->recv_ok( qr/^service.state\t(app[12])\tdown.*signal\tSIGTERM/m, 'first app signaled by rule' );
+my $other= $dp->last_captures->[0] eq 'app1'? 'app2' : 'app1';
+$dp->recv_ok( qr/^service.state\t$other\tdown.*signal\tSIGTERM/m, "$other signaled by rule" );
+
+$dp->send('rule.delete', 'reload');
+$dp->send('rule.delete', 'reload');
+$dp->recv_ok( qr/^error.*No such rule/m, 'rule deleted' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+
+done_testing;
@@ -0,0 +1,49 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use File::Path 'remove_tree';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--fs-workers', 2);
+$dp->timeout(3);
+
+my $dir= $dp->temp_path . '/204-fd-open-worker';
+remove_tree($dir);
+my $fname= "$dir/a/b/out.txt";
+
+$dp->send('fd.open', 'temp.w', 'write,create,mkdir', $fname);
+$dp->recv_ok( qr/^fd.state\ttemp.w\tfile\t.*write.*\t\Q$fname\E$/m, 'opened through worker' );
+ok( -f $fname, 'file and directories created' );
+
+# Commands after the open are processed once it completes
+$dp->send('fd.open', 'temp.r', 'read', "$dir/missing/file");
+$dp->send('echo', '-marker-');
+$dp->recv_ok( qr/^error\topen failed: No such file or directory, for command "fd.open/m, 'error from worker' );
+$dp->recv_ok( qr/^-marker-$/m, 'next command' );
+
+# Services can use the descriptor
+$dp->send('service.fds', 'foo', 'null', 'temp.w', 'temp.w');
+$dp->send('service.args', 'foo', 'sh', '-c', 'echo hello');
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.state\tfoo\tdown/m, 'service ran' );
+open my $fh, '<', $fname or die "open($fname): $!";
+is( scalar <$fh>, "hello\n", 'service wrote to file' );
+
+# Relative paths are relative to daemonproxy's directory, not the worker's
+mkdir "$dir/cwd";
+$dp->send('chdir', "$dir/cwd");
+$dp->send('fd.open', 'rel.w', 'write,create', 'rel.txt');
+$dp->recv_ok( qr/^fd.state\trel.w\tfile\t/m, 'opened relative path' );
+ok( -f "$dir/cwd/rel.txt", 'relative to chdir' );
+$dp->send('chdir', '/');
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+remove_tree($dir);
+
+done_testing;
@@ -0,0 +1,52 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Socket;
+use Test::DaemonProxy::FdPass qw( fdpass_available recv_fds );
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/205-fd-fetch.sock';
+my $fname= $dp->temp_path . '/205-fd-fetch.txt';
+unlink $sockpath, $fname;
+$dp->run('-i', '-S', $sockpath);
+$dp->timeout(3);
+
+$dp->send('fd.open', 'parked', 'write,create,trunc', $fname);
+$dp->recv_ok( qr/^fd.state\tparked\tfile/m, 'file opened' );
+$dp->send('fd.fetch', 'parked');
+$dp->recv_ok( qr/^error\tfile descriptors can only be sent over a control socket/m, 'stdin controller rejected' );
+
+socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+connect($s, sockaddr_un($sockpath)) || die "connect: $!";
+$s->autoflush(1);
+my $reply= '';
+$s->print("fd.fetch\tnot-there\n");
+$s->print("echo\t-marker-\n");
+sysread($s, $reply, 1024, length $reply) while $reply !~ /-marker-/;
+like( $reply, qr/^error\tNo such file descriptor/m, 'unknown name' );
+
+SKIP: {
+	fdpass_available()
+		or skip 'sendmsg/recvmsg not available on this platform', 3;
+
+	$s->print("fd.fetch\tparked\n");
+	my ($buf, $fd)= recv_fds($s, 256, 4) or die "recvmsg: $!";
+	like( $buf, qr/^fd.fetch\tparked\n/, 'reply' );
+	ok( defined $fd, 'received file descriptor' );
+	open(my $fh, '>&=', $fd) or die "fdopen: $!";
+	$fh->autoflush(1);
+	print $fh "hello\n";
+	open(my $in, '<', $fname) or die "open: $!";
+	is( scalar <$in>, "hello\n", 'descriptor refers to the stored file' );
+}
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $sockpath, $fname;
+
+done_testing;
@@ -0,0 +1,64 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Socket;
+use Test::DaemonProxy::FdPass qw( fdpass_available send_fds );
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/206-fd-take.sock';
+unlink $sockpath;
+$dp->run('-i', '-S', $sockpath);
+$dp->timeout(3);
+
+$dp->send('fd.take', 'a', 'b');
+$dp->recv_ok( qr/^error\tNo ancillary file descriptor received/m, 'no descriptors' );
+
+SKIP: {
+	fdpass_available()
+		or skip 'sendmsg/recvmsg not available on this platform', 6;
+
+	socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+	connect($s, sockaddr_un($sockpath)) || die "connect: $!";
+	$s->autoflush(1);
+
+	# One message carrying 200 descriptors
+	my @fh= map { open(my $fh, '<', '/dev/null') or die "open: $!"; $fh } 1..200;
+	send_fds($s, join("\t", 'fd.take', map { "bulk$_" } 1..200)."\n", @fh)
+		or die "sendmsg: $!";
+
+	# Fewer descriptors than names
+	send_fds($s, "fd.take\ta\tb\n", $fh[0]) or die "sendmsg: $!";
+	$s->print("echo\t-marker-\n");
+
+	my $reply= '';
+	sysread($s, $reply, 65536, length $reply) while $reply !~ /-marker-/;
+	my @taken= $reply =~ /^fd.state\tbulk\d+\t/mg;
+	is( scalar @taken, 200, 'all descriptors named' );
+	like( $reply, qr/^fd.state\tbulk200\t/m, 'last name assigned' );
+	like( $reply, qr/^error\tReceived 1 file descriptors for 2 names/m, 'count mismatch' );
+
+	# Two full messages of descriptors queued up, then more names than one
+	# message can carry.  Only one message's worth is consumed.
+	for (1..2) {
+		send_fds($s, "echo\tqueued\n", ($fh[0]) x 253) or die "sendmsg: $!";
+	}
+	$s->print(join("\t", 'fd.take', map { "x$_" } 1..254)."\n");
+	$s->print(join("\t", 'fd.take', map { "rest$_" } 1..253)."\n");
+	$s->print("echo\t-marker2-\n");
+	$reply= '';
+	sysread($s, $reply, 65536, length $reply) while $reply !~ /-marker2-/;
+	like( $reply, qr/^error\tToo many names/m, 'too many names' );
+	unlike( $reply, qr/^fd.state\tx\d+\t/m, 'no names assigned' );
+	is( scalar(() = $reply =~ /^fd.state\trest\d+\t/mg), 253, 'second batch still intact' );
+}
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $sockpath;
+
+done_testing;
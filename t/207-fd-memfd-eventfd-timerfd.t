@@ -0,0 +1,58 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+my $fname= $dp->temp_path . '/207-fd-types.out';
+unlink $fname;
+$dp->send('fd.open', 'out', 'write,create,trunc', $fname);
+$dp->recv_ok( qr/^fd.state\tout\tfile/m, 'output file' );
+
+# memfd with content, more lines, then sealed
+$dp->send('fd.memfd', 'conf', '-', 'first', 'line');
+$dp->recv_ok( qr/^fd.state\tconf\tmemfd\tread,write\tsize=11$/m, 'memfd created' );
+$dp->send('fd.append', 'conf', 'second');
+$dp->recv_ok( qr/^fd.state\tconf\tmemfd\tread,write\tsize=18$/m, 'line appended' );
+$dp->send('fd.seal', 'conf');
+$dp->recv_ok( qr/^fd.state\tconf\tmemfd\tread,sealed\tsize=18$/m, 'sealed' );
+$dp->send('fd.append', 'conf', 'third');
+$dp->recv_ok( qr/^error\twrite failed: Operation not permitted/m, 'sealed memfd rejects append' );
+$dp->send('fd.memfd', 'sized', 'size=4K,seal');
+$dp->recv_ok( qr/^fd.state\tsized\tmemfd\tread,sealed\tsize=4096$/m, 'sized memfd' );
+$dp->send('fd.memfd', 'bad', 'bogus');
+$dp->recv_ok( qr/^error\tunknown flag "bogus"/m, 'unknown flag' );
+
+# A service can read the memfd, but not write it
+$dp->send('service.fds', 'cat', 'conf', 'out', 'out');
+$dp->send('service.args', 'cat', 'sh', '-c', 'cat; { echo x >&0; } 2>/dev/null || echo denied');
+$dp->send('service.start', 'cat');
+$dp->recv_ok( qr/^service.state\tcat\tdown/m, 'service ran' );
+
+# eventfd and timerfd
+$dp->send('fd.eventfd', 'ev', 'nonblock,initval=3');
+$dp->recv_ok( qr/^fd.state\tev\teventfd\tread,write,nonblock\tcounter$/m, 'eventfd created' );
+$dp->send('fd.timerfd', 'tick', 'interval=1');
+$dp->recv_ok( qr/^fd.state\ttick\ttimerfd\tread\tmonotonic,interval=1,value=1$/m, 'timerfd created' );
+$dp->send('service.fds', 'rd', 'ev', 'out', 'out', 'tick');
+$dp->send('service.args', 'rd', 'perl', '-e',
+	'sysread(STDIN, $b, 8); print "event ", unpack("Q", $b), "\n"; open(my $t, "<&=3"); sysread($t, $b, 8); print "timer ", unpack("Q", $b), "\n"');
+$dp->send('service.start', 'rd');
+$dp->recv_ok( qr/^service.state\trd\tdown\t.*\texit\t0\t/m, 'service read eventfd and timerfd' );
+
+open my $fh, '<', $fname or die "open($fname): $!";
+my $out= do { local $/; <$fh> };
+is( $out, "first\tline\nsecond\ndenied\nevent 3\ntimer 1\n", 'service output' );
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $fname;
+
+done_testing;
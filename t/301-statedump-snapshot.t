@@ -0,0 +1,59 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+use Socket;
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/301-statedump-snapshot.sock';
+unlink $sockpath;
+$dp->run('-i', '-S', $sockpath);
+$dp->timeout(5);
+
+# Enough services that the statedump has to pause many times
+my $n= 120;
+my $filler= 'x' x 900;
+$dp->send('service.args', sprintf('s%03d', $_), 'true', $filler) for 1..$n;
+$dp->send('echo', '-marker-');
+$dp->recv_ok( qr/^-marker-$/m, 'services created' );
+
+socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+connect($s, sockaddr_un($sockpath)) || die "connect: $!";
+$s->autoflush(1);
+
+# Start a statedump, then delete and create services while it is paused
+$dp->send('statedump');
+$dp->send('echo', '-done-');
+sleep .5;
+$s->print("service.delete\ts$_\n") for map { sprintf('s%03d', $_) } 2..$n;
+$s->print("service.args\tnew\ttrue\n");
+
+my $out= '';
+$dp->dp_stdout->blocking(0);
+my $idle= 0;
+while ($out !~ /^-done-$/m && $idle < 50) {
+	my $got= sysread($dp->dp_stdout, $out, 65536, length $out);
+	if ($got) { $idle= 0 } else { ++$idle; sleep .1; }
+}
+$dp->dp_stdout->blocking(1);
+like( $out, qr/^-done-$/m, 'statedump completed' );
+
+my @lines= split /\n/, $out;
+is( scalar(grep { /^service.args\tnew\t/ } @lines), 1, 'service created during dump reported once' );
+is( scalar(grep { /^service.args\ts001\t/ } @lines), 1, 'surviving service dumped' );
+my @late= grep {
+	my ($name)= $lines[$_] =~ /^service.state\t(s\d+)\tdeleted/;
+	$name && grep { /^service.\w+\t$name\t(?!deleted)/ } @lines[$_+1 .. $#lines]
+} 0..$#lines;
+is( scalar @late, 0, 'nothing dumped for a service after its deletion' );
+
+$s->print("terminate\t0\n");
+$dp->exit_is( 0 );
+unlink $sockpath;
+
+done_testing;
@@ -0,0 +1,57 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+use Socket;
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/410-event-priority.sock';
+unlink $sockpath;
+$dp->run('-i', '-S', $sockpath);
+$dp->timeout(5);
+
+# Enough services that a statedump fills the stdout pipe and both lanes
+my $n= 120;
+my $filler= 'x' x 900;
+$dp->send('service.args', sprintf('s%03d', $_), 'true', $filler) for 1..$n;
+$dp->send('echo', '-marker-');
+$dp->recv_ok( qr/^-marker-$/m, 'services created' );
+
+socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+connect($s, sockaddr_un($sockpath)) || die "connect: $!";
+$s->autoflush(1);
+
+# Block the statedump by not reading, then generate events from elsewhere
+$dp->send('statedump');
+sleep .5;
+kill USR1 => $dp->pid;
+$s->print("service.tags\ts$n\tnewtag\n");
+sleep .5;
+
+my $out= '';
+while ($out !~ /^signal\tSIGUSR1\t.*\n(?:.*\n)*service.args\ts$n\t.*\n(?:.*\n)*signal\tSIGUSR1\t/m) {
+	$dp->dp_stdout->blocking(0);
+	my $got= sysread($dp->dp_stdout, $out, 65536, length $out);
+	last if defined $got && !$got;
+	sleep .1 unless $got;
+	last if length $out > 1_000_000;
+}
+my @lines= split /\n/, $out;
+my ($first_sig)= grep { $lines[$_] =~ /^signal\tSIGUSR1\t/ } 0..$#lines;
+my ($last_svc)= grep { $lines[$_] =~ /^service.args\ts$n\t/ } reverse 0..$#lines;
+ok( defined $first_sig && defined $last_svc && $first_sig < $last_svc, 'signal event went ahead of statedump' );
+
+my ($new_tag)= grep { $lines[$_] =~ /^service.tags\ts$n\tnewtag$/ } 0..$#lines;
+ok( defined $new_tag, 'tags event delivered' );
+ok( !grep({ $lines[$_] =~ /^service.tags\ts$n\t$/ } $new_tag+1 .. $#lines), 'no stale statedump line after the event' );
+
+$s->print("terminate\t0\n");
+$dp->exit_is( 0 );
+unlink $sockpath;
+
+done_testing;
@@ -0,0 +1,68 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+use Socket;
+use Test::DaemonProxy::FdPass qw( fdpass_available recv_fds );
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/411-event-ring.sock';
+unlink $sockpath;
+$dp->run('-i', '-S', $sockpath);
+$dp->timeout(3);
+
+$dp->send('event.ring');
+$dp->recv_ok( qr/^error\tfile descriptors can only be sent over the control socket/m, 'stdin controller rejected' );
+
+SKIP: {
+	fdpass_available()
+		or skip 'sendmsg/recvmsg not available on this platform', 8;
+
+	socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+	connect($s, sockaddr_un($sockpath)) || die "connect: $!";
+	$s->autoflush(1);
+
+	$s->print("event.ring\t100\n");
+	$s->print("echo\t-marker-\n");
+	my $reply= '';
+	sysread($s, $reply, 1024) while $reply !~ /-marker-/;
+	like( $reply, qr/^error\tinvalid size/m, 'tiny ring rejected' );
+
+	$s->print("event.ring\t8192\n");
+	my ($buf, $memfd, $eventfd)= recv_fds($s, 256, 4) or die "recvmsg: $!";
+	like( $buf, qr/^event.ring\t(\d+)\n/, 'reply' );
+	ok( defined $eventfd, 'received two file descriptors' );
+
+	$dp->send('service.args', 'foo', 'true');
+	$dp->recv_ok( qr/^service.args\tfoo\ttrue$/m, 'event' );
+
+	open(my $ring, '<&=', $memfd) or die "fdopen: $!";
+	my $data= do { local $/; <$ring> };
+	my ($magic, $version, $hsize, $dsize, $waiters, $head)= unpack('Z8 L4 Q', $data);
+	is( $magic, 'dpring', 'ring magic' );
+	my $len= unpack('L', substr($data, $hsize, 4));
+	is( substr($data, $hsize + 4, $len), "service.args\tfoo\ttrue\n", 'event recorded in ring' );
+
+	# A consumer scribbling over the header must not steer the writer
+	open(my $rw, '+<&=', $memfd) or die "fdopen: $!";
+	sysseek($rw, 16, 0) or die "seek: $!";
+	syswrite($rw, pack('L L Q', 0, 0, 0xFFFFFFF0)) or die "write: $!";
+	$dp->send('service.args', 'foo', 'false');
+	$dp->recv_ok( qr/^service.args\tfoo\tfalse$/m, 'still running after corrupt header' );
+	sysseek($rw, 0, 0);
+	sysread($rw, $data, 65536);
+	my $ofs= $hsize + 4 + (($len + 3) & ~3);
+	$len= unpack('L', substr($data, $ofs, 4));
+	is( substr($data, $ofs + 4, $len), "service.args\tfoo\tfalse\n", 'next event appended after the first' );
+}
+
+$dp->send('terminate', 0);
+$dp->exit_is( 0 );
+unlink $sockpath;
+
+done_testing;
@@ -0,0 +1,82 @@
+package Test::DaemonProxy::FdPass;
+use strict;
+use warnings;
+use Socket qw( SOL_SOCKET SCM_RIGHTS );
+use Config;
+use Carp;
+use Exporter 'import';
+our @EXPORT_OK= qw( fdpass_available send_fds recv_fds );
+
+# Minimal sendmsg/recvmsg wrappers for passing descriptors over the control
+# socket.  These go straight to syscall() so that the SCM_RIGHTS tests don't
+# depend on Socket::MsgHdr or any other non-core module.  The structures are
+# the Linux LP64 layout:
+#
+#   struct iovec   { void *base; size_t len; }
+#   struct msghdr  { void *name; int namelen; struct iovec *iov; size_t iovlen;
+#                    void *control; size_t controllen; int flags; }
+#   struct cmsghdr { size_t len; int level; int type; int data[]; }
+
+my ($SYS_sendmsg, $SYS_recvmsg);
+
+sub fdpass_available {
+	return 1 if defined $SYS_recvmsg;
+	return 0 unless $^O eq 'linux' && $Config{ptrsize} == 8;
+	eval {
+		require 'syscall.ph';
+		($SYS_sendmsg, $SYS_recvmsg)= (SYS_sendmsg(), SYS_recvmsg());
+		1;
+	};
+	return defined $SYS_recvmsg;
+}
+
+sub _addr { unpack('J', pack('P', $_[0])) }
+
+sub _align { ($_[0] + 7) & ~7 }
+
+sub _msghdr {
+	my ($iov, $control)= @_;
+	pack('J i x4 J J J J i x4', 0, 0, _addr($iov), 1,
+		length $control? _addr($control) : 0, length $control, 0);
+}
+
+# send_fds($socket, $data, @handles_or_fd_numbers)
+sub send_fds {
+	my ($sock, $data, @fds)= @_;
+	fdpass_available() or croak "sendmsg not available";
+	$data= "$data";
+	my @nums= map { ref $_? fileno($_) : $_ } @fds;
+	my $control= '';
+	if (@nums) {
+		$control= pack('J i i i*', 16 + 4 * @nums, SOL_SOCKET, SCM_RIGHTS, @nums);
+		$control.= "\0" x (_align(length $control) - length $control);
+	}
+	my $iov= pack('J J', _addr($data), length $data);
+	my $msg= _msghdr($iov, $control);
+	my $n= syscall($SYS_sendmsg, fileno($sock), $msg, 0);
+	return $n < 0? undef : $n;
+}
+
+# ($data, @fd_numbers)= recv_fds($socket, $buflen, $max_fds)
+sub recv_fds {
+	my ($sock, $buflen, $max_fds)= @_;
+	fdpass_available() or croak "recvmsg not available";
+	my $buf= "\0" x ($buflen || 1024);
+	my $control= "\0" x _align(16 + 4 * ($max_fds || 16));
+	my $iov= pack('J J', _addr($buf), length $buf);
+	my $msg= _msghdr($iov, $control);
+	my $n= syscall($SYS_recvmsg, fileno($sock), $msg, 0);
+	return if $n < 0;
+	my $controllen= unpack('x40 J', $msg);
+	my @fds;
+	for (my $ofs= 0; $ofs + 16 <= $controllen; ) {
+		my ($len, $level, $type)= unpack("x$ofs J i i", $control);
+		last if $len < 16;
+		push @fds, unpack("x".($ofs+16)." i".(($len - 16) >> 2), $control)
+			if $level == SOL_SOCKET && $type == SCM_RIGHTS;
+		$ofs+= _align($len);
+	}
+	return (substr($buf, 0, $n), @fds);
+}
+
+1;